@@ -0,0 +1,1755 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <sdl/SDL.h>
+
+#include "platform.h"
+#include "math.h"
+#include "work_queue.h"
+#include "transform.h"
+#include "sw_render.h"
+
+/*	Headless benchmarks for the software renderer.
+ *	No window is created, SDL is only used for its timer and threads.
+ *
+ *	Usage: bench_main [golden directory]
+ *	With a golden directory, the last frame of every workload is compared with
+ *	<directory>/<workload>_<resolution>.ppm, or written there when the file
+ *	doesn't exist yet. Any mismatch makes the benchmark exit with 1. Workloads that
+ *	draw the same frame another way share its image, see GetGoldenWorkload. */
+
+typedef struct Resolution
+{
+	const char* name;
+	int width;
+	int height;
+} Resolution;
+
+static double GetSeconds(u64 counterDelta)
+{
+	return (double) counterDelta / (double) SDL_GetPerformanceFrequency();
+}
+
+static void BenchmarkClear(const Resolution* resolution)
+{
+	const int warmup = 10;
+	const int iterations = 200;
+
+	Renderer renderer = CreateRenderer(resolution->width, resolution->height);
+	BackBuffer* backBuffer = &renderer.backBuffer;
+	const double bytes = (double) backBuffer->pitch * backBuffer->height;
+
+	Color color;
+	color.r = 32;
+	color.g = 64;
+	color.b = 128;
+	color.a = 255;
+
+	/* memset is the roofline: it doesn't have to build a pixel pattern */
+	for (int i = 0; i < warmup; i++) {
+		memset(backBuffer->memory, i, (size_t) bytes);
+	}
+	u64 start = SDL_GetPerformanceCounter();
+	for (int i = 0; i < iterations; i++) {
+		memset(backBuffer->memory, i, (size_t) bytes);
+	}
+	const double memsetSeconds = GetSeconds(SDL_GetPerformanceCounter() - start) / iterations;
+
+	for (int i = 0; i < warmup; i++) {
+		ClearBackBuffer(&renderer, &color);
+	}
+	start = SDL_GetPerformanceCounter();
+	for (int i = 0; i < iterations; i++) {
+		color.r = (u8) i;
+		ClearBackBuffer(&renderer, &color);
+	}
+	const double clearSeconds = GetSeconds(SDL_GetPerformanceCounter() - start) / iterations;
+
+	/* Centered rect with a quarter of the pixels, not contiguous in memory */
+	Rect rect;
+	rect.xMin = resolution->width / 4;
+	rect.yMin = resolution->height / 4;
+	rect.xMax = rect.xMin + resolution->width / 2;
+	rect.yMax = rect.yMin + resolution->height / 2;
+	const double rectBytes = (double) (rect.xMax - rect.xMin) * (rect.yMax - rect.yMin) * 4;
+
+	for (int i = 0; i < warmup; i++) {
+		FillRect(&renderer, &rect, &color);
+	}
+	start = SDL_GetPerformanceCounter();
+	for (int i = 0; i < iterations; i++) {
+		color.g = (u8) i;
+		FillRect(&renderer, &rect, &color);
+	}
+	const double rectSeconds = GetSeconds(SDL_GetPerformanceCounter() - start) / iterations;
+
+	printf("%-6s memset %7.2f GB/s | ClearBackBuffer %7.2f GB/s (%5.1f%%) | FillRect %7.2f GB/s\n",
+		resolution->name,
+		bytes / memsetSeconds * 1e-9,
+		bytes / clearSeconds * 1e-9,
+		100.0 * memsetSeconds / clearSeconds,
+		rectBytes / rectSeconds * 1e-9);
+
+	DestroyRenderer(&renderer);
+}
+
+/*	Present: CopyBackBuffer into linear memory, as into a locked streaming texture, 
+ *	for both layouts. The swizzled layout has to be de-tiled on the way. 
+ *	Cache misses aren't counted here, run under e.g. perf stat -e cache-misses. */
+static void BenchmarkPresent(const Resolution* resolution)
+{
+	const int warmup = 10;
+	const int iterations = 200;
+
+	Renderer renderer = CreateRenderer(resolution->width, resolution->height);
+	const int pitch = resolution->width * (int) sizeof(Pixel);
+	const double bytes = (double) pitch * resolution->height;
+	void* memory = malloc((size_t) bytes);
+
+	/* memcpy of the whole buffer is the roofline */
+	for (int i = 0; i < warmup; i++) {
+		memcpy(memory, renderer.backBuffer.memory, (size_t) bytes);
+	}
+	u64 start = SDL_GetPerformanceCounter();
+	for (int i = 0; i < iterations; i++) {
+		memcpy(memory, renderer.backBuffer.memory, (size_t) bytes);
+	}
+	const double memcpySeconds = GetSeconds(SDL_GetPerformanceCounter() - start) / iterations;
+
+	double copySeconds[2];
+	for (int isSwizzled = 0; isSwizzled < 2; isSwizzled++) {
+		if (isSwizzled) {
+			EnableSwizzledLayout(&renderer);
+		}
+		for (int i = 0; i < warmup; i++) {
+			CopyBackBuffer(&renderer, memory, pitch);
+		}
+		start = SDL_GetPerformanceCounter();
+		for (int i = 0; i < iterations; i++) {
+			CopyBackBuffer(&renderer, memory, pitch);
+		}
+		copySeconds[isSwizzled] = GetSeconds(SDL_GetPerformanceCounter() - start) / iterations;
+	}
+
+	printf("%-6s memcpy %7.2f GB/s | linear %7.2f GB/s (%5.3f ms) | swizzled %7.2f GB/s (%5.3f ms)\n",
+		resolution->name,
+		bytes / memcpySeconds * 1e-9,
+		bytes / copySeconds[0] * 1e-9, copySeconds[0] * 1e3,
+		bytes / copySeconds[1] * 1e-9, copySeconds[1] * 1e3);
+
+	free(memory);
+	DestroyRenderer(&renderer);
+}
+
+/*	Math:
+ *	The Matrix4x4 operations of math.h against the element by element code they
+ *	replaced, kept here as the reference, and the batch kernels on streams against
+ *	the same operation element by element. Every kernel runs over arrays of
+ *	TQ_BENCH_MATH_COUNT operands (which fit in L2), the best of all runs counts. */
+#define TQ_BENCH_MATH_COUNT 4096
+
+typedef struct MathData
+{
+	Matrix4x4* lhs;
+	Matrix4x4* rhs;
+	Matrix4x4* affines;	/* lhs with last row 0, 0, 0, 1 */
+	Matrix4x4* rigids;	/* rotation and translation */
+	Vec4* vectors;
+	Vec4* others;
+	Matrix4x4* matrices;	/* results */
+	Vec4* results;
+	Vec4Stream stream;	/* vectors */
+	Vec4Stream otherStream;	/* others */
+	Vec4Stream streamResults;
+	Quaternion* rotations;	/* vectors, normalized */
+	Quaternion* otherRotations;	/* others, normalized */
+	Vec4Stream rotationStream;	/* rotations */
+	Vec4Stream otherRotationStream;	/* otherRotations */
+	int count;
+} MathData;
+
+typedef void MathKernel(MathData* data);
+
+static Matrix4x4 ReferenceMultiply(const Matrix4x4* lhs, const Matrix4x4* rhs)
+{
+	Matrix4x4 result;
+	for (int i = 0; i < 4; i++) {
+		for (int j = 0; j < 4; j++) {
+			result.values[4 * i + j] = lhs->values[4 * i] * rhs->values[j] 
+				+ lhs->values[4 * i + 1] * rhs->values[4 + j] 
+				+ lhs->values[4 * i + 2] * rhs->values[8 + j] 
+				+ lhs->values[4 * i + 3] * rhs->values[12 + j];
+		}
+	}
+	return result;
+}
+
+static Vec4 ReferenceTransform(const Matrix4x4* lhs, const Vec4* rhs)
+{
+	Vec4 result;
+	for (int i = 0; i < 4; i++) {
+		result.values[i] = lhs->values[4 * i] * rhs->x + lhs->values[4 * i + 1] * rhs->y 
+			+ lhs->values[4 * i + 2] * rhs->z + lhs->values[4 * i + 3] * rhs->w;
+	}
+	return result;
+}
+
+static Matrix4x4 ReferenceTranspose(const Matrix4x4* m)
+{
+	Matrix4x4 result;
+	for (int i = 0; i < 4; i++) {
+		for (int j = 0; j < 4; j++) {
+			result.values[4 * i + j] = m->values[4 * j + i];
+		}
+	}
+	return result;
+}
+
+/* The same 2x2 determinants as the scalar Inverse of math.h */
+static Matrix4x4 ReferenceInverse(const Matrix4x4* m)
+{
+	const float* a = m->values;
+	const float s0 = a[0] * a[5] - a[4] * a[1];
+	const float s1 = a[0] * a[6] - a[4] * a[2];
+	const float s2 = a[0] * a[7] - a[4] * a[3];
+	const float s3 = a[1] * a[6] - a[5] * a[2];
+	const float s4 = a[1] * a[7] - a[5] * a[3];
+	const float s5 = a[2] * a[7] - a[6] * a[3];
+	const float c5 = a[10] * a[15] - a[14] * a[11];
+	const float c4 = a[9] * a[15] - a[13] * a[11];
+	const float c3 = a[9] * a[14] - a[13] * a[10];
+	const float c2 = a[8] * a[15] - a[12] * a[11];
+	const float c1 = a[8] * a[14] - a[12] * a[10];
+	const float c0 = a[8] * a[13] - a[12] * a[9];
+	const float invDeterminant = 1.0f / (s0 * c5 - s1 * c4 + s2 * c3 + s3 * c2 - s4 * c1 + s5 * c0);
+	
+	const Matrix4x4 adjugate =
+	{
+		a[5] * c5 - a[6] * c4 + a[7] * c3, -a[1] * c5 + a[2] * c4 - a[3] * c3,
+		a[13] * s5 - a[14] * s4 + a[15] * s3, -a[9] * s5 + a[10] * s4 - a[11] * s3,
+		-a[4] * c5 + a[6] * c2 - a[7] * c1, a[0] * c5 - a[2] * c2 + a[3] * c1,
+		-a[12] * s5 + a[14] * s2 - a[15] * s1, a[8] * s5 - a[10] * s2 + a[11] * s1,
+		a[4] * c4 - a[5] * c2 + a[7] * c0, -a[0] * c4 + a[1] * c2 - a[3] * c0,
+		a[12] * s4 - a[13] * s2 + a[15] * s0, -a[8] * s4 + a[9] * s2 - a[11] * s0,
+		-a[4] * c3 + a[5] * c1 - a[6] * c0, a[0] * c3 - a[1] * c1 + a[2] * c0,
+		-a[12] * s3 + a[13] * s1 - a[14] * s0, a[8] * s3 - a[9] * s1 + a[10] * s0
+	};
+	
+	Matrix4x4 result;
+	for (int i = 0; i < 16; i++) {
+		result.values[i] = adjugate.values[i] * invDeterminant;
+	}
+	return result;
+}
+
+static void MultiplyReference(MathData* data)
+{
+	for (int i = 0; i < data->count; i++) {
+		data->matrices[i] = ReferenceMultiply(&data->lhs[i], &data->rhs[i]);
+	}
+}
+
+static void MultiplyEach(MathData* data)
+{
+	for (int i = 0; i < data->count; i++) {
+		data->matrices[i] = data->lhs[i] * data->rhs[i];
+	}
+}
+
+/* Many vectors by the same matrix, like the vertex transform of DrawTriangles */
+static void TransformReference(MathData* data)
+{
+	const Matrix4x4 transform = data->lhs[0];
+	for (int i = 0; i < data->count; i++) {
+		data->results[i] = ReferenceTransform(&transform, &data->vectors[i]);
+	}
+}
+
+static void TransformEach(MathData* data)
+{
+	const Matrix4x4 transform = data->lhs[0];
+	for (int i = 0; i < data->count; i++) {
+		data->results[i] = transform * data->vectors[i];
+	}
+}
+
+static void TransformArray(MathData* data)
+{
+	Transform(data->lhs[0], data->vectors, data->results, data->count);
+}
+
+static void TransposeReference(MathData* data)
+{
+	for (int i = 0; i < data->count; i++) {
+		data->matrices[i] = ReferenceTranspose(&data->lhs[i]);
+	}
+}
+
+static void TransposeEach(MathData* data)
+{
+	for (int i = 0; i < data->count; i++) {
+		data->matrices[i] = Transpose(data->lhs[i]);
+	}
+}
+
+static void InverseReference(MathData* data)
+{
+	for (int i = 0; i < data->count; i++) {
+		data->matrices[i] = ReferenceInverse(&data->lhs[i]);
+	}
+}
+
+static void InverseEach(MathData* data)
+{
+	for (int i = 0; i < data->count; i++) {
+		data->matrices[i] = Inverse(data->lhs[i]);
+	}
+}
+
+/* The special inverses against the general one on the same matrices */
+static void AffineInverseReference(MathData* data)
+{
+	for (int i = 0; i < data->count; i++) {
+		data->matrices[i] = Inverse(data->affines[i]);
+	}
+}
+
+static void AffineInverseEach(MathData* data)
+{
+	for (int i = 0; i < data->count; i++) {
+		data->matrices[i] = AffineInverse(data->affines[i]);
+	}
+}
+
+static void RigidInverseReference(MathData* data)
+{
+	for (int i = 0; i < data->count; i++) {
+		data->matrices[i] = Inverse(data->rigids[i]);
+	}
+}
+
+static void RigidInverseEach(MathData* data)
+{
+	for (int i = 0; i < data->count; i++) {
+		data->matrices[i] = RigidInverse(data->rigids[i]);
+	}
+}
+
+static void NormalMatrixReference(MathData* data)
+{
+	for (int i = 0; i < data->count; i++) {
+		Matrix4x4 result = Transpose(Inverse(data->affines[i]));
+		result.a14 = 0.0f;
+		result.a24 = 0.0f;
+		result.a34 = 0.0f;
+		result.a41 = 0.0f;
+		result.a42 = 0.0f;
+		result.a43 = 0.0f;
+		data->matrices[i] = result;
+	}
+}
+
+static void NormalMatrixEach(MathData* data)
+{
+	for (int i = 0; i < data->count; i++) {
+		data->matrices[i] = NormalMatrix4x4(data->affines[i]);
+	}
+}
+
+static Vec3 GetXYZ(const Vec4* v)
+{
+	const Vec3 result = { v->x, v->y, v->z };
+	return result;
+}
+
+static Vec3Stream GetXYZStream(const Vec4Stream* stream)
+{
+	const Vec3Stream result = { stream->x, stream->y, stream->z, stream->count };
+	return result;
+}
+
+static void TransformStream(MathData* data)
+{
+	const Matrix4x4 transform = data->lhs[0];
+	Transform(transform, data->stream, &data->streamResults);
+}
+
+static void NormalizeEach(MathData* data)
+{
+	for (int i = 0; i < data->count; i++) {
+		const Vec3 normal = Normalized(GetXYZ(&data->vectors[i]));
+		data->results[i].x = normal.x;
+		data->results[i].y = normal.y;
+		data->results[i].z = normal.z;
+	}
+}
+
+static void NormalizeStream(MathData* data)
+{
+	Vec3Stream results = GetXYZStream(&data->streamResults);
+	Normalize(GetXYZStream(&data->stream), &results);
+}
+
+static void DotEach(MathData* data)
+{
+	for (int i = 0; i < data->count; i++) {
+		data->results[i].x = Dot(GetXYZ(&data->vectors[i]), GetXYZ(&data->others[i]));
+	}
+}
+
+static void DotStream(MathData* data)
+{
+	Dot(GetXYZStream(&data->stream), GetXYZStream(&data->otherStream), data->streamResults.x);
+}
+
+static void CrossEach(MathData* data)
+{
+	for (int i = 0; i < data->count; i++) {
+		const Vec3 cross = Cross(GetXYZ(&data->vectors[i]), GetXYZ(&data->others[i]));
+		data->results[i].x = cross.x;
+		data->results[i].y = cross.y;
+		data->results[i].z = cross.z;
+	}
+}
+
+static void CrossStream(MathData* data)
+{
+	Vec3Stream results = GetXYZStream(&data->streamResults);
+	Cross(GetXYZStream(&data->stream), GetXYZStream(&data->otherStream), &results);
+}
+
+/* Clip space to screen space like the vertex transform of DrawTriangles */
+static void ProjectEach(MathData* data)
+{
+	const Matrix4x4 viewport = ViewportMatrix4x4(0, 0, 1920, 1080);
+	for (int i = 0; i < data->count; i++) {
+		Vec4 ndc = PerspectiveDivide(data->vectors[i]);
+		const float w = ndc.w;
+		ndc.w = 1.0f;
+		data->results[i] = viewport * ndc;
+		data->results[i].w = w;
+	}
+}
+
+static void ProjectStream(MathData* data)
+{
+	PerspectiveDivide(data->stream, &data->streamResults);
+	Viewport(0, 0, 1920, 1080, data->streamResults, &data->streamResults);
+}
+
+static Vec4 GetXYZW(const Quaternion* q)
+{
+	const Vec4 result = { q->x, q->y, q->z, q->w };
+	return result;
+}
+
+static QuaternionStream GetQuaternionStream(const Vec4Stream* stream)
+{
+	const QuaternionStream result = { stream->x, stream->y, stream->z, stream->w, stream->count };
+	return result;
+}
+
+/* Blending two poses of a skeleton with the same amount for every joint */
+static void NlerpEach(MathData* data)
+{
+	for (int i = 0; i < data->count; i++) {
+		const Quaternion rotation = Nlerp(data->rotations[i], data->otherRotations[i], 0.3f);
+		data->results[i] = GetXYZW(&rotation);
+	}
+}
+
+static void NlerpStream(MathData* data)
+{
+	QuaternionStream results = GetQuaternionStream(&data->streamResults);
+	Nlerp(GetQuaternionStream(&data->rotationStream), GetQuaternionStream(&data->otherRotationStream), 
+		0.3f, &results);
+}
+
+static void SlerpEach(MathData* data)
+{
+	for (int i = 0; i < data->count; i++) {
+		const Quaternion rotation = Slerp(data->rotations[i], data->otherRotations[i], 0.3f);
+		data->results[i] = GetXYZW(&rotation);
+	}
+}
+
+static void SlerpStream(MathData* data)
+{
+	QuaternionStream results = GetQuaternionStream(&data->streamResults);
+	Slerp(GetQuaternionStream(&data->rotationStream), GetQuaternionStream(&data->otherRotationStream), 
+		0.3f, &results);
+}
+
+static void RotateEach(MathData* data)
+{
+	for (int i = 0; i < data->count; i++) {
+		const Vec3 rotated = Rotated(GetXYZ(&data->vectors[i]), data->rotations[i]);
+		data->results[i].x = rotated.x;
+		data->results[i].y = rotated.y;
+		data->results[i].z = rotated.z;
+	}
+}
+
+static void RotateStream(MathData* data)
+{
+	Vec3Stream results = GetXYZStream(&data->streamResults);
+	Rotate(GetXYZStream(&data->stream), GetQuaternionStream(&data->rotationStream), &results);
+}
+
+static void RotationMatricesEach(MathData* data)
+{
+	for (int i = 0; i < data->count; i++) {
+		data->matrices[i] = CreateMatrix4x4(data->rotations[i]);
+	}
+}
+
+static void RotationMatricesStream(MathData* data)
+{
+	CreateMatrix4x4(GetQuaternionStream(&data->rotationStream), data->matrices);
+}
+
+/* Returns the best time per operand in seconds */
+static double MeasureMathKernel(MathKernel* kernel, MathData* data)
+{
+	const int warmup = 10;
+	const int iterations = 200;
+	
+	for (int i = 0; i < warmup; i++) {
+		kernel(data);
+	}
+	double best = 1e30;
+	for (int i = 0; i < iterations; i++) {
+		const u64 start = SDL_GetPerformanceCounter();
+		kernel(data);
+		const double seconds = GetSeconds(SDL_GetPerformanceCounter() - start);
+		best = seconds < best ? seconds : best;
+	}
+	return best / data->count;
+}
+
+/* Largest difference between the results of kernel and reference */
+static void BenchmarkMathKernel(const char* name, MathKernel* reference, MathKernel* kernel, 
+	MathData* data, bool isVector)
+{
+	const int numFloats = data->count * (isVector ? 4 : 16);
+	float* const results = isVector ? data->results[0].values : data->matrices[0].values;
+	float* const expected = (float*) malloc(sizeof(float) * numFloats);
+	
+	const double referenceSeconds = MeasureMathKernel(reference, data);
+	memcpy(expected, results, sizeof(float) * numFloats);
+	const double seconds = MeasureMathKernel(kernel, data);
+	
+	float maxDifference = 0.0f;
+	for (int i = 0; i < numFloats; i++) {
+		const float difference = fabsf(results[i] - expected[i]);
+		maxDifference = difference > maxDifference ? difference : maxDifference;
+	}
+	free(expected);
+	
+	printf("%-20s reference %7.2f ns | math.h %7.2f ns | %5.2fx | max difference %g\n",
+		name, referenceSeconds * 1e9, seconds * 1e9, referenceSeconds / seconds, maxDifference);
+}
+
+/* Same as BenchmarkMathKernel, comparing the first numComponents of the results */
+static void BenchmarkStreamKernel(const char* name, MathKernel* reference, MathKernel* kernel, 
+	MathData* data, int numComponents)
+{
+	const double referenceSeconds = MeasureMathKernel(reference, data);
+	const double seconds = MeasureMathKernel(kernel, data);
+	
+	float maxDifference = 0.0f;
+	for (int i = 0; i < data->count; i++) {
+		const Vec4 result = GetStreamElement(data->streamResults, i);
+		for (int j = 0; j < numComponents; j++) {
+			const float difference = fabsf(result.values[j] - data->results[i].values[j]);
+			maxDifference = difference > maxDifference ? difference : maxDifference;
+		}
+	}
+	
+	printf("%-20s each %7.2f ns | stream %7.2f ns | %5.2fx | max difference %g\n",
+		name, referenceSeconds * 1e9, seconds * 1e9, referenceSeconds / seconds, maxDifference);
+}
+
+static Vec4Stream CreateVec4Stream(int count)
+{
+	Vec4Stream result;
+	result.x = (float*) malloc(sizeof(float) * count);
+	result.y = (float*) malloc(sizeof(float) * count);
+	result.z = (float*) malloc(sizeof(float) * count);
+	result.w = (float*) malloc(sizeof(float) * count);
+	result.count = count;
+	return result;
+}
+
+static void DestroyVec4Stream(Vec4Stream* stream)
+{
+	free(stream->x);
+	free(stream->y);
+	free(stream->z);
+	free(stream->w);
+}
+
+static void BenchmarkMath(void)
+{
+	MathData data;
+	data.count = TQ_BENCH_MATH_COUNT;
+	data.lhs = (Matrix4x4*) malloc(sizeof(Matrix4x4) * data.count);
+	data.rhs = (Matrix4x4*) malloc(sizeof(Matrix4x4) * data.count);
+	data.affines = (Matrix4x4*) malloc(sizeof(Matrix4x4) * data.count);
+	data.rigids = (Matrix4x4*) malloc(sizeof(Matrix4x4) * data.count);
+	data.vectors = (Vec4*) malloc(sizeof(Vec4) * data.count);
+	data.others = (Vec4*) malloc(sizeof(Vec4) * data.count);
+	data.matrices = (Matrix4x4*) malloc(sizeof(Matrix4x4) * data.count);
+	data.results = (Vec4*) malloc(sizeof(Vec4) * data.count);
+	data.rotations = (Quaternion*) malloc(sizeof(Quaternion) * data.count);
+	data.otherRotations = (Quaternion*) malloc(sizeof(Quaternion) * data.count);
+	
+	/* Fixed seed, strong diagonals so every lhs is well conditioned */
+	u32 state = 0x12345678;
+	for (int i = 0; i < data.count; i++) {
+		for (int j = 0; j < 16; j++) {
+			state = state * 1664525 + 1013904223;
+			data.lhs[i].values[j] = (float) (state >> 8) / (1 << 24) - 0.5f + ((j % 5 == 0) ? 4.0f : 0.0f);
+			state = state * 1664525 + 1013904223;
+			data.rhs[i].values[j] = (float) (state >> 8) / (1 << 24) - 0.5f;
+		}
+		for (int j = 0; j < 4; j++) {
+			state = state * 1664525 + 1013904223;
+			data.vectors[i].values[j] = (float) (state >> 8) / (1 << 24) * 100.0f - 50.0f;
+			state = state * 1664525 + 1013904223;
+			data.others[i].values[j] = (float) (state >> 8) / (1 << 24) * 100.0f - 50.0f;
+		}
+		
+		data.affines[i] = data.lhs[i];
+		data.affines[i].a41 = 0.0f;
+		data.affines[i].a42 = 0.0f;
+		data.affines[i].a43 = 0.0f;
+		data.affines[i].a44 = 1.0f;
+		const Quaternion rotation = { data.vectors[i].x, data.vectors[i].y, data.vectors[i].z, data.vectors[i].w };
+		const Quaternion otherRotation = { data.others[i].x, data.others[i].y, data.others[i].z, data.others[i].w };
+		data.rotations[i] = Normalized(rotation);
+		data.otherRotations[i] = Normalized(otherRotation);
+		const Vec3 translation = { data.others[i].x, data.others[i].y, data.others[i].z };
+		data.rigids[i] = Translate(CreateMatrix4x4(data.rotations[i]), translation);
+	}
+	data.stream = CreateVec4Stream(data.count);
+	data.otherStream = CreateVec4Stream(data.count);
+	data.streamResults = CreateVec4Stream(data.count);
+	ToStream(data.vectors, &data.stream);
+	ToStream(data.others, &data.otherStream);
+	data.rotationStream = CreateVec4Stream(data.count);
+	data.otherRotationStream = CreateVec4Stream(data.count);
+	QuaternionStream rotationStream = GetQuaternionStream(&data.rotationStream);
+	QuaternionStream otherRotationStream = GetQuaternionStream(&data.otherRotationStream);
+	ToStream(data.rotations, &rotationStream);
+	ToStream(data.otherRotations, &otherRotationStream);
+	
+#if defined(TQ_AVX)
+	printf("Math (AVX)\n");
+#elif defined(TQ_SSE2)
+	printf("Math (SSE2)\n");
+#else
+	printf("Math (scalar)\n");
+#endif
+	BenchmarkMathKernel("Matrix4x4 * Matrix4x4", MultiplyReference, MultiplyEach, &data, false);
+	BenchmarkMathKernel("Transform Vec4 array", TransformReference, TransformArray, &data, true);
+	BenchmarkMathKernel("Transpose", TransposeReference, TransposeEach, &data, false);
+	BenchmarkMathKernel("Inverse", InverseReference, InverseEach, &data, false);
+	printf("Against the general Inverse\n");
+	BenchmarkMathKernel("AffineInverse", AffineInverseReference, AffineInverseEach, &data, false);
+	BenchmarkMathKernel("RigidInverse", RigidInverseReference, RigidInverseEach, &data, false);
+	BenchmarkMathKernel("NormalMatrix4x4", NormalMatrixReference, NormalMatrixEach, &data, false);
+	
+	printf("Streams (%d lanes)\n", TQ_LANES);
+	BenchmarkStreamKernel("Transform", TransformEach, TransformStream, &data, 4);
+	BenchmarkStreamKernel("Normalize", NormalizeEach, NormalizeStream, &data, 3);
+	BenchmarkStreamKernel("Dot", DotEach, DotStream, &data, 1);
+	BenchmarkStreamKernel("Cross", CrossEach, CrossStream, &data, 3);
+	BenchmarkStreamKernel("Divide and viewport", ProjectEach, ProjectStream, &data, 4);
+	BenchmarkStreamKernel("Nlerp", NlerpEach, NlerpStream, &data, 4);
+	BenchmarkStreamKernel("Slerp", SlerpEach, SlerpStream, &data, 4);
+	BenchmarkStreamKernel("Rotate", RotateEach, RotateStream, &data, 3);
+	BenchmarkMathKernel("CreateMatrix4x4", RotationMatricesEach, RotationMatricesStream, &data, false);
+	
+	DestroyVec4Stream(&data.stream);
+	DestroyVec4Stream(&data.otherStream);
+	DestroyVec4Stream(&data.streamResults);
+	DestroyVec4Stream(&data.rotationStream);
+	DestroyVec4Stream(&data.otherRotationStream);
+	free(data.lhs);
+	free(data.rhs);
+	free(data.affines);
+	free(data.rigids);
+	free(data.vectors);
+	free(data.others);
+	free(data.matrices);
+	free(data.results);
+	free(data.rotations);
+	free(data.otherRotations);
+}
+
+/*	Workloads:
+ *	Canned screen space geometry or a 3D scene (see CreateScene), generated once 
+ *	per resolution from a fixed seed so every run (and every golden image) draws 
+ *	exactly the same frame. */
+typedef enum WorkloadType
+{
+	WORKLOAD_CLEAR,
+	WORKLOAD_SMALL_TRIANGLES,
+	WORKLOAD_LARGE_TRIANGLES,
+	WORKLOAD_LONG_LINES,
+	WORKLOAD_BLENDED_TRIANGLES,
+	WORKLOAD_MULTISAMPLED_TRIANGLES,
+	WORKLOAD_SUPERSAMPLED_TRIANGLES,
+	WORKLOAD_DIRTY_RECTS,
+	WORKLOAD_PERSPECTIVE_TRIANGLES,
+	WORKLOAD_TEXTURED_TRIANGLES,
+	WORKLOAD_COLORED_TRIANGLES,
+	WORKLOAD_SHADER_TRIANGLES,
+	WORKLOAD_CULLED_TRIANGLES,
+	WORKLOAD_COUNT
+} WorkloadType;
+
+static const char* workloadNames[WORKLOAD_COUNT] =
+{
+	"clear",
+	"small_triangles",
+	"large_triangles",
+	"long_lines",
+	"blended_triangles",
+	"msaa_triangles",
+	"ssaa_triangles",
+	"dirty_rects",
+	"perspective_triangles",
+	"textured_triangles",
+	"colored_triangles",
+	"shader_triangles",
+	"culled_triangles"
+};
+
+/*	The meshes of the 3D workloads, see CreateScene. Quads of 4 vertices, so
+ *	every face has its own uvs. */
+typedef struct Mesh
+{
+	Vec4* positions;
+	Vec4* colors;	/* per vertex, rgba in [0, 1] */
+	Vec2* uvs;
+	int numVertices;
+	u32* indices;
+	int numIndices;
+} Mesh;
+
+/* What the shaders of shader_triangles read, one per mesh */
+typedef struct SceneUniforms
+{
+	const Matrix4x4* transform;
+	const Vec4* positions;
+	const Vec4* colors;
+} SceneUniforms;
+
+typedef struct Workload
+{
+	WorkloadType type;
+	int* coordinates;	/* x, y pairs: 3 per triangle, 2 per line */
+	Color* colors;	/* 1 per primitive, 1 per mesh for the 3D workloads */
+	int numPrimitives;
+	double pixels;	/* pixels written per frame, overdraw included, the screen for 3D */
+	
+	/* 3D workloads: numCubes cubes, then the floor */
+	Mesh cube;
+	Mesh floor;
+	Matrix4x4* transforms;	/* model-view-projection per mesh */
+	int numCubes;
+	Texture texture;
+	SceneUniforms* uniforms;	/* per mesh, read until the flush when tiled */
+	Shader* shaders;
+	
+	/* ssaa_triangles: the frame averaged down to the resolution, see DownsampleBackBuffer */
+	BackBuffer resolved;
+} Workload;
+
+static u32 NextRandom(u32* state)
+{
+	/* xorshift32 */
+	u32 x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*state = x;
+	return x;
+}
+
+static int RandomInRange(u32* state, int min, int max)
+{
+	return min + (int) (NextRandom(state) % (u32) (max - min + 1));
+}
+
+/*	dirty_rects moves a widget of a quarter of the screen along x by this many 
+ *	pixels every frame */
+#define TQ_BENCH_WIDGET_STEP 16
+
+static Rect GetWidgetRect(const BackBuffer* const backBuffer, int frame)
+{
+	const int width = backBuffer->width / 4;
+	const int height = backBuffer->height / 4;
+	const int x = (frame * TQ_BENCH_WIDGET_STEP) % (backBuffer->width - width);
+	const Rect result = { x, height, x + width, 2 * height };
+	return result;
+}
+
+/*	Scene of the 3D workloads: TQ_BENCH_CUBES_PER_ROW^2 cubes on a floor, seen
+ *	in perspective from right above the front row. The floor and the front row
+ *	cross the near plane and the sides of the screen, so they are clipped, the 
+ *	rows in the back are only a few pixels big. culled_triangles stands in the 
+ *	middle of the cubes instead, so most of them are behind or beside the camera 
+ *	and are dropped by CullBoundingSphere. */
+#define TQ_BENCH_CUBES_PER_ROW 16
+#define TQ_BENCH_CUBE_SPACING 3.0f
+#define TQ_BENCH_CUBE_RADIUS 0.8660254f	/* of the unit cube, sqrt(3) / 2 */
+#define TQ_BENCH_FLOOR_QUADS 8	/* per side */
+#define TQ_BENCH_TEXTURE_SIZE 64
+
+static Mesh CreateMesh(int numQuads)
+{
+	Mesh result;
+	result.positions = (Vec4*) malloc(sizeof(Vec4) * 4 * numQuads);
+	result.colors = (Vec4*) malloc(sizeof(Vec4) * 4 * numQuads);
+	result.uvs = (Vec2*) malloc(sizeof(Vec2) * 4 * numQuads);
+	result.indices = (u32*) malloc(sizeof(u32) * 6 * numQuads);
+	result.numVertices = 0;
+	result.numIndices = 0;
+	return result;
+}
+
+static void DestroyMesh(Mesh* mesh)
+{
+	free(mesh->positions);
+	free(mesh->colors);
+	free(mesh->uvs);
+	free(mesh->indices);
+}
+
+/*	Square of size x size around center, facing along normal, with up along one
+ *	of its sides. Counter-clockwise seen from the front, so it's a front face,
+ *	and uv goes from 0 to uvScale along each side. */
+static void AddQuad(Mesh* mesh, const Vec3& center, const Vec3& normal, const Vec3& up,
+	float size, float uvScale)
+{
+	const Vec3 right = Cross(up, -normal);
+	const float corners[4][2] = { { -1.0f, -1.0f }, { 1.0f, -1.0f }, { 1.0f, 1.0f }, { -1.0f, 1.0f } };
+	const u32 first = (u32) mesh->numVertices;
+	
+	for (int i = 0; i < 4; i++) {
+		const Vec3 p = center + (0.5f * size * corners[i][0]) * right + (0.5f * size * corners[i][1]) * up;
+		const Vec4 position = { p.x, p.y, p.z, 1.0f };
+		const Vec2 uv = { 0.5f * (corners[i][0] + 1.0f) * uvScale, 0.5f * (1.0f - corners[i][1]) * uvScale };
+		mesh->positions[first + i] = position;
+		mesh->uvs[first + i] = uv;
+	}
+	mesh->numVertices += 4;
+	
+	const u32 quad[6] = { 0, 1, 2, 0, 2, 3 };
+	for (int i = 0; i < 6; i++) {
+		mesh->indices[mesh->numIndices++] = first + quad[i];
+	}
+}
+
+/* Vertex colors: the position in the box at boxMin, so faces get gradients */
+static void SetBoxColors(Mesh* mesh, const Vec3& boxMin, const Vec3& boxSize)
+{
+	for (int i = 0; i < mesh->numVertices; i++) {
+		const Vec4* const p = &mesh->positions[i];
+		const Vec4 color = {
+			(p->x - boxMin.x) / boxSize.x,
+			(p->y - boxMin.y) / boxSize.y,
+			(p->z - boxMin.z) / boxSize.z,
+			1.0f
+		};
+		mesh->colors[i] = color;
+	}
+}
+
+/*	The shaders of shader_triangles: the vertex colors, interpolated and converted
+ *	like the built-in stages do, so the frame is the one of colored_triangles */
+static Vec4 SceneVertexShader(const void* uniforms, u32 index, float* varyings)
+{
+	const SceneUniforms* const scene = (const SceneUniforms*) uniforms;
+	for (int i = 0; i < 4; i++) {
+		varyings[VARYING_COLOR + i] = scene->colors[index].values[i];
+	}
+	return *scene->transform * scene->positions[index];
+}
+
+static void SceneFragmentShader(const FragmentSpan* span, Pixel* colors)
+{
+	PackSpanColors(span, VARYING_COLOR, colors);
+}
+
+static void CreateScene(Workload* workload, int width, int height)
+{
+	/* Unit cube at the origin */
+	const Vec3 axes[3] = { { 1.0f, 0.0f, 0.0f }, { 0.0f, 1.0f, 0.0f }, { 0.0f, 0.0f, 1.0f } };
+	workload->cube = CreateMesh(6);
+	for (int i = 0; i < 6; i++) {
+		const Vec3 normal = (i & 1) ? -axes[i / 2] : axes[i / 2];
+		const Vec3& up = (i / 2 == 1) ? axes[2] : axes[1];
+		AddQuad(&workload->cube, 0.5f * normal, normal, up, 1.0f, 1.0f);
+	}
+	const Vec3 cubeMin = { -0.5f, -0.5f, -0.5f };
+	const Vec3 cubeSize = { 1.0f, 1.0f, 1.0f };
+	SetBoxColors(&workload->cube, cubeMin, cubeSize);
+	
+	/* The floor below all cubes, the texture repeats 4 times per quad */
+	const float rowLength = TQ_BENCH_CUBES_PER_ROW * TQ_BENCH_CUBE_SPACING;
+	const float quadSize = rowLength / TQ_BENCH_FLOOR_QUADS;
+	workload->floor = CreateMesh(TQ_BENCH_FLOOR_QUADS * TQ_BENCH_FLOOR_QUADS);
+	for (int z = 0; z < TQ_BENCH_FLOOR_QUADS; z++) {
+		for (int x = 0; x < TQ_BENCH_FLOOR_QUADS; x++) {
+			const Vec3 center = { (x + 0.5f) * quadSize - 0.5f * rowLength, 0.0f, (z + 0.5f) * quadSize - 2.0f };
+			AddQuad(&workload->floor, center, axes[1], axes[2], quadSize, 4.0f);
+		}
+	}
+	const Vec3 floorMin = { -0.5f * rowLength, -1.0f, -2.0f };
+	const Vec3 floorSize = { rowLength, 2.0f, rowLength };
+	SetBoxColors(&workload->floor, floorMin, floorSize);
+	
+	/* The camera looks along +z and 25 degrees down, from above the first row */
+	Vec3 eye = { 0.0f, 2.5f, 0.0f };
+	if (workload->type == WORKLOAD_CULLED_TRIANGLES) {
+		eye.z = 0.5f * (TQ_BENCH_CUBES_PER_ROW - 1) * TQ_BENCH_CUBE_SPACING;
+	}
+	const Matrix4x4 view = CreateMatrix4x4(QuaternionFromAxis(axes[0], -25.0f)) * Translate(-eye);
+	const Matrix4x4 viewProjection = Perspective(60.0f, (float) width / height, 0.25f, 100.0f) * view;
+	
+	workload->numCubes = TQ_BENCH_CUBES_PER_ROW * TQ_BENCH_CUBES_PER_ROW;
+	workload->transforms = (Matrix4x4*) malloc(sizeof(Matrix4x4) * (workload->numCubes + 1));
+	workload->colors = (Color*) malloc(sizeof(Color) * (workload->numCubes + 1));
+	
+	u32 random = 0x9E3779B9u;
+	const Vec3 cubeScale = { 1.5f, 1.5f, 1.5f };
+	for (int i = 0; i < workload->numCubes; i++) {
+		const int row = i / TQ_BENCH_CUBES_PER_ROW;
+		const int column = i % TQ_BENCH_CUBES_PER_ROW;
+		const Vec3 position = {
+			(column - 0.5f * (TQ_BENCH_CUBES_PER_ROW - 1)) * TQ_BENCH_CUBE_SPACING,
+			0.75f,
+			row * TQ_BENCH_CUBE_SPACING
+		};
+		const Quaternion rotation = QuaternionFromAxis(axes[1], (float) RandomInRange(&random, 0, 359));
+		workload->transforms[i] = viewProjection * CreateMatrix4x4(position, rotation, cubeScale);
+		
+		const u32 rgb = NextRandom(&random);
+		workload->colors[i].r = (u8) rgb;
+		workload->colors[i].g = (u8) (rgb >> 8);
+		workload->colors[i].b = (u8) (rgb >> 16);
+		workload->colors[i].a = 255;
+	}
+	workload->transforms[workload->numCubes] = viewProjection;
+	workload->colors[workload->numCubes].r = 96;
+	workload->colors[workload->numCubes].g = 96;
+	workload->colors[workload->numCubes].b = 96;
+	workload->colors[workload->numCubes].a = 255;
+	
+	workload->numPrimitives = (workload->numCubes * workload->cube.numIndices + workload->floor.numIndices) / 3;
+	
+	workload->uniforms = (SceneUniforms*) malloc(sizeof(SceneUniforms) * (workload->numCubes + 1));
+	workload->shaders = (Shader*) malloc(sizeof(Shader) * (workload->numCubes + 1));
+	for (int i = 0; i <= workload->numCubes; i++) {
+		const Mesh* const mesh = (i < workload->numCubes) ? &workload->cube : &workload->floor;
+		workload->uniforms[i].transform = &workload->transforms[i];
+		workload->uniforms[i].positions = mesh->positions;
+		workload->uniforms[i].colors = mesh->colors;
+		workload->shaders[i].vertex = SceneVertexShader;
+		workload->shaders[i].fragment = SceneFragmentShader;
+		workload->shaders[i].numVaryings = 4;
+		workload->shaders[i].uniforms = &workload->uniforms[i];
+	}
+	
+	/* Checkers over a gradient, so every mip level looks different */
+	Pixel* texels = (Pixel*) malloc(sizeof(Pixel) * TQ_BENCH_TEXTURE_SIZE * TQ_BENCH_TEXTURE_SIZE);
+	for (int y = 0; y < TQ_BENCH_TEXTURE_SIZE; y++) {
+		for (int x = 0; x < TQ_BENCH_TEXTURE_SIZE; x++) {
+			Color color = { 255, 255, 255, 255 };
+			if (((x / 8) ^ (y / 8)) & 1) {
+				color.r = (u8) (x * 256 / TQ_BENCH_TEXTURE_SIZE);
+				color.g = (u8) (y * 256 / TQ_BENCH_TEXTURE_SIZE);
+				color.b = 128;
+			}
+			texels[y * TQ_BENCH_TEXTURE_SIZE + x] = PackColor(&color);
+		}
+	}
+	workload->texture = CreateTexture(texels, TQ_BENCH_TEXTURE_SIZE, TQ_BENCH_TEXTURE_SIZE);
+	free(texels);
+}
+
+static bool IsSceneWorkload(WorkloadType type)
+{
+	return type == WORKLOAD_PERSPECTIVE_TRIANGLES || type == WORKLOAD_TEXTURED_TRIANGLES
+		|| type == WORKLOAD_COLORED_TRIANGLES || type == WORKLOAD_SHADER_TRIANGLES
+		|| type == WORKLOAD_CULLED_TRIANGLES;
+}
+
+/* The workload a workload is compared with, the type itself when there's none */
+static WorkloadType GetReferenceWorkload(WorkloadType type)
+{
+	switch (type) {
+		case WORKLOAD_TEXTURED_TRIANGLES: return WORKLOAD_PERSPECTIVE_TRIANGLES;
+		case WORKLOAD_COLORED_TRIANGLES: return WORKLOAD_PERSPECTIVE_TRIANGLES;
+		case WORKLOAD_SHADER_TRIANGLES: return WORKLOAD_COLORED_TRIANGLES;
+		case WORKLOAD_SUPERSAMPLED_TRIANGLES: return WORKLOAD_MULTISAMPLED_TRIANGLES;
+		default: return type;
+	}
+}
+
+/* The workload whose golden image a workload has to match, the type itself when it has its own */
+static WorkloadType GetGoldenWorkload(WorkloadType type)
+{
+	switch (type) {
+		case WORKLOAD_SHADER_TRIANGLES: return WORKLOAD_COLORED_TRIANGLES;
+		default: return type;
+	}
+}
+
+static Workload CreateWorkload(WorkloadType type, int width, int height)
+{
+	Workload result;
+	result.type = type;
+	result.coordinates = NULL;
+	result.colors = NULL;
+	result.numPrimitives = 0;
+	result.pixels = (double) width * height;
+	result.transforms = NULL;
+	result.numCubes = 0;
+	result.uniforms = NULL;
+	result.shaders = NULL;
+	result.resolved.memory = NULL;
+	
+	if (IsSceneWorkload(type)) {
+		CreateScene(&result, width, height);
+		return result;
+	}
+	
+	int verticesPerPrimitive = 3;
+	switch (type) {
+		case WORKLOAD_SMALL_TRIANGLES: result.numPrimitives = 50000; break;
+		case WORKLOAD_LARGE_TRIANGLES: result.numPrimitives = 16; break;
+		case WORKLOAD_LONG_LINES: result.numPrimitives = 1000; verticesPerPrimitive = 2; break;
+		case WORKLOAD_BLENDED_TRIANGLES: result.numPrimitives = 16; break;
+		case WORKLOAD_MULTISAMPLED_TRIANGLES: result.numPrimitives = 16; break;
+		case WORKLOAD_SUPERSAMPLED_TRIANGLES: result.numPrimitives = 16; break;
+		case WORKLOAD_DIRTY_RECTS: result.numPrimitives = 16; break;
+		default: return result;
+	}
+	
+	result.coordinates = (int*) malloc(sizeof(int) * 2 * verticesPerPrimitive * result.numPrimitives);
+	result.colors = (Color*) malloc(sizeof(Color) * result.numPrimitives);
+	result.pixels = 0.0;
+	
+	u32 random = 0x9E3779B9u;
+	for (int i = 0; i < result.numPrimitives; i++) {
+		int* v = result.coordinates + 2 * verticesPerPrimitive * i;
+		
+		if (type == WORKLOAD_SMALL_TRIANGLES) {
+			/* Up to 6x6 pixels, about 9 pixels of area on average */
+			const int x = RandomInRange(&random, 0, width - 7);
+			const int y = RandomInRange(&random, 0, height - 7);
+			for (int j = 0; j < 3; j++) {
+				v[2 * j] = x + RandomInRange(&random, 0, 6);
+				v[2 * j + 1] = y + RandomInRange(&random, 0, 6);
+			}
+		} else if (type == WORKLOAD_LARGE_TRIANGLES || type == WORKLOAD_BLENDED_TRIANGLES
+			|| type == WORKLOAD_MULTISAMPLED_TRIANGLES || type == WORKLOAD_SUPERSAMPLED_TRIANGLES
+			|| type == WORKLOAD_DIRTY_RECTS) {
+			/* One corner of the screen to points on the two opposite edges, half the screen each */
+			const int cornerX = (i & 1) ? width - 1 : 0;
+			const int cornerY = (i & 2) ? height - 1 : 0;
+			v[0] = cornerX;
+			v[1] = cornerY;
+			v[2] = width - 1 - cornerX;
+			v[3] = RandomInRange(&random, 0, height - 1);
+			v[4] = RandomInRange(&random, 0, width - 1);
+			v[5] = height - 1 - cornerY;
+		} else {
+			/* From the left to the right edge or from the top to the bottom edge */
+			if (i & 1) {
+				v[0] = 0;
+				v[1] = RandomInRange(&random, 0, height - 1);
+				v[2] = width - 1;
+				v[3] = RandomInRange(&random, 0, height - 1);
+			} else {
+				v[0] = RandomInRange(&random, 0, width - 1);
+				v[1] = 0;
+				v[2] = RandomInRange(&random, 0, width - 1);
+				v[3] = height - 1;
+			}
+		}
+		
+		if (type == WORKLOAD_LONG_LINES) {
+			const int dx = abs(v[2] - v[0]);
+			const int dy = abs(v[3] - v[1]);
+			result.pixels += (dx > dy ? dx : dy) + 1;
+		} else {
+			const double area = (double) (v[2] - v[0]) * (v[5] - v[1]) - (double) (v[3] - v[1]) * (v[4] - v[0]);
+			result.pixels += fabs(area) * 0.5;
+		}
+		
+		const u32 rgb = NextRandom(&random);
+		result.colors[i].r = (u8) rgb;
+		result.colors[i].g = (u8) (rgb >> 8);
+		result.colors[i].b = (u8) (rgb >> 16);
+		result.colors[i].a = (type == WORKLOAD_BLENDED_TRIANGLES) ? (u8) (rgb >> 24) : 255;
+	}
+	
+	if (type == WORKLOAD_SUPERSAMPLED_TRIANGLES) {
+		result.resolved.width = width;
+		result.resolved.height = height;
+		result.resolved.pitch = width * (int) sizeof(Pixel);
+		result.resolved.layout = RENDERER_LAYOUT_LINEAR;
+		result.resolved.memory = (u8*) malloc((size_t) result.resolved.pitch * height);
+	}
+	
+	if (type == WORKLOAD_DIRTY_RECTS) {
+		/* Only the widget and where it was are cleared and drawn, see GetWidgetRect */
+		const double invalidated = (double) (width / 4 + TQ_BENCH_WIDGET_STEP) * (height / 4);
+		result.pixels = invalidated * (1.0 + result.pixels / ((double) width * height));
+	}
+	
+	return result;
+}
+
+static void DestroyWorkload(Workload* workload)
+{
+	free(workload->coordinates);
+	free(workload->colors);
+	free(workload->resolved.memory);
+	if (workload->transforms) {
+		DestroyMesh(&workload->cube);
+		DestroyMesh(&workload->floor);
+		free(workload->transforms);
+		DestroyTexture(&workload->texture);
+		free(workload->uniforms);
+		free(workload->shaders);
+	}
+}
+
+/*	The scene of the 3D workloads, depth tested. The cubes are drawn front to
+ *	back and the floor last, so hidden parts are mostly rejected by hi-Z. */
+static void DrawScene(Renderer* renderer, const Workload* workload)
+{
+	Color sky = { 112, 160, 208, 255 };
+	ClearBackBuffer(renderer, &sky);
+	ClearDepthBuffer(renderer, 1.0f);
+	
+	const Vec3 cubeCenter = { 0.0f, 0.0f, 0.0f };
+	for (int i = 0; i <= workload->numCubes; i++) {
+		const Mesh* const mesh = (i < workload->numCubes) ? &workload->cube : &workload->floor;
+		const Matrix4x4* const transform = &workload->transforms[i];
+		if (workload->type == WORKLOAD_CULLED_TRIANGLES && i < workload->numCubes
+			&& CullBoundingSphere(renderer, transform, &cubeCenter, TQ_BENCH_CUBE_RADIUS, mesh->numIndices / 3)) {
+			continue;
+		}
+		
+		if (workload->type == WORKLOAD_TEXTURED_TRIANGLES) {
+			/* Vertex colors modulated by the mipmapped texture */
+			const VertexAttributes attributes = { mesh->colors, mesh->uvs, NULL };
+			DrawShadedTriangles(renderer, transform, mesh->positions, &attributes, mesh->numVertices,
+				mesh->indices, mesh->numIndices, &workload->texture);
+		} else if (workload->type == WORKLOAD_COLORED_TRIANGLES) {
+			const VertexAttributes attributes = { mesh->colors, NULL, NULL };
+			DrawShadedTriangles(renderer, transform, mesh->positions, &attributes, mesh->numVertices,
+				mesh->indices, mesh->numIndices, NULL);
+		} else if (workload->type == WORKLOAD_SHADER_TRIANGLES) {
+			DrawTrianglesWithShader(renderer, &workload->shaders[i], mesh->numVertices, 
+				mesh->indices, mesh->numIndices);
+		} else {
+			DrawTriangles(renderer, transform, mesh->positions, mesh->numVertices, 
+				mesh->indices, mesh->numIndices, &workload->colors[i]);
+		}
+	}
+}
+
+/*	Every pixel of dest is the average of the 2x2 pixels of source it covers.
+ *	Both columns of a pair are in the same row of a block, so this reads both layouts. */
+static void DownsampleBackBuffer(const BackBuffer* source, const BackBuffer* dest)
+{
+	for (int y = 0; y < dest->height; y++) {
+		Pixel* row = GetBackBufferRow(dest, y);
+		for (int bx = 0; bx < source->width; bx += TQ_SW_BLOCK_SIZE) {
+			const Pixel* const top = GetBlockRow(source, bx, 2 * y);
+			const Pixel* const bottom = GetBlockRow(source, bx, 2 * y + 1);
+			const int end = MinInt(bx + TQ_SW_BLOCK_SIZE, source->width);
+			for (int x = bx; x < end; x += 2) {
+				row[x / 2] = AveragePixels(top[x], top[x + 1], bottom[x], bottom[x + 1]);
+			}
+		}
+	}
+}
+
+/* One frame of the workload, including the flush of binned triangles, and its cull stats */
+static void RenderWorkload(Renderer* renderer, const Workload* workload, int frame)
+{
+	const int* v = workload->coordinates;
+	ResetCullStats(renderer);
+	
+	switch (workload->type) {
+		case WORKLOAD_CLEAR: {
+			Color color;
+			color.r = (u8) frame;
+			color.g = 64;
+			color.b = 128;
+			color.a = 255;
+			ClearBackBuffer(renderer, &color);
+		} break;
+		case WORKLOAD_SMALL_TRIANGLES:
+		case WORKLOAD_LARGE_TRIANGLES: {
+			for (int i = 0; i < workload->numPrimitives; i++, v += 6) {
+				DrawTriangle(renderer, v[0], v[1], v[2], v[3], v[4], v[5], &workload->colors[i]);
+			}
+		} break;
+		case WORKLOAD_LONG_LINES: {
+			for (int i = 0; i < workload->numPrimitives; i++, v += 4) {
+				DrawLine(renderer, v[0], v[1], v[2], v[3], &workload->colors[i]);
+			}
+		} break;
+		case WORKLOAD_BLENDED_TRIANGLES: {
+			/* Translucent overlays, src-over on top of whatever the last frame left */
+			SetBlendMode(renderer, RENDERER_BLEND_ALPHA);
+			for (int i = 0; i < workload->numPrimitives; i++, v += 6) {
+				DrawTriangle(renderer, v[0], v[1], v[2], v[3], v[4], v[5], &workload->colors[i]);
+			}
+			SetBlendMode(renderer, RENDERER_BLEND_NONE);
+		} break;
+		case WORKLOAD_MULTISAMPLED_TRIANGLES: {
+			/* large_triangles with 4x multisampling, the resolve included */
+			for (int i = 0; i < workload->numPrimitives; i++, v += 6) {
+				DrawTriangle(renderer, v[0], v[1], v[2], v[3], v[4], v[5], &workload->colors[i]);
+			}
+			ResolveMultisampling(renderer);
+		} break;
+		case WORKLOAD_SUPERSAMPLED_TRIANGLES: {
+			/* The same at twice the resolution (see BenchmarkWorkloads), the downsample included */
+			for (int i = 0; i < workload->numPrimitives; i++, v += 6) {
+				DrawTriangle(renderer, 2 * v[0], 2 * v[1], 2 * v[2], 2 * v[3], 2 * v[4], 2 * v[5], 
+					&workload->colors[i]);
+			}
+			FlushRenderer(renderer);
+			DownsampleBackBuffer(&renderer->backBuffer, &workload->resolved);
+		} break;
+		case WORKLOAD_DIRTY_RECTS: {
+			/* large_triangles redrawn as a whole, but clipped to where a widget moved */
+			const Rect oldWidget = GetWidgetRect(&renderer->backBuffer, (frame > 0) ? frame - 1 : 0);
+			const Rect newWidget = GetWidgetRect(&renderer->backBuffer, frame);
+			InvalidateRect(renderer, &oldWidget);
+			InvalidateRect(renderer, &newWidget);
+			
+			Color background = { 0, 0, 0, 255 };
+			ClearBackBuffer(renderer, &background);
+			for (int i = 0; i < workload->numPrimitives; i++, v += 6) {
+				DrawTriangle(renderer, v[0], v[1], v[2], v[3], v[4], v[5], &workload->colors[i]);
+			}
+			ResetDirtyRects(renderer);
+		} break;
+		case WORKLOAD_PERSPECTIVE_TRIANGLES:
+		case WORKLOAD_TEXTURED_TRIANGLES:
+		case WORKLOAD_COLORED_TRIANGLES:
+		case WORKLOAD_SHADER_TRIANGLES:
+		case WORKLOAD_CULLED_TRIANGLES: {
+			DrawScene(renderer, workload);
+		} break;
+		default: break;
+	}
+	
+	FlushRenderer(renderer);
+}
+
+/*	Statistics:
+ *	Every workload is warmed up first (caches, page faults, lazily grown
+ *	buffers), then timed frame by frame. The median is the number to compare
+ *	between runs, the minimum is the best case without interruptions. */
+typedef struct Timings
+{
+	double min;
+	double median;
+	double mean;
+	double deviation;
+} Timings;
+
+static int CompareDoubles(const void* a, const void* b)
+{
+	const double x = *(const double*) a;
+	const double y = *(const double*) b;
+	return (x > y) - (x < y);
+}
+
+static Timings MeasureWorkload(Renderer* renderer, const Workload* workload, int warmup, int iterations)
+{
+	double* seconds = (double*) malloc(sizeof(double) * iterations);
+	
+	for (int i = 0; i < warmup; i++) {
+		RenderWorkload(renderer, workload, i);
+	}
+	for (int i = 0; i < iterations; i++) {
+		const u64 start = SDL_GetPerformanceCounter();
+		RenderWorkload(renderer, workload, i);
+		seconds[i] = GetSeconds(SDL_GetPerformanceCounter() - start);
+	}
+	
+	qsort(seconds, iterations, sizeof(double), CompareDoubles);
+	
+	Timings result;
+	result.min = seconds[0];
+	result.median = (iterations & 1) ? seconds[iterations / 2]
+		: 0.5 * (seconds[iterations / 2 - 1] + seconds[iterations / 2]);
+	
+	double sum = 0.0;
+	for (int i = 0; i < iterations; i++) {
+		sum += seconds[i];
+	}
+	result.mean = sum / iterations;
+	
+	double variance = 0.0;
+	for (int i = 0; i < iterations; i++) {
+		variance += (seconds[i] - result.mean) * (seconds[i] - result.mean);
+	}
+	result.deviation = iterations > 1 ? sqrt(variance / (iterations - 1)) : 0.0;
+	
+	free(seconds);
+	return result;
+}
+
+/*	Golden images:
+ *	Binary PPM (P6), top row first. The alpha channel isn't stored. */
+static bool WritePPM(const char* path, const BackBuffer* backBuffer)
+{
+	FILE* file = fopen(path, "wb");
+	if (!file) {
+		return false;
+	}
+	
+	fprintf(file, "P6\n%d %d\n255\n", backBuffer->width, backBuffer->height);
+	u8* row = (u8*) malloc(3 * backBuffer->width);
+	for (int y = 0; y < backBuffer->height; y++) {
+		const Pixel* pixels = GetBackBufferRow(backBuffer, y);
+		for (int x = 0; x < backBuffer->width; x++) {
+			const Color color = UnpackColor(pixels[x]);
+			row[3 * x] = color.r;
+			row[3 * x + 1] = color.g;
+			row[3 * x + 2] = color.b;
+		}
+		fwrite(row, 1, 3 * backBuffer->width, file);
+	}
+	free(row);
+	
+	fclose(file);
+	return true;
+}
+
+/* Returns the number of pixels that differ from the PPM at path, -1 if it can't be compared */
+static int ComparePPM(const char* path, const BackBuffer* backBuffer)
+{
+	FILE* file = fopen(path, "rb");
+	if (!file) {
+		return -1;
+	}
+	
+	int width = 0;
+	int height = 0;
+	int maxValue = 0;
+	if (fscanf(file, "P6 %d %d %d", &width, &height, &maxValue) != 3 
+		|| width != backBuffer->width || height != backBuffer->height || maxValue != 255) {
+		fclose(file);
+		return -1;
+	}
+	fgetc(file);	/* single whitespace before the pixels */
+	
+	int result = 0;
+	u8* row = (u8*) malloc(3 * width);
+	for (int y = 0; y < height && result >= 0; y++) {
+		if (fread(row, 1, 3 * width, file) != (size_t) (3 * width)) {
+			result = -1;
+			break;
+		}
+		const Pixel* pixels = GetBackBufferRow(backBuffer, y);
+		for (int x = 0; x < width; x++) {
+			const Color color = UnpackColor(pixels[x]);
+			if (row[3 * x] != color.r || row[3 * x + 1] != color.g || row[3 * x + 2] != color.b) {
+				result++;
+			}
+		}
+	}
+	free(row);
+	
+	fclose(file);
+	return result;
+}
+
+/* Returns false on a mismatch with the golden image */
+static bool CheckGoldenImage(const char* directory, const char* name, const BackBuffer* backBuffer)
+{
+	char path[512];
+	snprintf(path, sizeof(path), "%s/%s.ppm", directory, name);
+	
+	FILE* file = fopen(path, "rb");
+	if (!file) {
+		if (!WritePPM(path, backBuffer)) {
+			printf("  could not write %s\n", path);
+			return false;
+		}
+		printf("  wrote %s\n", path);
+		return true;
+	}
+	fclose(file);
+	
+	const int numDifferent = ComparePPM(path, backBuffer);
+	if (numDifferent != 0) {
+		if (numDifferent < 0) {
+			printf("  MISMATCH %s: unreadable or different size\n", path);
+		} else {
+			printf("  MISMATCH %s: %d pixels differ\n", path, numDifferent);
+		}
+		return false;
+	}
+	return true;
+}
+
+/* Returns false on a golden image mismatch */
+static bool BenchmarkWorkloads(const Resolution* resolution, WorkQueue* workQueue, const char* goldenDirectory)
+{
+	const int warmup = 5;
+	const int iterations = 30;
+	bool result = true;
+	
+	Renderer renderer = CreateRenderer(resolution->width, resolution->height);
+	
+	/*	Golden images are compared after presenting, which de-tiles the swizzled layout.
+	 *	ssaa_triangles renders at twice the resolution and compares its downsampled frame. */
+	BackBuffer presented;
+	presented.width = resolution->width;
+	presented.height = resolution->height;
+	presented.pitch = resolution->width * (int) sizeof(Pixel);
+	presented.layout = RENDERER_LAYOUT_LINEAR;
+	presented.memory = (u8*) malloc((size_t) presented.pitch * presented.height);
+	
+	/* Median of every workload and mode, for the comparison with the reference */
+	double medians[WORKLOAD_COUNT][4];
+	
+	for (int type = 0; type < WORKLOAD_COUNT; type++) {
+		Workload workload = CreateWorkload((WorkloadType) type, resolution->width, resolution->height);
+		if (type == WORKLOAD_MULTISAMPLED_TRIANGLES) {
+			EnableMultisampling(&renderer);
+		}
+		if (type == WORKLOAD_SUPERSAMPLED_TRIANGLES) {
+			ResizeRenderer(&renderer, 2 * resolution->width, 2 * resolution->height);
+		}
+		if (type == WORKLOAD_DIRTY_RECTS) {
+			EnableDirtyRects(&renderer);
+		}
+		if (IsSceneWorkload((WorkloadType) type)) {
+			EnableDepthBuffer(&renderer, RENDERER_DEPTH_32);
+			SetCullMode(&renderer, RENDERER_CULL_BACK);
+		}
+		
+		/* All modes and layouts have to produce the same golden image */
+		for (int mode = 0; mode < 4; mode++) {
+			const int isTiled = mode & 1;
+			const int isSwizzled = mode >> 1;
+			if (isTiled) {
+				EnableTiledRendering(&renderer, workQueue);
+			}
+			if (isSwizzled) {
+				EnableSwizzledLayout(&renderer);
+			}
+			
+			const Timings timings = MeasureWorkload(&renderer, &workload, warmup, iterations);
+			printf("%-6s %-21s %-6s %-8s median %8.3f ms (min %8.3f, mean %8.3f, sd %6.3f) | ",
+				resolution->name, workloadNames[type], isTiled ? "tiled" : "direct", 
+				isSwizzled ? "swizzled" : "linear",
+				timings.median * 1e3, timings.min * 1e3, timings.mean * 1e3, timings.deviation * 1e3);
+			if (workload.numPrimitives > 0 && workload.type != WORKLOAD_LONG_LINES) {
+				printf("%9.4f Mtri/s | ", workload.numPrimitives / timings.median * 1e-6);
+			} else if (workload.numPrimitives > 0) {
+				printf("%9.4f Mlines/s | ", workload.numPrimitives / timings.median * 1e-6);
+			} else {
+				printf("%9s         | ", "");
+			}
+			printf("%8.1f Mpix/s | %6.2f ns/pixel", 
+				workload.pixels / timings.median * 1e-6, timings.median / workload.pixels * 1e9);
+			
+			medians[type][mode] = timings.median;
+			const WorkloadType reference = GetReferenceWorkload((WorkloadType) type);
+			if (reference != type) {
+				printf(" | %5.2fx %s", timings.median / medians[reference][mode], workloadNames[reference]);
+			}
+			printf("\n");
+			
+			/* The same in every mode, RenderWorkload counts one frame */
+			const CullStats* const stats = &renderer.cullStats;
+			if (mode == 0 && stats->numTriangles > 0) {
+				printf("%-6s %-21s culled %d of %d triangles per frame: frustum %d, back-face %d, degenerate %d\n",
+					resolution->name, workloadNames[type], 
+					stats->numFrustumCulled + stats->numBackFaceCulled + stats->numDegenerateCulled,
+					stats->numTriangles, stats->numFrustumCulled, stats->numBackFaceCulled, 
+					stats->numDegenerateCulled);
+			}
+			
+			if (goldenDirectory) {
+				Color background = { 0, 0, 0, 255 };
+				if (workload.type != WORKLOAD_CLEAR) {
+					ClearBackBuffer(&renderer, &background);
+				}
+				RenderWorkload(&renderer, &workload, 0);
+				const BackBuffer* frame = &workload.resolved;
+				if (!workload.resolved.memory) {
+					CopyBackBuffer(&renderer, presented.memory, presented.pitch);
+					frame = &presented;
+				}
+				
+				char name[128];
+				const WorkloadType golden = GetGoldenWorkload((WorkloadType) type);
+				snprintf(name, sizeof(name), "%s_%s", workloadNames[golden], resolution->name);
+				result &= CheckGoldenImage(goldenDirectory, name, frame);
+			}
+			
+			if (isTiled) {
+				DisableTiledRendering(&renderer);
+			}
+			if (isSwizzled) {
+				DisableSwizzledLayout(&renderer);
+			}
+		}
+		
+		DisableMultisampling(&renderer);
+		if (type == WORKLOAD_SUPERSAMPLED_TRIANGLES) {
+			ResizeRenderer(&renderer, resolution->width, resolution->height);
+		}
+		DisableDirtyRects(&renderer);
+		DisableDepthBuffer(&renderer);
+		SetCullMode(&renderer, RENDERER_CULL_NONE);
+		DestroyWorkload(&workload);
+	}
+	
+	free(presented.memory);
+	DestroyRenderer(&renderer);
+	return result;
+}
+
+/*	Transforms:
+ *	A scene of TQ_BENCH_TRANSFORM_COUNT nodes in TQ_BENCH_TRANSFORM_ROOTS trees,
+ *	up to TQ_BENCH_TRANSFORM_DEPTH levels deep. The reference rebuilds the world
+ *	matrix of every node from its local transform and those of all its ancestors,
+ *	like the per object code transform.h replaced. Every frame either all nodes
+ *	change, or TQ_BENCH_TRANSFORM_MOVES random nodes move. */
+#define TQ_BENCH_TRANSFORM_COUNT 65536
+#define TQ_BENCH_TRANSFORM_ROOTS 16
+#define TQ_BENCH_TRANSFORM_DEPTH 8
+#define TQ_BENCH_TRANSFORM_MOVES 256
+
+typedef struct TransformScene
+{
+	TransformHierarchy hierarchy;
+	Matrix4x4* referenceWorlds;
+	WorkQueue* workQueue;	/* NULL for the serial update */
+	u32 state;
+} TransformScene;
+
+typedef void TransformKernel(TransformScene* scene);
+
+static float RandomFloat(u32* state, float min, float max)
+{
+	return min + (max - min) * (float) (NextRandom(state) >> 8) / (1 << 24);
+}
+
+static Matrix4x4 GetWorldMatrixRecursive(const TransformHierarchy* hierarchy, int i)
+{
+	const Matrix4x4 local = Translate(hierarchy->positions[i]) * CreateMatrix4x4(hierarchy->rotations[i])
+		* Scale(hierarchy->scales[i]);
+	const int parent = hierarchy->parents[i];
+	if (parent == TQ_TRANSFORM_NO_PARENT) {
+		return local;
+	}
+	return GetWorldMatrixRecursive(hierarchy, parent) * local;
+}
+
+static void RebuildTransformsRecursive(TransformScene* scene)
+{
+	for (int i = 0; i < scene->hierarchy.count; i++) {
+		scene->referenceWorlds[i] = GetWorldMatrixRecursive(&scene->hierarchy, i);
+	}
+}
+
+static void UpdateAllTransforms(TransformScene* scene)
+{
+	for (int i = 0; i < scene->hierarchy.count; i++) {
+		MarkTransformDirty(&scene->hierarchy, i);
+	}
+	UpdateTransforms(&scene->hierarchy, scene->workQueue);
+}
+
+static void UpdateMovedTransforms(TransformScene* scene)
+{
+	TransformHierarchy* hierarchy = &scene->hierarchy;
+	for (int i = 0; i < TQ_BENCH_TRANSFORM_MOVES; i++) {
+		const int node = RandomInRange(&scene->state, 0, hierarchy->count - 1);
+		const Vec3 position =
+		{
+			RandomFloat(&scene->state, -10.0f, 10.0f),
+			RandomFloat(&scene->state, -10.0f, 10.0f),
+			RandomFloat(&scene->state, -10.0f, 10.0f)
+		};
+		SetLocalPosition(hierarchy, node, &position);
+	}
+	UpdateTransforms(hierarchy, scene->workQueue);
+}
+
+/* Returns the median time of a frame in seconds */
+static double MeasureTransformKernel(TransformKernel* kernel, TransformScene* scene)
+{
+	const int warmup = 3;
+	const int iterations = 25;
+	double seconds[25];
+	
+	for (int i = 0; i < warmup; i++) {
+		kernel(scene);
+	}
+	for (int i = 0; i < iterations; i++) {
+		const u64 start = SDL_GetPerformanceCounter();
+		kernel(scene);
+		seconds[i] = GetSeconds(SDL_GetPerformanceCounter() - start);
+	}
+	
+	qsort(seconds, iterations, sizeof(double), CompareDoubles);
+	return seconds[iterations / 2];
+}
+
+/* Largest difference between the world matrices and a recursive rebuild of them */
+static float GetTransformDifference(TransformScene* scene)
+{
+	RebuildTransformsRecursive(scene);
+	
+	float result = 0.0f;
+	for (int i = 0; i < scene->hierarchy.count; i++) {
+		for (int j = 0; j < 16; j++) {
+			const float difference = fabsf(scene->hierarchy.worlds[i].values[j] 
+				- scene->referenceWorlds[i].values[j]);
+			result = difference > result ? difference : result;
+		}
+	}
+	return result;
+}
+
+static void BenchmarkTransformKernel(const char* name, TransformKernel* kernel, TransformScene* scene,
+	WorkQueue* workQueue, double referenceSeconds)
+{
+	scene->workQueue = workQueue;
+	const double seconds = MeasureTransformKernel(kernel, scene);
+	
+	printf("%-20s %-8s median %8.3f ms | %6.2fx | max difference %g\n", name, workQueue ? "parallel" : "serial",
+		seconds * 1e3, referenceSeconds / seconds, GetTransformDifference(scene));
+}
+
+static void BenchmarkTransforms(WorkQueue* workQueue)
+{
+	TransformScene scene;
+	scene.hierarchy = CreateTransformHierarchy(TQ_BENCH_TRANSFORM_COUNT);
+	scene.referenceWorlds = (Matrix4x4*) malloc(sizeof(Matrix4x4) * TQ_BENCH_TRANSFORM_COUNT);
+	scene.workQueue = NULL;
+	scene.state = 0x2545F491;
+	
+	/* Depth-first: a random walk up and down the path from the current root */
+	int path[TQ_BENCH_TRANSFORM_DEPTH];
+	int depth = 0;
+	for (int i = 0; i < TQ_BENCH_TRANSFORM_COUNT; i++) {
+		int level = depth - RandomInRange(&scene.state, 0, 2);
+		level = level < 0 ? 0 : (level > TQ_BENCH_TRANSFORM_DEPTH - 1 ? TQ_BENCH_TRANSFORM_DEPTH - 1 : level);
+		if (i % (TQ_BENCH_TRANSFORM_COUNT / TQ_BENCH_TRANSFORM_ROOTS) == 0) {
+			level = 0;
+		}
+		
+		const int parent = level == 0 ? TQ_TRANSFORM_NO_PARENT : path[level - 1];
+		const int node = AddTransform(&scene.hierarchy, parent);
+		path[level] = node;
+		depth = level + 1;
+		
+		const Vec3 position = 
+		{
+			RandomFloat(&scene.state, -10.0f, 10.0f),
+			RandomFloat(&scene.state, -10.0f, 10.0f),
+			RandomFloat(&scene.state, -10.0f, 10.0f)
+		};
+		const Quaternion rotation =
+		{
+			RandomFloat(&scene.state, -1.0f, 1.0f),
+			RandomFloat(&scene.state, -1.0f, 1.0f),
+			RandomFloat(&scene.state, -1.0f, 1.0f),
+			RandomFloat(&scene.state, -1.0f, 1.0f)
+		};
+		const Vec3 scale = 
+		{
+			RandomFloat(&scene.state, 0.5f, 1.5f),
+			RandomFloat(&scene.state, 0.5f, 1.5f),
+			RandomFloat(&scene.state, 0.5f, 1.5f)
+		};
+		const Quaternion normalizedRotation = Normalized(rotation);
+		SetLocalPosition(&scene.hierarchy, node, &position);
+		SetLocalRotation(&scene.hierarchy, node, &normalizedRotation);
+		SetLocalScale(&scene.hierarchy, node, &scale);
+	}
+	
+	const double referenceSeconds = MeasureTransformKernel(RebuildTransformsRecursive, &scene);
+	printf("%-20s %-8s median %8.3f ms\n", "recursive rebuild", "serial", referenceSeconds * 1e3);
+	BenchmarkTransformKernel("all changed", UpdateAllTransforms, &scene, NULL, referenceSeconds);
+	BenchmarkTransformKernel("all changed", UpdateAllTransforms, &scene, workQueue, referenceSeconds);
+	BenchmarkTransformKernel("moved", UpdateMovedTransforms, &scene, NULL, referenceSeconds);
+	BenchmarkTransformKernel("moved", UpdateMovedTransforms, &scene, workQueue, referenceSeconds);
+	
+	free(scene.referenceWorlds);
+	DestroyTransformHierarchy(&scene.hierarchy);
+}
+
+int main(int argc, char* argv[])
+{
+	const char* goldenDirectory = argc > 1 ? argv[1] : NULL;
+	
+	const Resolution resolutions[] =
+	{
+		{ "720p", 1280, 720 },
+		{ "1080p", 1920, 1080 },
+		{ "1440p", 2560, 1440 },
+		{ "4K", 3840, 2160 }
+	};
+	const int numResolutions = sizeof(resolutions) / sizeof(resolutions[0]);
+
+	BenchmarkMath();
+	
+	printf("\nClear\n");
+	for (int i = 0; i < numResolutions; i++) {
+		BenchmarkClear(&resolutions[i]);
+	}
+	
+	printf("\nPresent\n");
+	for (int i = 0; i < numResolutions; i++) {
+		BenchmarkPresent(&resolutions[i]);
+	}
+	
+	WorkQueue workQueue;
+	if (!CreateWorkQueue(&workQueue, -1)) {
+		printf("Could not create work queue\n");
+		return 1;
+	}
+	
+	bool isGolden = true;
+	printf("\nWorkloads (%d worker threads + main thread when tiled)\n", workQueue.numThreads);
+	for (int i = 0; i < numResolutions; i++) {
+		isGolden &= BenchmarkWorkloads(&resolutions[i], &workQueue, goldenDirectory);
+	}
+	
+	printf("\nTransforms (%d nodes, %d worker threads + main thread when parallel)\n", 
+		TQ_BENCH_TRANSFORM_COUNT, workQueue.numThreads);
+	BenchmarkTransforms(&workQueue);
+	
+	DestroyWorkQueue(&workQueue);
+
+	return isGolden ? 0 : 1;
+}
@@ -67,6 +67,9 @@ typedef struct Input
 	i32 mouseScrollY;
 	/* Controller */
 	Controller controllers[INPUT_MAX_CONTROLLERS];	
+	/* Window, 0 unless it was resized since the last events were handled */
+	i32 resizedWidth;
+	i32 resizedHeight;
 } Input;
 
 Input CreateInput(u8* keys, int numKeys)
@@ -92,6 +95,8 @@ Input CreateInput(u8* keys, int numKeys)
 	input.mouseY = 0;
 	input.mouseScrollX = 0;
 	input.mouseScrollY = 0;
+	input.resizedWidth = 0;
+	input.resizedHeight = 0;
 	
 	
 	return input;
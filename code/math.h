@@ -111,7 +111,8 @@ union Vec3
 	}
 };
 
-union Vec4
+// 16 byte aligned, so a Vec4 is one SSE register
+union TQ_ALIGN(16) Vec4
 {
 	float values[4];
 	struct
@@ -175,7 +176,8 @@ union Matrix3x3
 	};
 };
 
-union Matrix4x4
+// Row-major and 16 byte aligned, so every row is one SSE register
+union TQ_ALIGN(16) Matrix4x4
 {
 	float values[16];
 	struct
@@ -598,6 +600,47 @@ inline Quaternion Inverse(const Quaternion& q)
 	return result;
 }
 
+// Normalized lerp along the shortest path between unit quaternions q1 and q2.
+// Cheaper than Slerp, but the rotation speeds up towards amount 0.5.
+inline Quaternion Nlerp(const Quaternion& q1, const Quaternion& q2, const float amount)
+{
+	const float diff = 1.0f - amount;
+	const float weight2 = Dot(q1, q2) < 0.0f ? -amount : amount;
+
+	return Normalized(diff * q1 + weight2 * q2);
+}
+
+// The weights of q1 and q2 for Slerp, cosAngle >= 0 (the shortest path)
+inline void SlerpWeights(const float cosAngle, const float amount, float* weight1, float* weight2)
+{
+	// sin(angle) goes to 0 for nearly the same rotations, lerp those instead
+	if (cosAngle > 0.9995f) {
+		*weight1 = 1.0f - amount;
+		*weight2 = amount;
+		return;
+	}
+
+	const float angle = acos(cosAngle);
+	const float invSin = 1.0f / sin(angle);
+	*weight1 = sin((1.0f - amount) * angle) * invSin;
+	*weight2 = sin(amount * angle) * invSin;
+}
+
+// Spherical lerp along the shortest path between unit quaternions q1 and q2,
+// at a constant rotation speed
+inline Quaternion Slerp(const Quaternion& q1, const Quaternion& q2, const float amount)
+{
+	const float cosAngle = Dot(q1, q2);
+	float weight1;
+	float weight2;
+	SlerpWeights(fabs(cosAngle), amount, &weight1, &weight2);
+	if (cosAngle < 0.0f) {
+		weight2 = -weight2;
+	}
+
+	return Normalized(weight1 * q1 + weight2 * q2);
+}
+
 
 inline Vec3 Rotated(const Vec3& v, const Quaternion& q)
 {
@@ -670,10 +713,42 @@ inline Matrix3x3 operator*(const Matrix3x3& lhs, const Matrix3x3& rhs)
 
 // Matrix4x4
 
+#ifdef TQ_SSE2
+// v.x * row 1 + v.y * row 2 + v.z * row 3 + v.w * row 4 of m, added in the same
+// order as the scalar code, so both give exactly the same results
+inline __m128 CombineRows(__m128 v, const Matrix4x4& m)
+{
+	__m128 result = _mm_mul_ps(_mm_shuffle_ps(v, v, 0x00), _mm_load_ps(&m.values[0]));
+	result = _mm_add_ps(result, _mm_mul_ps(_mm_shuffle_ps(v, v, 0x55), _mm_load_ps(&m.values[4])));
+	result = _mm_add_ps(result, _mm_mul_ps(_mm_shuffle_ps(v, v, 0xAA), _mm_load_ps(&m.values[8])));
+	result = _mm_add_ps(result, _mm_mul_ps(_mm_shuffle_ps(v, v, 0xFF), _mm_load_ps(&m.values[12])));
+	return result;
+}
+#endif
+
 inline Matrix4x4 operator*(const Matrix4x4& lhs, const Matrix4x4& rhs)
 {
 	Matrix4x4 result;
 
+#if defined(TQ_AVX)
+	// Two rows at once, each 128-bit half combines the rows of rhs with its own row of lhs
+	const __m256 rhs1 = _mm256_broadcast_ps((const __m128*) &rhs.values[0]);
+	const __m256 rhs2 = _mm256_broadcast_ps((const __m128*) &rhs.values[4]);
+	const __m256 rhs3 = _mm256_broadcast_ps((const __m128*) &rhs.values[8]);
+	const __m256 rhs4 = _mm256_broadcast_ps((const __m128*) &rhs.values[12]);
+	for (int i = 0; i < 16; i += 8) {
+		const __m256 rows = _mm256_loadu_ps(&lhs.values[i]);
+		__m256 row = _mm256_mul_ps(_mm256_shuffle_ps(rows, rows, 0x00), rhs1);
+		row = _mm256_add_ps(row, _mm256_mul_ps(_mm256_shuffle_ps(rows, rows, 0x55), rhs2));
+		row = _mm256_add_ps(row, _mm256_mul_ps(_mm256_shuffle_ps(rows, rows, 0xAA), rhs3));
+		row = _mm256_add_ps(row, _mm256_mul_ps(_mm256_shuffle_ps(rows, rows, 0xFF), rhs4));
+		_mm256_storeu_ps(&result.values[i], row);
+	}
+#elif defined(TQ_SSE2)
+	for (int i = 0; i < 16; i += 4) {
+		_mm_store_ps(&result.values[i], CombineRows(_mm_load_ps(&lhs.values[i]), rhs));
+	}
+#else
 	// First row
 	result.a11 = lhs.a11 * rhs.a11 + lhs.a12 * rhs.a21 + lhs.a13 * rhs.a31 + lhs.a14 * rhs.a41;
 	result.a12 = lhs.a11 * rhs.a12 + lhs.a12 * rhs.a22 + lhs.a13 * rhs.a32 + lhs.a14 * rhs.a42;
@@ -697,6 +772,7 @@ inline Matrix4x4 operator*(const Matrix4x4& lhs, const Matrix4x4& rhs)
 	result.a42 = lhs.a41 * rhs.a12 + lhs.a42 * rhs.a22 + lhs.a43 * rhs.a32 + lhs.a44 * rhs.a42;
 	result.a43 = lhs.a41 * rhs.a13 + lhs.a42 * rhs.a23 + lhs.a43 * rhs.a33 + lhs.a44 * rhs.a43;
 	result.a44 = lhs.a41 * rhs.a14 + lhs.a42 * rhs.a24 + lhs.a43 * rhs.a34 + lhs.a44 * rhs.a44;
+#endif
 
 	return result;
 }
@@ -713,6 +789,34 @@ inline Vec4 operator*(const Matrix4x4& lhs, const Vec4& rhs)
 	return result;
 }
 
+// lhs * vectors[i] for count vectors, result may be vectors. With SSE2 lhs is
+// transposed once, then every vector combines the columns of lhs, added in the
+// same order as Matrix4x4 * Vec4.
+inline void Transform(const Matrix4x4& lhs, const Vec4* vectors, Vec4* result, int count)
+{
+#ifdef TQ_SSE2
+	__m128 column1 = _mm_load_ps(&lhs.values[0]);
+	__m128 column2 = _mm_load_ps(&lhs.values[4]);
+	__m128 column3 = _mm_load_ps(&lhs.values[8]);
+	__m128 column4 = _mm_load_ps(&lhs.values[12]);
+	_MM_TRANSPOSE4_PS(column1, column2, column3, column4);
+
+	for (int i = 0; i < count; i++) {
+		const __m128 v = _mm_load_ps(vectors[i].values);
+		__m128 sum = _mm_mul_ps(_mm_shuffle_ps(v, v, 0x00), column1);
+		sum = _mm_add_ps(sum, _mm_mul_ps(_mm_shuffle_ps(v, v, 0x55), column2));
+		sum = _mm_add_ps(sum, _mm_mul_ps(_mm_shuffle_ps(v, v, 0xAA), column3));
+		sum = _mm_add_ps(sum, _mm_mul_ps(_mm_shuffle_ps(v, v, 0xFF), column4));
+		_mm_store_ps(result[i].values, sum);
+	}
+#else
+	const Matrix4x4 m = lhs;
+	for (int i = 0; i < count; i++) {
+		result[i] = m * vectors[i];
+	}
+#endif
+}
+
 inline Matrix4x4 CreateMatrix4x4()
 {
 	const Matrix4x4 result =
@@ -762,8 +866,38 @@ inline Matrix4x4 CreateMatrix4x4(const Quaternion& q)
 	return result;
 }
 
+// Translate(position) * CreateMatrix4x4(rotation) * Scale(scale), without the
+// two matrix multiplications
+inline Matrix4x4 CreateMatrix4x4(const Vec3& position, const Quaternion& rotation, const Vec3& scale)
+{
+	const Matrix4x4 r = CreateMatrix4x4(rotation);
+	const Matrix4x4 result =
+	{
+		r.a11 * scale.x, r.a12 * scale.y, r.a13 * scale.z, position.x,
+		r.a21 * scale.x, r.a22 * scale.y, r.a23 * scale.z, position.y,
+		r.a31 * scale.x, r.a32 * scale.y, r.a33 * scale.z, position.z,
+		0.0f, 0.0f, 0.0f, 1.0f
+	};
+
+	return result;
+}
+
 inline Matrix4x4 Transpose(const Matrix4x4& m)
 {
+#ifdef TQ_SSE2
+	__m128 row1 = _mm_load_ps(&m.values[0]);
+	__m128 row2 = _mm_load_ps(&m.values[4]);
+	__m128 row3 = _mm_load_ps(&m.values[8]);
+	__m128 row4 = _mm_load_ps(&m.values[12]);
+	_MM_TRANSPOSE4_PS(row1, row2, row3, row4);
+
+	Matrix4x4 result;
+	_mm_store_ps(&result.values[0], row1);
+	_mm_store_ps(&result.values[4], row2);
+	_mm_store_ps(&result.values[8], row3);
+	_mm_store_ps(&result.values[12], row4);
+	return result;
+#else
 	const Matrix4x4 result =
 	{
 		m.a11, m.a21, m.a31, m.a41,
@@ -773,6 +907,289 @@ inline Matrix4x4 Transpose(const Matrix4x4& m)
 	};
 
 	return result;
+#endif
+}
+
+// m has to be invertible (determinant not 0). Cramer's rule: the transposed
+// cofactors divided by the determinant, the cofactors built from the 2x2
+// determinants of the lower and upper two rows.
+//
+// Reference:
+// Intel, Streaming SIMD Extensions - Inverse of 4x4 Matrix (AP-928, 1999)
+inline Matrix4x4 Inverse(const Matrix4x4& m)
+{
+	Matrix4x4 result;
+
+#ifdef TQ_SSE2
+	// The columns of m, the 2nd and 4th with their halves swapped
+	__m128 row0 = _mm_load_ps(&m.values[0]);
+	__m128 row1 = _mm_load_ps(&m.values[4]);
+	__m128 row2 = _mm_load_ps(&m.values[8]);
+	__m128 row3 = _mm_load_ps(&m.values[12]);
+	_MM_TRANSPOSE4_PS(row0, row1, row2, row3);
+	row1 = _mm_shuffle_ps(row1, row1, 0x4E);
+	row3 = _mm_shuffle_ps(row3, row3, 0x4E);
+
+	__m128 minor0;
+	__m128 minor1;
+	__m128 minor2;
+	__m128 minor3;
+
+	__m128 products = _mm_mul_ps(row2, row3);
+	products = _mm_shuffle_ps(products, products, 0xB1);
+	minor0 = _mm_mul_ps(row1, products);
+	minor1 = _mm_mul_ps(row0, products);
+	products = _mm_shuffle_ps(products, products, 0x4E);
+	minor0 = _mm_sub_ps(_mm_mul_ps(row1, products), minor0);
+	minor1 = _mm_sub_ps(_mm_mul_ps(row0, products), minor1);
+	minor1 = _mm_shuffle_ps(minor1, minor1, 0x4E);
+
+	products = _mm_mul_ps(row1, row2);
+	products = _mm_shuffle_ps(products, products, 0xB1);
+	minor0 = _mm_add_ps(_mm_mul_ps(row3, products), minor0);
+	minor3 = _mm_mul_ps(row0, products);
+	products = _mm_shuffle_ps(products, products, 0x4E);
+	minor0 = _mm_sub_ps(minor0, _mm_mul_ps(row3, products));
+	minor3 = _mm_sub_ps(_mm_mul_ps(row0, products), minor3);
+	minor3 = _mm_shuffle_ps(minor3, minor3, 0x4E);
+
+	products = _mm_mul_ps(_mm_shuffle_ps(row1, row1, 0x4E), row3);
+	products = _mm_shuffle_ps(products, products, 0xB1);
+	row2 = _mm_shuffle_ps(row2, row2, 0x4E);
+	minor0 = _mm_add_ps(_mm_mul_ps(row2, products), minor0);
+	minor2 = _mm_mul_ps(row0, products);
+	products = _mm_shuffle_ps(products, products, 0x4E);
+	minor0 = _mm_sub_ps(minor0, _mm_mul_ps(row2, products));
+	minor2 = _mm_sub_ps(_mm_mul_ps(row0, products), minor2);
+	minor2 = _mm_shuffle_ps(minor2, minor2, 0x4E);
+
+	products = _mm_mul_ps(row0, row1);
+	products = _mm_shuffle_ps(products, products, 0xB1);
+	minor2 = _mm_add_ps(_mm_mul_ps(row3, products), minor2);
+	minor3 = _mm_sub_ps(_mm_mul_ps(row2, products), minor3);
+	products = _mm_shuffle_ps(products, products, 0x4E);
+	minor2 = _mm_sub_ps(_mm_mul_ps(row3, products), minor2);
+	minor3 = _mm_sub_ps(minor3, _mm_mul_ps(row2, products));
+
+	products = _mm_mul_ps(row0, row3);
+	products = _mm_shuffle_ps(products, products, 0xB1);
+	minor1 = _mm_sub_ps(minor1, _mm_mul_ps(row2, products));
+	minor2 = _mm_add_ps(_mm_mul_ps(row1, products), minor2);
+	products = _mm_shuffle_ps(products, products, 0x4E);
+	minor1 = _mm_add_ps(_mm_mul_ps(row2, products), minor1);
+	minor2 = _mm_sub_ps(minor2, _mm_mul_ps(row1, products));
+
+	products = _mm_mul_ps(row0, row2);
+	products = _mm_shuffle_ps(products, products, 0xB1);
+	minor1 = _mm_add_ps(_mm_mul_ps(row3, products), minor1);
+	minor3 = _mm_sub_ps(minor3, _mm_mul_ps(row1, products));
+	products = _mm_shuffle_ps(products, products, 0x4E);
+	minor1 = _mm_sub_ps(minor1, _mm_mul_ps(row3, products));
+	minor3 = _mm_add_ps(_mm_mul_ps(row1, products), minor3);
+
+	// Determinant in all lanes, a full division instead of the approximate reciprocal
+	__m128 determinant = _mm_mul_ps(row0, minor0);
+	determinant = _mm_add_ps(_mm_shuffle_ps(determinant, determinant, 0x4E), determinant);
+	determinant = _mm_add_ps(_mm_shuffle_ps(determinant, determinant, 0xB1), determinant);
+	const __m128 invDeterminant = _mm_div_ps(_mm_set1_ps(1.0f), determinant);
+
+	_mm_store_ps(&result.values[0], _mm_mul_ps(minor0, invDeterminant));
+	_mm_store_ps(&result.values[4], _mm_mul_ps(minor1, invDeterminant));
+	_mm_store_ps(&result.values[8], _mm_mul_ps(minor2, invDeterminant));
+	_mm_store_ps(&result.values[12], _mm_mul_ps(minor3, invDeterminant));
+#else
+	// 2x2 determinants of the upper (s) and lower (c) two rows
+	const float s0 = m.a11 * m.a22 - m.a21 * m.a12;
+	const float s1 = m.a11 * m.a23 - m.a21 * m.a13;
+	const float s2 = m.a11 * m.a24 - m.a21 * m.a14;
+	const float s3 = m.a12 * m.a23 - m.a22 * m.a13;
+	const float s4 = m.a12 * m.a24 - m.a22 * m.a14;
+	const float s5 = m.a13 * m.a24 - m.a23 * m.a14;
+
+	const float c5 = m.a33 * m.a44 - m.a43 * m.a34;
+	const float c4 = m.a32 * m.a44 - m.a42 * m.a34;
+	const float c3 = m.a32 * m.a43 - m.a42 * m.a33;
+	const float c2 = m.a31 * m.a44 - m.a41 * m.a34;
+	const float c1 = m.a31 * m.a43 - m.a41 * m.a33;
+	const float c0 = m.a31 * m.a42 - m.a41 * m.a32;
+
+	const float invDeterminant = 1.0f / (s0 * c5 - s1 * c4 + s2 * c3 + s3 * c2 - s4 * c1 + s5 * c0);
+
+	result.a11 = ( m.a22 * c5 - m.a23 * c4 + m.a24 * c3) * invDeterminant;
+	result.a12 = (-m.a12 * c5 + m.a13 * c4 - m.a14 * c3) * invDeterminant;
+	result.a13 = ( m.a42 * s5 - m.a43 * s4 + m.a44 * s3) * invDeterminant;
+	result.a14 = (-m.a32 * s5 + m.a33 * s4 - m.a34 * s3) * invDeterminant;
+
+	result.a21 = (-m.a21 * c5 + m.a23 * c2 - m.a24 * c1) * invDeterminant;
+	result.a22 = ( m.a11 * c5 - m.a13 * c2 + m.a14 * c1) * invDeterminant;
+	result.a23 = (-m.a41 * s5 + m.a43 * s2 - m.a44 * s1) * invDeterminant;
+	result.a24 = ( m.a31 * s5 - m.a33 * s2 + m.a34 * s1) * invDeterminant;
+
+	result.a31 = ( m.a21 * c4 - m.a22 * c2 + m.a24 * c0) * invDeterminant;
+	result.a32 = (-m.a11 * c4 + m.a12 * c2 - m.a14 * c0) * invDeterminant;
+	result.a33 = ( m.a41 * s4 - m.a42 * s2 + m.a44 * s0) * invDeterminant;
+	result.a34 = (-m.a31 * s4 + m.a32 * s2 - m.a34 * s0) * invDeterminant;
+
+	result.a41 = (-m.a21 * c3 + m.a22 * c1 - m.a23 * c0) * invDeterminant;
+	result.a42 = ( m.a11 * c3 - m.a12 * c1 + m.a13 * c0) * invDeterminant;
+	result.a43 = (-m.a41 * s3 + m.a42 * s1 - m.a43 * s0) * invDeterminant;
+	result.a44 = ( m.a31 * s3 - m.a32 * s1 + m.a33 * s0) * invDeterminant;
+#endif
+
+	return result;
+}
+
+#ifdef TQ_SSE2
+// lhs x rhs in lanes 0 to 2, lane 3 is 0 for finite values
+inline __m128 CrossLanes(__m128 lhs, __m128 rhs)
+{
+	const __m128 lhsYZX = _mm_shuffle_ps(lhs, lhs, _MM_SHUFFLE(3, 0, 2, 1));
+	const __m128 rhsYZX = _mm_shuffle_ps(rhs, rhs, _MM_SHUFFLE(3, 0, 2, 1));
+	const __m128 lhsZXY = _mm_shuffle_ps(lhs, lhs, _MM_SHUFFLE(3, 1, 0, 2));
+	const __m128 rhsZXY = _mm_shuffle_ps(rhs, rhs, _MM_SHUFFLE(3, 1, 0, 2));
+	return _mm_sub_ps(_mm_mul_ps(lhsYZX, rhsZXY), _mm_mul_ps(lhsZXY, rhsYZX));
+}
+
+// The affine matrix with columns column1 to column3 (lanes 0 to 2) and
+// translation (lanes 0 to 2), the last row is 0, 0, 0, 1
+inline Matrix4x4 CombineAffineColumns(__m128 column1, __m128 column2, __m128 column3, __m128 translation)
+{
+	_MM_TRANSPOSE4_PS(column1, column2, column3, translation);
+
+	Matrix4x4 result;
+	_mm_store_ps(&result.values[0], column1);
+	_mm_store_ps(&result.values[4], column2);
+	_mm_store_ps(&result.values[8], column3);
+	_mm_store_ps(&result.values[12], _mm_set_ps(1.0f, 0.0f, 0.0f, 0.0f));
+	return result;
+}
+#endif
+
+// m has to be affine (last row 0, 0, 0, 1) with an invertible upper 3x3 A,
+// e.g. a model matrix with scale or shear. The inverse is A^-1 with the
+// translation -A^-1 * t, A^-1 from 3 cross products instead of all 16 cofactors.
+inline Matrix4x4 AffineInverse(const Matrix4x4& m)
+{
+#ifdef TQ_SSE2
+	const __m128 row1 = _mm_load_ps(&m.values[0]);
+	const __m128 row2 = _mm_load_ps(&m.values[4]);
+	const __m128 row3 = _mm_load_ps(&m.values[8]);
+
+	// The rows of the cofactor matrix of A are the columns of A^-1 times det(A)
+	const __m128 cofactors1 = CrossLanes(row2, row3);
+	const __m128 cofactors2 = CrossLanes(row3, row1);
+	const __m128 cofactors3 = CrossLanes(row1, row2);
+	__m128 determinant = _mm_mul_ps(row1, cofactors1);
+	determinant = _mm_add_ps(_mm_add_ps(_mm_shuffle_ps(determinant, determinant, 0x00),
+		_mm_shuffle_ps(determinant, determinant, 0x55)), _mm_shuffle_ps(determinant, determinant, 0xAA));
+	const __m128 invDeterminant = _mm_div_ps(_mm_set1_ps(1.0f), determinant);
+
+	const __m128 column1 = _mm_mul_ps(cofactors1, invDeterminant);
+	const __m128 column2 = _mm_mul_ps(cofactors2, invDeterminant);
+	const __m128 column3 = _mm_mul_ps(cofactors3, invDeterminant);
+	__m128 translation = _mm_mul_ps(column1, _mm_set1_ps(m.a14));
+	translation = _mm_add_ps(translation, _mm_mul_ps(column2, _mm_set1_ps(m.a24)));
+	translation = _mm_add_ps(translation, _mm_mul_ps(column3, _mm_set1_ps(m.a34)));
+
+	return CombineAffineColumns(column1, column2, column3, _mm_sub_ps(_mm_setzero_ps(), translation));
+#else
+	const Vec3 row1 = { m.a11, m.a12, m.a13 };
+	const Vec3 row2 = { m.a21, m.a22, m.a23 };
+	const Vec3 row3 = { m.a31, m.a32, m.a33 };
+	const float invDeterminant = 1.0f / Dot(row1, Cross(row2, row3));
+	const Vec3 column1 = Cross(row2, row3) * invDeterminant;
+	const Vec3 column2 = Cross(row3, row1) * invDeterminant;
+	const Vec3 column3 = Cross(row1, row2) * invDeterminant;
+	const Vec3 translation = column1 * m.a14 + column2 * m.a24 + column3 * m.a34;
+
+	const Matrix4x4 result =
+	{
+		column1.x, column2.x, column3.x, -translation.x,
+		column1.y, column2.y, column3.y, -translation.y,
+		column1.z, column2.z, column3.z, -translation.z,
+		0, 0, 0, 1
+	};
+
+	return result;
+#endif
+}
+
+// m has to be a rotation (orthonormal upper 3x3 R) followed by a translation t,
+// e.g. a camera or an unscaled model matrix. The inverse is R^T with the
+// translation -R^T * t, no division at all.
+inline Matrix4x4 RigidInverse(const Matrix4x4& m)
+{
+#ifdef TQ_SSE2
+	// The rows of R are the columns of R^T, lane 3 (t) ends up in the last row
+	const __m128 row1 = _mm_load_ps(&m.values[0]);
+	const __m128 row2 = _mm_load_ps(&m.values[4]);
+	const __m128 row3 = _mm_load_ps(&m.values[8]);
+	__m128 translation = _mm_mul_ps(row1, _mm_set1_ps(m.a14));
+	translation = _mm_add_ps(translation, _mm_mul_ps(row2, _mm_set1_ps(m.a24)));
+	translation = _mm_add_ps(translation, _mm_mul_ps(row3, _mm_set1_ps(m.a34)));
+
+	return CombineAffineColumns(row1, row2, row3, _mm_sub_ps(_mm_setzero_ps(), translation));
+#else
+	const Matrix4x4 result =
+	{
+		m.a11, m.a21, m.a31, -(m.a11 * m.a14 + m.a21 * m.a24 + m.a31 * m.a34),
+		m.a12, m.a22, m.a32, -(m.a12 * m.a14 + m.a22 * m.a24 + m.a32 * m.a34),
+		m.a13, m.a23, m.a33, -(m.a13 * m.a14 + m.a23 * m.a24 + m.a33 * m.a34),
+		0, 0, 0, 1
+	};
+
+	return result;
+#endif
+}
+
+// Transforms the normals of a mesh with model matrix m: the inverse transpose of
+// the upper 3x3 A, without translation. That's the cofactor matrix of A divided
+// by det(A), so only 3 cross products. Only the direction of a transformed
+// normal is right, normalize it when A scales.
+inline Matrix4x4 NormalMatrix4x4(const Matrix4x4& m)
+{
+#ifdef TQ_SSE2
+	const __m128 row1 = _mm_load_ps(&m.values[0]);
+	const __m128 row2 = _mm_load_ps(&m.values[4]);
+	const __m128 row3 = _mm_load_ps(&m.values[8]);
+
+	const __m128 cofactors1 = CrossLanes(row2, row3);
+	const __m128 cofactors2 = CrossLanes(row3, row1);
+	const __m128 cofactors3 = CrossLanes(row1, row2);
+	__m128 determinant = _mm_mul_ps(row1, cofactors1);
+	determinant = _mm_add_ps(_mm_add_ps(_mm_shuffle_ps(determinant, determinant, 0x00),
+		_mm_shuffle_ps(determinant, determinant, 0x55)), _mm_shuffle_ps(determinant, determinant, 0xAA));
+	const __m128 invDeterminant = _mm_div_ps(_mm_set1_ps(1.0f), determinant);
+
+	// Whole rows only, mixing in scalar stores stalls the loads of the result
+	const __m128 mask = _mm_castsi128_ps(_mm_set_epi32(0, -1, -1, -1));
+	const __m128 invDeterminantXYZ = _mm_and_ps(invDeterminant, mask);
+
+	Matrix4x4 result;
+	_mm_store_ps(&result.values[0], _mm_mul_ps(cofactors1, invDeterminantXYZ));
+	_mm_store_ps(&result.values[4], _mm_mul_ps(cofactors2, invDeterminantXYZ));
+	_mm_store_ps(&result.values[8], _mm_mul_ps(cofactors3, invDeterminantXYZ));
+	_mm_store_ps(&result.values[12], _mm_set_ps(1.0f, 0.0f, 0.0f, 0.0f));
+	return result;
+#else
+	const Vec3 row1 = { m.a11, m.a12, m.a13 };
+	const Vec3 row2 = { m.a21, m.a22, m.a23 };
+	const Vec3 row3 = { m.a31, m.a32, m.a33 };
+	const float invDeterminant = 1.0f / Dot(row1, Cross(row2, row3));
+	const Vec3 cofactors1 = Cross(row2, row3) * invDeterminant;
+	const Vec3 cofactors2 = Cross(row3, row1) * invDeterminant;
+	const Vec3 cofactors3 = Cross(row1, row2) * invDeterminant;
+
+	const Matrix4x4 result =
+	{
+		cofactors1.x, cofactors1.y, cofactors1.z, 0,
+		cofactors2.x, cofactors2.y, cofactors2.z, 0,
+		cofactors3.x, cofactors3.y, cofactors3.z, 0,
+		0, 0, 0, 1
+	};
+
+	return result;
+#endif
 }
 
 inline Matrix4x4 Translate(const Matrix4x4& m, const Vec3& v)
@@ -866,7 +1283,7 @@ inline Matrix4x4 Ortho(const float left, const float right,
 		2.0f/width, 0, 0, -(right + left) / width,
 		0, 2.0f/height, 0, -(top + bottom) / height,
 		0, 0, -2.0f/depth, -(zFar + zNear) / depth,
-		0, 0, 0, 0
+		0, 0, 0, 1
 	};
 
 	return result;
@@ -901,7 +1318,7 @@ inline Vec4 PerspectiveDivide(const Vec4& v)
 		v.w		
 	};
 	
-	return v; 
+	return result; 
 }
 
 inline Matrix4x4 LookAt(const Vec3& eye, const Vec3& look, const Vec3& up)
@@ -953,4 +1370,588 @@ inline Matrix4x4 ViewportMatrix4x4(int x, int y, int width, int height)
 	};
 
 	return result;
-}
\ No newline at end of file
+}
+
+/***********
+* Streams *
+***********/
+
+// Structure of arrays: one array per component, so the batch kernels below
+// load TQ_LANES elements of a component at once (8 with AVX, 4 with SSE2, 1
+// without) and work on that many elements in parallel. The arrays belong to the
+// caller, any alignment works. A result may be written over an input stream,
+// and has room for the count of the input. The elements after the last whole
+// group of lanes go through the single element operations, which give the same
+// results.
+
+struct Vec3Stream
+{
+	float* x;
+	float* y;
+	float* z;
+	int count;
+};
+
+struct Vec4Stream
+{
+	float* x;
+	float* y;
+	float* z;
+	float* w;
+	int count;
+};
+
+struct QuaternionStream
+{
+	float* x;
+	float* y;
+	float* z;
+	float* w;
+	int count;
+};
+
+#if defined(TQ_AVX)
+#define TQ_LANES 8
+typedef __m256 FloatLanes;
+
+inline FloatLanes LoadLanes(const float* values)
+{
+	return _mm256_loadu_ps(values);
+}
+
+inline void StoreLanes(float* values, FloatLanes lanes)
+{
+	_mm256_storeu_ps(values, lanes);
+}
+
+inline FloatLanes BroadcastLanes(float value)
+{
+	return _mm256_set1_ps(value);
+}
+
+inline FloatLanes AddLanes(FloatLanes lhs, FloatLanes rhs)
+{
+	return _mm256_add_ps(lhs, rhs);
+}
+
+inline FloatLanes SubLanes(FloatLanes lhs, FloatLanes rhs)
+{
+	return _mm256_sub_ps(lhs, rhs);
+}
+
+inline FloatLanes MulLanes(FloatLanes lhs, FloatLanes rhs)
+{
+	return _mm256_mul_ps(lhs, rhs);
+}
+
+inline FloatLanes DivLanes(FloatLanes lhs, FloatLanes rhs)
+{
+	return _mm256_div_ps(lhs, rhs);
+}
+
+inline FloatLanes SqrtLanes(FloatLanes lanes)
+{
+	return _mm256_sqrt_ps(lanes);
+}
+
+// -lanes where test < 0, lanes elsewhere
+inline FloatLanes NegateWhereNegativeLanes(FloatLanes lanes, FloatLanes test)
+{
+	const __m256 negative = _mm256_cmp_ps(test, _mm256_setzero_ps(), _CMP_LT_OQ);
+	return _mm256_xor_ps(lanes, _mm256_and_ps(negative, _mm256_set1_ps(-0.0f)));
+}
+#elif defined(TQ_SSE2)
+#define TQ_LANES 4
+typedef __m128 FloatLanes;
+
+inline FloatLanes LoadLanes(const float* values)
+{
+	return _mm_loadu_ps(values);
+}
+
+inline void StoreLanes(float* values, FloatLanes lanes)
+{
+	_mm_storeu_ps(values, lanes);
+}
+
+inline FloatLanes BroadcastLanes(float value)
+{
+	return _mm_set1_ps(value);
+}
+
+inline FloatLanes AddLanes(FloatLanes lhs, FloatLanes rhs)
+{
+	return _mm_add_ps(lhs, rhs);
+}
+
+inline FloatLanes SubLanes(FloatLanes lhs, FloatLanes rhs)
+{
+	return _mm_sub_ps(lhs, rhs);
+}
+
+inline FloatLanes MulLanes(FloatLanes lhs, FloatLanes rhs)
+{
+	return _mm_mul_ps(lhs, rhs);
+}
+
+inline FloatLanes DivLanes(FloatLanes lhs, FloatLanes rhs)
+{
+	return _mm_div_ps(lhs, rhs);
+}
+
+inline FloatLanes SqrtLanes(FloatLanes lanes)
+{
+	return _mm_sqrt_ps(lanes);
+}
+
+// -lanes where test < 0, lanes elsewhere
+inline FloatLanes NegateWhereNegativeLanes(FloatLanes lanes, FloatLanes test)
+{
+	const __m128 negative = _mm_cmplt_ps(test, _mm_setzero_ps());
+	return _mm_xor_ps(lanes, _mm_and_ps(negative, _mm_set1_ps(-0.0f)));
+}
+#else
+#define TQ_LANES 1
+typedef float FloatLanes;
+
+inline FloatLanes LoadLanes(const float* values)
+{
+	return *values;
+}
+
+inline void StoreLanes(float* values, FloatLanes lanes)
+{
+	*values = lanes;
+}
+
+inline FloatLanes BroadcastLanes(float value)
+{
+	return value;
+}
+
+inline FloatLanes AddLanes(FloatLanes lhs, FloatLanes rhs)
+{
+	return lhs + rhs;
+}
+
+inline FloatLanes SubLanes(FloatLanes lhs, FloatLanes rhs)
+{
+	return lhs - rhs;
+}
+
+inline FloatLanes MulLanes(FloatLanes lhs, FloatLanes rhs)
+{
+	return lhs * rhs;
+}
+
+inline FloatLanes DivLanes(FloatLanes lhs, FloatLanes rhs)
+{
+	return lhs / rhs;
+}
+
+inline FloatLanes SqrtLanes(FloatLanes lanes)
+{
+	return (float) sqrt(lanes);
+}
+
+// -lanes where test < 0, lanes elsewhere
+inline FloatLanes NegateWhereNegativeLanes(FloatLanes lanes, FloatLanes test)
+{
+	return test < 0.0f ? -lanes : lanes;
+}
+#endif
+
+// Every element of m in all lanes, done once before a loop over a stream
+inline void BroadcastLanes(const Matrix4x4& m, FloatLanes* result)
+{
+	for (int i = 0; i < 16; i++) {
+		result[i] = BroadcastLanes(m.values[i]);
+	}
+}
+
+// A row of broadcast elements times (x, y, z, w), added in the same order as
+// Matrix4x4 * Vec4
+inline FloatLanes CombineLanes(const FloatLanes* row, FloatLanes x, FloatLanes y, FloatLanes z, FloatLanes w)
+{
+	FloatLanes result = MulLanes(row[0], x);
+	result = AddLanes(result, MulLanes(row[1], y));
+	result = AddLanes(result, MulLanes(row[2], z));
+	return AddLanes(result, MulLanes(row[3], w));
+}
+
+inline Vec3 GetStreamElement(const Vec3Stream& v, int i)
+{
+	const Vec3 result = { v.x[i], v.y[i], v.z[i] };
+	return result;
+}
+
+inline Vec4 GetStreamElement(const Vec4Stream& v, int i)
+{
+	const Vec4 result = { v.x[i], v.y[i], v.z[i], v.w[i] };
+	return result;
+}
+
+inline void SetStreamElement(Vec3Stream* v, int i, const Vec3& value)
+{
+	v->x[i] = value.x;
+	v->y[i] = value.y;
+	v->z[i] = value.z;
+}
+
+inline Quaternion GetStreamElement(const QuaternionStream& q, int i)
+{
+	const Quaternion result = { q.x[i], q.y[i], q.z[i], q.w[i] };
+	return result;
+}
+
+inline void SetStreamElement(Vec4Stream* v, int i, const Vec4& value)
+{
+	v->x[i] = value.x;
+	v->y[i] = value.y;
+	v->z[i] = value.z;
+	v->w[i] = value.w;
+}
+
+inline void SetStreamElement(QuaternionStream* q, int i, const Quaternion& value)
+{
+	q->x[i] = value.x;
+	q->y[i] = value.y;
+	q->z[i] = value.z;
+	q->w[i] = value.w;
+}
+
+// From and to arrays of structures, e.g. the positions of DrawTriangles
+
+inline void ToStream(const Vec3* values, Vec3Stream* result)
+{
+	for (int i = 0; i < result->count; i++) {
+		SetStreamElement(result, i, values[i]);
+	}
+}
+
+inline void ToStream(const Vec4* values, Vec4Stream* result)
+{
+	for (int i = 0; i < result->count; i++) {
+		SetStreamElement(result, i, values[i]);
+	}
+}
+
+inline void ToStream(const Quaternion* values, QuaternionStream* result)
+{
+	for (int i = 0; i < result->count; i++) {
+		SetStreamElement(result, i, values[i]);
+	}
+}
+
+inline void FromStream(const Vec3Stream& v, Vec3* result)
+{
+	for (int i = 0; i < v.count; i++) {
+		result[i] = GetStreamElement(v, i);
+	}
+}
+
+inline void FromStream(const Vec4Stream& v, Vec4* result)
+{
+	for (int i = 0; i < v.count; i++) {
+		result[i] = GetStreamElement(v, i);
+	}
+}
+
+inline void FromStream(const QuaternionStream& q, Quaternion* result)
+{
+	for (int i = 0; i < q.count; i++) {
+		result[i] = GetStreamElement(q, i);
+	}
+}
+
+// m * v for every element
+inline void Transform(const Matrix4x4& m, const Vec4Stream& v, Vec4Stream* result)
+{
+	FloatLanes rows[16];
+	BroadcastLanes(m, rows);
+
+	int i = 0;
+	for (; i + TQ_LANES <= v.count; i += TQ_LANES) {
+		const FloatLanes x = LoadLanes(v.x + i);
+		const FloatLanes y = LoadLanes(v.y + i);
+		const FloatLanes z = LoadLanes(v.z + i);
+		const FloatLanes w = LoadLanes(v.w + i);
+		StoreLanes(result->x + i, CombineLanes(&rows[0], x, y, z, w));
+		StoreLanes(result->y + i, CombineLanes(&rows[4], x, y, z, w));
+		StoreLanes(result->z + i, CombineLanes(&rows[8], x, y, z, w));
+		StoreLanes(result->w + i, CombineLanes(&rows[12], x, y, z, w));
+	}
+	for (; i < v.count; i++) {
+		SetStreamElement(result, i, m * GetStreamElement(v, i));
+	}
+}
+
+// m * (x, y, z, 1) for every point, e.g. positions to clip space
+inline void TransformPoints(const Matrix4x4& m, const Vec3Stream& points, Vec4Stream* result)
+{
+	FloatLanes rows[16];
+	BroadcastLanes(m, rows);
+	const FloatLanes one = BroadcastLanes(1.0f);
+	int i = 0;
+	for (; i + TQ_LANES <= points.count; i += TQ_LANES) {
+		const FloatLanes x = LoadLanes(points.x + i);
+		const FloatLanes y = LoadLanes(points.y + i);
+		const FloatLanes z = LoadLanes(points.z + i);
+		StoreLanes(result->x + i, CombineLanes(&rows[0], x, y, z, one));
+		StoreLanes(result->y + i, CombineLanes(&rows[4], x, y, z, one));
+		StoreLanes(result->z + i, CombineLanes(&rows[8], x, y, z, one));
+		StoreLanes(result->w + i, CombineLanes(&rows[12], x, y, z, one));
+	}
+	for (; i < points.count; i++) {
+		const Vec3 point = GetStreamElement(points, i);
+		const Vec4 v = { point.x, point.y, point.z, 1.0f };
+		SetStreamElement(result, i, m * v);
+	}
+}
+
+inline void Normalize(const Vec3Stream& v, Vec3Stream* result)
+{
+	const FloatLanes one = BroadcastLanes(1.0f);
+	int i = 0;
+	for (; i + TQ_LANES <= v.count; i += TQ_LANES) {
+		const FloatLanes x = LoadLanes(v.x + i);
+		const FloatLanes y = LoadLanes(v.y + i);
+		const FloatLanes z = LoadLanes(v.z + i);
+		const FloatLanes lengthSquared = AddLanes(AddLanes(MulLanes(x, x), MulLanes(y, y)), MulLanes(z, z));
+		const FloatLanes invLength = DivLanes(one, SqrtLanes(lengthSquared));
+		StoreLanes(result->x + i, MulLanes(x, invLength));
+		StoreLanes(result->y + i, MulLanes(y, invLength));
+		StoreLanes(result->z + i, MulLanes(z, invLength));
+	}
+	for (; i < v.count; i++) {
+		SetStreamElement(result, i, Normalized(GetStreamElement(v, i)));
+	}
+}
+
+inline void Dot(const Vec3Stream& lhs, const Vec3Stream& rhs, float* result)
+{
+	int i = 0;
+	for (; i + TQ_LANES <= lhs.count; i += TQ_LANES) {
+		const FloatLanes x = MulLanes(LoadLanes(lhs.x + i), LoadLanes(rhs.x + i));
+		const FloatLanes y = MulLanes(LoadLanes(lhs.y + i), LoadLanes(rhs.y + i));
+		const FloatLanes z = MulLanes(LoadLanes(lhs.z + i), LoadLanes(rhs.z + i));
+		StoreLanes(result + i, AddLanes(AddLanes(x, y), z));
+	}
+	for (; i < lhs.count; i++) {
+		result[i] = Dot(GetStreamElement(lhs, i), GetStreamElement(rhs, i));
+	}
+}
+
+inline void Cross(const Vec3Stream& lhs, const Vec3Stream& rhs, Vec3Stream* result)
+{
+	int i = 0;
+	for (; i + TQ_LANES <= lhs.count; i += TQ_LANES) {
+		const FloatLanes lx = LoadLanes(lhs.x + i);
+		const FloatLanes ly = LoadLanes(lhs.y + i);
+		const FloatLanes lz = LoadLanes(lhs.z + i);
+		const FloatLanes rx = LoadLanes(rhs.x + i);
+		const FloatLanes ry = LoadLanes(rhs.y + i);
+		const FloatLanes rz = LoadLanes(rhs.z + i);
+		StoreLanes(result->x + i, SubLanes(MulLanes(ly, rz), MulLanes(lz, ry)));
+		StoreLanes(result->y + i, SubLanes(MulLanes(lz, rx), MulLanes(lx, rz)));
+		StoreLanes(result->z + i, SubLanes(MulLanes(lx, ry), MulLanes(ly, rx)));
+	}
+	for (; i < lhs.count; i++) {
+		SetStreamElement(result, i, Cross(GetStreamElement(lhs, i), GetStreamElement(rhs, i)));
+	}
+}
+
+// Like PerspectiveDivide, w is kept
+inline void PerspectiveDivide(const Vec4Stream& v, Vec4Stream* result)
+{
+	int i = 0;
+	for (; i + TQ_LANES <= v.count; i += TQ_LANES) {
+		const FloatLanes w = LoadLanes(v.w + i);
+		StoreLanes(result->x + i, DivLanes(LoadLanes(v.x + i), w));
+		StoreLanes(result->y + i, DivLanes(LoadLanes(v.y + i), w));
+		StoreLanes(result->z + i, DivLanes(LoadLanes(v.z + i), w));
+		StoreLanes(result->w + i, w);
+	}
+	for (; i < v.count; i++) {
+		SetStreamElement(result, i, PerspectiveDivide(GetStreamElement(v, i)));
+	}
+}
+
+// ViewportMatrix4x4(x, y, width, height) * (ndc.x, ndc.y, ndc.z, 1), w is kept.
+// Only x and y change, so this skips the rest of the matrix.
+inline void Viewport(int x, int y, int width, int height, const Vec4Stream& ndc, Vec4Stream* result)
+{
+	const float halfWidth = (float) width / 2;
+	const float halfHeight = (float) height / 2;
+	const float offsetX = x + halfWidth;
+	const float offsetY = y + halfHeight;
+
+	int i = 0;
+	for (; i + TQ_LANES <= ndc.count; i += TQ_LANES) {
+		const FloatLanes screenX = AddLanes(MulLanes(BroadcastLanes(halfWidth), LoadLanes(ndc.x + i)),
+			BroadcastLanes(offsetX));
+		const FloatLanes screenY = AddLanes(MulLanes(BroadcastLanes(-halfHeight), LoadLanes(ndc.y + i)),
+			BroadcastLanes(offsetY));
+		StoreLanes(result->x + i, screenX);
+		StoreLanes(result->y + i, screenY);
+		StoreLanes(result->z + i, LoadLanes(ndc.z + i));
+		StoreLanes(result->w + i, LoadLanes(ndc.w + i));
+	}
+	for (; i < ndc.count; i++) {
+		result->x[i] = halfWidth * ndc.x[i] + offsetX;
+		result->y[i] = -halfHeight * ndc.y[i] + offsetY;
+		result->z[i] = ndc.z[i];
+		result->w[i] = ndc.w[i];
+	}
+}
+
+// Quaternion streams, e.g. the joint rotations of a skeleton
+
+// weight1 * q1 + weight2 * q2, normalized like Normalized(const Quaternion&)
+inline void StoreBlendedLanes(const QuaternionStream& q1, const QuaternionStream& q2, int i,
+	FloatLanes weight1, FloatLanes weight2, QuaternionStream* result)
+{
+	const FloatLanes x = AddLanes(MulLanes(weight1, LoadLanes(q1.x + i)), MulLanes(weight2, LoadLanes(q2.x + i)));
+	const FloatLanes y = AddLanes(MulLanes(weight1, LoadLanes(q1.y + i)), MulLanes(weight2, LoadLanes(q2.y + i)));
+	const FloatLanes z = AddLanes(MulLanes(weight1, LoadLanes(q1.z + i)), MulLanes(weight2, LoadLanes(q2.z + i)));
+	const FloatLanes w = AddLanes(MulLanes(weight1, LoadLanes(q1.w + i)), MulLanes(weight2, LoadLanes(q2.w + i)));
+	FloatLanes lengthSquared = AddLanes(MulLanes(x, x), MulLanes(y, y));
+	lengthSquared = AddLanes(AddLanes(lengthSquared, MulLanes(z, z)), MulLanes(w, w));
+	const FloatLanes invLength = DivLanes(BroadcastLanes(1.0f), SqrtLanes(lengthSquared));
+	StoreLanes(result->x + i, MulLanes(x, invLength));
+	StoreLanes(result->y + i, MulLanes(y, invLength));
+	StoreLanes(result->z + i, MulLanes(z, invLength));
+	StoreLanes(result->w + i, MulLanes(w, invLength));
+}
+
+inline FloatLanes DotLanes(const QuaternionStream& q1, const QuaternionStream& q2, int i)
+{
+	FloatLanes result = AddLanes(MulLanes(LoadLanes(q1.x + i), LoadLanes(q2.x + i)),
+		MulLanes(LoadLanes(q1.y + i), LoadLanes(q2.y + i)));
+	result = AddLanes(result, MulLanes(LoadLanes(q1.z + i), LoadLanes(q2.z + i)));
+	return AddLanes(result, MulLanes(LoadLanes(q1.w + i), LoadLanes(q2.w + i)));
+}
+
+// Nlerp(q1, q2, amount) for every element, e.g. blending two poses
+inline void Nlerp(const QuaternionStream& q1, const QuaternionStream& q2, float amount,
+	QuaternionStream* result)
+{
+	const FloatLanes weight1 = BroadcastLanes(1.0f - amount);
+	const FloatLanes weight2 = BroadcastLanes(amount);
+	int i = 0;
+	for (; i + TQ_LANES <= q1.count; i += TQ_LANES) {
+		const FloatLanes cosAngle = DotLanes(q1, q2, i);
+		StoreBlendedLanes(q1, q2, i, weight1, NegateWhereNegativeLanes(weight2, cosAngle), result);
+	}
+	for (; i < q1.count; i++) {
+		SetStreamElement(result, i, Nlerp(GetStreamElement(q1, i), GetStreamElement(q2, i), amount));
+	}
+}
+
+// Slerp(q1, q2, amount) for every element. Only the angles and their sines are
+// computed per element, there are no sin and acos on lanes.
+inline void Slerp(const QuaternionStream& q1, const QuaternionStream& q2, float amount,
+	QuaternionStream* result)
+{
+	TQ_ALIGN(32) float cosAngles[TQ_LANES];
+	TQ_ALIGN(32) float weights1[TQ_LANES];
+	TQ_ALIGN(32) float weights2[TQ_LANES];
+	int i = 0;
+	for (; i + TQ_LANES <= q1.count; i += TQ_LANES) {
+		const FloatLanes cosAngle = DotLanes(q1, q2, i);
+		StoreLanes(cosAngles, cosAngle);
+		for (int j = 0; j < TQ_LANES; j++) {
+			SlerpWeights(fabs(cosAngles[j]), amount, &weights1[j], &weights2[j]);
+		}
+		const FloatLanes weight2 = NegateWhereNegativeLanes(LoadLanes(weights2), cosAngle);
+		StoreBlendedLanes(q1, q2, i, LoadLanes(weights1), weight2, result);
+	}
+	for (; i < q1.count; i++) {
+		SetStreamElement(result, i, Slerp(GetStreamElement(q1, i), GetStreamElement(q2, i), amount));
+	}
+}
+
+// CreateMatrix4x4(q) for every element, result has room for q.count matrices
+inline void CreateMatrix4x4(const QuaternionStream& q, Matrix4x4* result)
+{
+	const FloatLanes one = BroadcastLanes(1.0f);
+	const FloatLanes two = BroadcastLanes(2.0f);
+	TQ_ALIGN(32) float rotation[9][TQ_LANES];
+	int i = 0;
+	for (; i + TQ_LANES <= q.count; i += TQ_LANES) {
+		const FloatLanes x = LoadLanes(q.x + i);
+		const FloatLanes y = LoadLanes(q.y + i);
+		const FloatLanes z = LoadLanes(q.z + i);
+		const FloatLanes w = LoadLanes(q.w + i);
+		const FloatLanes x2 = MulLanes(two, x);
+		const FloatLanes y2 = MulLanes(two, y);
+		const FloatLanes z2 = MulLanes(two, z);
+		const FloatLanes xx2 = MulLanes(x2, x);
+		const FloatLanes xy2 = MulLanes(x2, y);
+		const FloatLanes xz2 = MulLanes(x2, z);
+		const FloatLanes xw2 = MulLanes(x2, w);
+		const FloatLanes yy2 = MulLanes(y2, y);
+		const FloatLanes yz2 = MulLanes(y2, z);
+		const FloatLanes yw2 = MulLanes(y2, w);
+		const FloatLanes zz2 = MulLanes(z2, z);
+		const FloatLanes zw2 = MulLanes(z2, w);
+		StoreLanes(rotation[0], SubLanes(one, AddLanes(yy2, zz2)));
+		StoreLanes(rotation[1], AddLanes(xy2, zw2));
+		StoreLanes(rotation[2], SubLanes(xz2, yw2));
+		StoreLanes(rotation[3], SubLanes(xy2, zw2));
+		StoreLanes(rotation[4], SubLanes(one, AddLanes(xx2, zz2)));
+		StoreLanes(rotation[5], AddLanes(yz2, xw2));
+		StoreLanes(rotation[6], AddLanes(xz2, yw2));
+		StoreLanes(rotation[7], SubLanes(yz2, xw2));
+		StoreLanes(rotation[8], SubLanes(one, AddLanes(xx2, yy2)));
+
+		for (int j = 0; j < TQ_LANES; j++) {
+			const Matrix4x4 m =
+			{
+				rotation[0][j], rotation[1][j], rotation[2][j], 0.0f,
+				rotation[3][j], rotation[4][j], rotation[5][j], 0.0f,
+				rotation[6][j], rotation[7][j], rotation[8][j], 0.0f,
+				0.0f, 0.0f, 0.0f, 1.0f
+			};
+			result[i + j] = m;
+		}
+	}
+	for (; i < q.count; i++) {
+		result[i] = CreateMatrix4x4(GetStreamElement(q, i));
+	}
+}
+
+// Rotated(v[i], q[i]) for every element
+inline void Rotate(const Vec3Stream& v, const QuaternionStream& q, Vec3Stream* result)
+{
+	const FloatLanes two = BroadcastLanes(2.0f);
+	int i = 0;
+	for (; i + TQ_LANES <= v.count; i += TQ_LANES) {
+		const FloatLanes vx = LoadLanes(v.x + i);
+		const FloatLanes vy = LoadLanes(v.y + i);
+		const FloatLanes vz = LoadLanes(v.z + i);
+		const FloatLanes ux = LoadLanes(q.x + i);
+		const FloatLanes uy = LoadLanes(q.y + i);
+		const FloatLanes uz = LoadLanes(q.z + i);
+		const FloatLanes s = LoadLanes(q.w + i);
+
+		// 2 * (u . v) * u + (s * s - u . u) * v + 2 * s * (u x v)
+		const FloatLanes dotUV = AddLanes(AddLanes(MulLanes(ux, vx), MulLanes(uy, vy)), MulLanes(uz, vz));
+		const FloatLanes dotUU = AddLanes(AddLanes(MulLanes(ux, ux), MulLanes(uy, uy)), MulLanes(uz, uz));
+		const FloatLanes uScale = MulLanes(two, dotUV);
+		const FloatLanes vScale = SubLanes(MulLanes(s, s), dotUU);
+		const FloatLanes crossScale = MulLanes(two, s);
+		const FloatLanes crossX = SubLanes(MulLanes(uy, vz), MulLanes(uz, vy));
+		const FloatLanes crossY = SubLanes(MulLanes(uz, vx), MulLanes(ux, vz));
+		const FloatLanes crossZ = SubLanes(MulLanes(ux, vy), MulLanes(uy, vx));
+		StoreLanes(result->x + i, AddLanes(AddLanes(MulLanes(ux, uScale), MulLanes(vx, vScale)),
+			MulLanes(crossX, crossScale)));
+		StoreLanes(result->y + i, AddLanes(AddLanes(MulLanes(uy, uScale), MulLanes(vy, vScale)),
+			MulLanes(crossY, crossScale)));
+		StoreLanes(result->z + i, AddLanes(AddLanes(MulLanes(uz, uScale), MulLanes(vz, vScale)),
+			MulLanes(crossZ, crossScale)));
+	}
+	for (; i < v.count; i++) {
+		SetStreamElement(result, i, Rotated(GetStreamElement(v, i), GetStreamElement(q, i)));
+	}
+}
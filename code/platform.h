@@ -15,6 +15,26 @@ typedef uint64_t u64;
 typedef unsigned int uint;
 typedef unsigned long ulong;
 
+/*****************************************************************************/
+/* SIMD */
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TQ_SSE2 1
+#include <emmintrin.h>
+#endif
+
+/* Only with /arch:AVX or -mavx, the AVX paths have SSE2 fallbacks */
+#if defined(__AVX__)
+#define TQ_AVX 1
+#include <immintrin.h>
+#endif
+
+#if defined(_MSC_VER)
+#define TQ_ALIGN(n) __declspec(align(n))
+#else
+#define TQ_ALIGN(n) __attribute__((aligned(n)))
+#endif
+
 /*****************************************************************************/
 /* Clock */
 
@@ -92,7 +92,7 @@ Window SDL2CreateWindow(const char* title, int width, int height, u32 flags)
 	result.renderer = SDL_CreateRenderer(result.handle, -1, SDL_RENDERER_SOFTWARE);
 	result.frontBuffer = SDL_CreateTexture(
             result.renderer,
-            SDL_PIXELFORMAT_ARGB8888,
+            SDL_PIXELFORMAT_ARGB8888,	/* Same layout as Pixel in sw_render.h */
             SDL_TEXTUREACCESS_STREAMING,
             width,
             height
@@ -113,14 +113,94 @@ void SDL2DestroyWindow(Window* window)
 	SDL_DestroyTexture(window->frontBuffer);
 	SDL_Quit();
 }
+*/
 
-void SDL2SwapBuffers(Window* window, Renderer* renderer)
+/*	The software renderer draws straight into the front buffer, without a copy:
+ *
+ *	void* memory;
+ *	int pitch;
+ *	if (SDL2LockFrontBuffer(&window, &memory, &pitch)) {
+ *		BindBackBuffer(&renderer, memory, pitch);
+ *		ClearBackBuffer(&renderer, &color);
+ *		...
+ *		UnbindBackBuffer(&renderer);
+ *		SDL2PresentFrontBuffer(&window);
+ *	}
+ */
+bool SDL2LockFrontBuffer(Window* window, void** memory, int* pitch)
 {
-	SDL_UpdateTexture(window->frontBuffer, 0, renderer->backBuffer.memory, renderer->backBuffer.pitch);
+	if (SDL_LockTexture(window->frontBuffer, NULL, memory, pitch) != 0) {
+		printf("Could not lock frontbuffer: %s\n", SDL_GetError());
+		return false;
+	}
+	
+	return true;
+}
+
+void SDL2PresentFrontBuffer(Window* window)
+{
+	SDL_UnlockTexture(window->frontBuffer);
+	SDL_RenderCopy(window->renderer, window->frontBuffer, 0, 0);
+	SDL_RenderPresent(window->renderer);
+}
+
+/*	Textures can't change size, so the front buffer is recreated. The renderer 
+ *	keeps its memory when it fits, so a live resize only costs the texture:
+ *
+ *	if (input.resizedWidth > 0) {
+ *		SDL2ResizeFrontBuffer(&window, input.resizedWidth, input.resizedHeight);
+ *		ResizeRenderer(&renderer, input.resizedWidth, input.resizedHeight);
+ *	}
+ */
+bool SDL2ResizeFrontBuffer(Window* window, int width, int height)
+{
+	SDL_DestroyTexture(window->frontBuffer);
+	window->frontBuffer = SDL_CreateTexture(
+		window->renderer,
+		SDL_PIXELFORMAT_ARGB8888,
+		SDL_TEXTUREACCESS_STREAMING,
+		width,
+		height
+	);
+	if (!window->frontBuffer) {
+		printf("Could not resize frontbuffer: %s\n", SDL_GetError());
+		return false;
+	}
+	
+	return true;
+}
+
+/*	Uploads only the rects of memory (ARGB8888, pitch in bytes) that changed and presents.
+ *	A locked texture is write-only, its old pixels are lost, so with dirty rects 
+ *	the software renderer keeps its own back buffer instead:
+ *
+ *	EnableDirtyRects(&renderer);
+ *	...
+ *	InvalidateRect(&renderer, &oldBounds);
+ *	InvalidateRect(&renderer, &newBounds);
+ *	ClearBackBuffer(&renderer, &color);
+ *	...
+ *	FlushRenderer(&renderer);
+ *	SDL_Rect rects[TQ_SW_MAX_DIRTY_RECTS];
+ *	for (int i = 0; i < renderer.dirtyRects.numRects; i++) {
+ *		const Rect* rect = &renderer.dirtyRects.rects[i];
+ *		rects[i] = { rect->xMin, rect->yMin, rect->xMax - rect->xMin, rect->yMax - rect->yMin };
+ *	}
+ *	SDL2PresentFrontBufferRects(&window, renderer.backBuffer.memory, renderer.backBuffer.pitch, 
+ *		rects, renderer.dirtyRects.numRects);
+ *	ResetDirtyRects(&renderer);
+ */
+void SDL2PresentFrontBufferRects(Window* window, const void* memory, int pitch, 
+	const SDL_Rect* rects, int numRects)
+{
+	for (int i = 0; i < numRects; i++) {
+		const SDL_Rect* rect = &rects[i];
+		const u8* pixels = (const u8*) memory + rect->y * pitch + rect->x * 4;
+		SDL_UpdateTexture(window->frontBuffer, rect, pixels, pitch);
+	}
 	SDL_RenderCopy(window->renderer, window->frontBuffer, 0, 0);
 	SDL_RenderPresent(window->renderer);
 }
-*/
 
 enum Scancode
 {
@@ -369,6 +449,8 @@ static bool HandleEvents(Input* input)
 {
 	SDL_Event event;
 	InputResetMouseScroll(input);
+	input->resizedWidth = 0;
+	input->resizedHeight = 0;
 	/* SDL_SetRelativeMouseMode(SDL_TRUE);*/
 	
 	for (int i = 0; i < INPUT_NUM_MOUSEBUTTONS; i++) {
@@ -426,7 +508,9 @@ static bool HandleEvents(Input* input)
 		}
 		if (event.type == SDL_WINDOWEVENT) {
 			if (event.window.event == SDL_WINDOWEVENT_RESIZED) {
-				/* TODO */
+				/* Only the last size counts, the owner of the swapchain or front buffer resizes it */
+				input->resizedWidth = event.window.data1;
+				input->resizedHeight = event.window.data2;
 			}
 		}
 	}
@@ -1,254 +1,4628 @@
 #pragma once
 
+/*	Pixels are packed in a u32 as 0xAARRGGBB, which is SDL_PIXELFORMAT_ARGB8888:
+ *	the format of the streaming front buffer texture, so the back buffer is 
+ *	uploaded as is. In (little endian) memory this reads B, G, R, A. */
+typedef u32 Pixel;
+
+enum BackBufferLayout
+{
+	RENDERER_LAYOUT_LINEAR = 0,
+	RENDERER_LAYOUT_SWIZZLED	/* see Swizzled layout */
+};
+
 typedef struct BackBuffer
 {
 	u8* memory;
 	int width;
 	int height;
-	int pitch;
-	int	bytesPerPixel;
+	int pitch;	/* in bytes, between rows of tiles for the swizzled layout */
+	BackBufferLayout layout;
 } BackBuffer;
 
-typedef struct Color
+typedef struct Color
+{
+	u8 r;
+	u8 g;
+	u8 b;
+	u8 a;
+} Color;
+
+inline Pixel PackColor(const Color* const color)
+{
+	return (Pixel) color->b 
+		| ((Pixel) color->g << 8) 
+		| ((Pixel) color->r << 16) 
+		| ((Pixel) color->a << 24);
+}
+
+inline Color UnpackColor(Pixel pixel)
+{
+	Color result;
+	result.b = (u8) pixel;
+	result.g = (u8) (pixel >> 8);
+	result.r = (u8) (pixel >> 16);
+	result.a = (u8) (pixel >> 24);
+	return result;
+}
+
+/* Only for the linear layout, see GetPixelAddress */
+inline Pixel* GetBackBufferRow(const BackBuffer* const backBuffer, int y)
+{
+	return (Pixel*) (backBuffer->memory + (size_t) y * backBuffer->pitch);
+}
+
+typedef struct Rect
+{
+	int xMin;
+	int yMin;
+	int xMax;	/* exclusive */
+	int yMax;	/* exclusive */
+} Rect;
+
+/*	Varyings:
+ *	Per vertex attributes of shaded triangles, interpolated perspective-correct.
+ *	DrawShadedTriangles fills them as color (rgba in [0, 1]), uv and, when the mesh
+ *	has them, normals. */
+#define TQ_SW_MAX_VARYINGS 12
+
+enum Varying
+{
+	VARYING_COLOR = 0,	/* 4 floats */
+	VARYING_UV = 4,	/* 2 floats */
+	VARYING_NORMAL = 6	/* 3 floats */
+};
+
+struct Texture;
+struct Shader;
+
+/*	Blending:
+ *	How pixels are combined with what is already in the back buffer, for
+ *	everything except ClearBackBuffer. Source colors have straight alpha,
+ *	except for RENDERER_BLEND_PREMULTIPLIED. */
+enum BlendMode
+{
+	RENDERER_BLEND_NONE = 0,	/* dest = src */
+	RENDERER_BLEND_ALPHA,	/* dest = src * a + dest * (1 - a), "src-over" */
+	RENDERER_BLEND_PREMULTIPLIED,	/* dest = src + dest * (1 - a), src already multiplied by a */
+	RENDERER_BLEND_ADDITIVE	/* dest = dest + src * a, saturated */
+};
+
+/*	Sub-pixel precision:
+ *	Triangle vertices are 28.4 fixed point screen coordinates and pixel (x, y)
+ *	is sampled at its center (x + 0.5, y + 0.5). A pixel center exactly on an
+ *	edge only belongs to the triangle when that edge is a top edge (horizontal,
+ *	above the inside) or a left edge, so triangles sharing an edge touch every
+ *	pixel along it exactly once. */
+#define TQ_SW_SUBPIXEL_BITS 4
+#define TQ_SW_SUBPIXEL_ONE (1 << TQ_SW_SUBPIXEL_BITS)
+#define TQ_SW_SUBPIXEL_HALF (TQ_SW_SUBPIXEL_ONE / 2)
+
+typedef struct TriangleCommand
+{
+	int v1x;	/* 28.4 fixed point */
+	int v1y;
+	int v2x;
+	int v2y;
+	int v3x;
+	int v3y;
+	float z1;	/* depth in [0, 1] */
+	float z2;
+	float z3;
+	Color color;	/* only for flat triangles */
+	BlendMode blendMode;
+	bool isDepthTested;	/* false for the 2D triangles, see Depth buffer */
+	int varyings;	/* index into renderer->triangleVaryings, TQ_SW_FLAT for flat triangles */
+} TriangleCommand;
+
+#define TQ_SW_FLAT -1
+
+/*	What only shaded triangles have. Kept apart from their TriangleCommand, so
+ *	flat triangles (and binned ones) don't carry it around. */
+typedef struct TriangleVaryings
+{
+	float invW[3];	/* 1 / w per vertex */
+	float values[3][TQ_SW_MAX_VARYINGS];
+	int numVaryings;
+	const struct Texture* texture;	/* optional, sampled at VARYING_UV */
+	const struct Shader* shader;	/* optional, replaces the built-in fragment stage */
+} TriangleVaryings;
+
+/*	Depth buffer:
+ *	Optional, enabled with EnableDepthBuffer. Depth is in [0, 1] and a pixel
+ *	passes when it is closer (less) than what is stored. Depth testing always
+ *	goes through the half-space rasterizer. Only the 3D draws (DrawTriangles,
+ *	DrawShadedTriangles, DrawTrianglesWithShader) are depth tested: like 
+ *	DrawLine and FillRect, DrawTriangle is a 2D overlay which neither tests nor
+ *	writes depth, so it is drawn over whatever was drawn before.
+ *	For hierarchical early-Z every 8x8 block also keeps conservative bounds of
+ *	its depths, so whole blocks of occluded triangles are rejected at once.
+ *	The bounds have the precision of the format (see QuantizeDepth), so they 
+ *	agree with the per pixel test of 16-bit depths. */
+enum DepthFormat
+{
+	RENDERER_DEPTH_NONE = 0,
+	RENDERER_DEPTH_16 = 16,	/* u16, unsigned normalized */
+	RENDERER_DEPTH_32 = 32	/* float */
+};
+
+#define TQ_SW_BLOCK_SIZE 8
+
+typedef struct DepthBuffer
+{
+	u8* memory;
+	size_t capacity;	/* bytes of memory, see ReserveBuffer */
+	int width;
+	int height;
+	int pitch;
+	DepthFormat format;
+	
+	/* Per block bounds: every depth in the block is within [hiZMin, hiZMax] */
+	float* hiZMin;
+	float* hiZMax;
+	int numBlocksX;
+	int numBlocksY;
+	int maxBlocks;
+} DepthBuffer;
+
+enum Rasterizer
+{
+	RENDERER_RASTERIZER_SCANLINE = 0,
+	RENDERER_RASTERIZER_HALFSPACE = 1
+};
+
+/*	Culling:
+ *	The batch draws (DrawTriangles, DrawShadedTriangles and DrawTrianglesWithShader)
+ *	cull before any triangle is set up: a batch with every vertex outside the same
+ *	frustum plane is dropped as a whole, otherwise every triangle with all vertices
+ *	outside one plane, facing away or without area. Front faces are
+ *	counter-clockwise in normalized device coordinates, like OpenGL.
+ *	CullBoundingSphere rejects whole meshes before their vertices are transformed.
+ *	The counters add up until ResetCullStats, e.g. once per frame. */
+enum CullMode
+{
+	RENDERER_CULL_NONE = 0,
+	RENDERER_CULL_BACK,
+	RENDERER_CULL_FRONT
+};
+
+typedef struct CullStats
+{
+	int numTriangles;	/* submitted to the batch draws or culled by CullBoundingSphere */
+	int numFrustumCulled;
+	int numBackFaceCulled;	/* front faces with RENDERER_CULL_FRONT */
+	int numDegenerateCulled;	/* zero area after snapping to 28.4 */
+} CullStats;
+
+/*	Dirty rectangles:
+ *	Optional, enabled with EnableDirtyRects. Everything that draws adds the 
+ *	area it may have touched to the dirty rects, so only those have to be 
+ *	uploaded and presented, and ResetDirtyRects starts over for the next frame.
+ *	InvalidateRect goes the other way: until the next ResetDirtyRects every clear, 
+ *	fill, line and triangle is clipped to the invalidated rects, so a frame in 
+ *	which only a few things moved can be redrawn as a whole while only the pixels 
+ *	around them are cleared, rasterized, resolved and uploaded.
+ *	Rects which overlap, or whose bounding box is no bigger than both together, 
+ *	are merged, so the rects never overlap and blending never happens twice.
+ *	When the set is full the two rects which grow the least are merged. */
+#define TQ_SW_MAX_DIRTY_RECTS 16
+
+typedef struct DirtyRects
+{
+	Rect rects[TQ_SW_MAX_DIRTY_RECTS];	/* never overlapping */
+	int numRects;
+} DirtyRects;
+
+/*	Multisampling:
+ *	Optional, enabled with EnableMultisampling. Triangles are rasterized with 
+ *	4 samples per pixel into a sample buffer which has the samples of every pixel
+ *	next to each other, so covered spans are still filled in one go. Every sample
+ *	has a depth buffer of its own.
+ *	Coverage and depth are tested per sample, but every pixel is shaded only once,
+ *	at its center, and that color is written (or blended) to the samples which
+ *	pass. ResolveMultisampling averages the samples into the back buffer.
+ *	DrawPixel, DrawLine and FillRect always draw straight into the back buffer, 
+ *	so they end up on top of the resolved image, e.g. for UI.
+ *	The samples are on a rotated grid, offset in 1/16 pixels (28.4) from the center. */
+#define TQ_SW_NUM_SAMPLES 4
+#define TQ_SW_SAMPLE_EXTENT 6	/* largest offset of a sample along x or y */
+
+static const int sampleOffsets[TQ_SW_NUM_SAMPLES][2] =
+{
+	{ -2, -6 },
+	{ 6, -2 },
+	{ -6, 2 },
+	{ 2, 6 }
+};
+
+/*	Tiled rendering:
+ *	DrawTriangle only bins the triangle into every screen tile its bounding box
+ *	touches. FlushRenderer then rasterizes each tile on the work queue, every tile
+ *	walking its own bin in submission order, so the result is identical to
+ *	drawing the triangles one by one on a single thread. */
+#define TQ_SW_TILE_SIZE 64
+
+/*	Vertex after the vertex transform of DrawTriangles.
+ *	x, y and z are only valid when it doesn't need clipping */
+typedef struct TransformedVertex
+{
+	Vec4 clip;
+	u32 clipCode;
+	int x;	/* 28.4 fixed point */
+	int y;
+	float z;	/* depth in [0, 1] */
+	float invW;
+} TransformedVertex;
+
+struct Renderer;
+
+typedef struct RenderTile
+{
+	struct Renderer* renderer;
+	Rect rect;
+	u32* triangles;
+	int numTriangles;
+	int maxTriangles;
+} RenderTile;
+
+typedef struct Renderer
+{
+	BackBuffer backBuffer;
+	u8* headlessMemory;	/* the renderer's own back buffer, used when no memory is bound */
+	size_t headlessCapacity;
+	DepthBuffer depthBuffer;
+	int* scanBuffer;
+	int maxScanLines;
+	
+	/* Multisampling, sample 0 shares the depth buffer, see GetSampleDepthBuffer */
+	bool isMultisampled;
+	BackBuffer sampleBuffer;	/* TQ_SW_NUM_SAMPLES pixels wide per pixel */
+	size_t sampleCapacity;
+	DepthBuffer sampleDepthBuffers[TQ_SW_NUM_SAMPLES - 1];
+	Rasterizer rasterizer;
+	BlendMode blendMode;
+	CullMode cullMode;
+	CullStats cullStats;
+	
+	/* Dirty rectangles, see EnableDirtyRects */
+	bool isTrackingDirtyRects;
+	DirtyRects dirtyRects;	/* changed since ResetDirtyRects */
+	DirtyRects invalidRects;	/* drawing is clipped to these when there are any */
+	
+	/* Transformed vertices of the current DrawTriangles batch */
+	TransformedVertex* vertices;
+	float* varyings;	/* TQ_SW_MAX_VARYINGS per vertex, written by vertex shaders */
+	int maxVertices;
+	u32* visibleTriangles;	/* offsets of the first index of the triangles left after culling */
+	int maxVisibleTriangles;
+	
+	/*	Varyings of the pending shaded triangles, see AddTriangleVaryings. 
+	 *	Without tiling only the one being rasterized. */
+	TriangleVaryings* triangleVaryings;
+	int numTriangleVaryings;
+	int maxTriangleVaryings;
+	
+	/* Tiled rendering, only used when workQueue is set */
+	WorkQueue* workQueue;
+	TriangleCommand* triangles;
+	int numTriangles;
+	int maxTriangles;
+	RenderTile* tiles;
+	int numTilesX;
+	int numTilesY;
+	int maxTiles;	/* tiles beyond the grid keep their bins for when it grows again */
+} Renderer;
+
+/* NULL for flat triangles */
+inline const TriangleVaryings* GetTriangleVaryings(const Renderer* const renderer, 
+	const TriangleCommand* const triangle)
+{
+	return (triangle->varyings != TQ_SW_FLAT) ? &renderer->triangleVaryings[triangle->varyings] : NULL;
+}
+
+inline int MinInt(int a, int b)
+{
+	return (a < b) ? a : b;
+}
+
+inline int MaxInt(int a, int b)
+{
+	return (a > b) ? a : b;
+}
+
+inline bool IsRectEmpty(const Rect* const rect)
+{
+	return rect->xMin >= rect->xMax || rect->yMin >= rect->yMax;
+}
+
+inline i64 GetRectArea(const Rect* const rect)
+{
+	return IsRectEmpty(rect) ? 0 : (i64) (rect->xMax - rect->xMin) * (rect->yMax - rect->yMin);
+}
+
+inline Rect IntersectRects(const Rect* const a, const Rect* const b)
+{
+	const Rect result = {
+		MaxInt(a->xMin, b->xMin), MaxInt(a->yMin, b->yMin),
+		MinInt(a->xMax, b->xMax), MinInt(a->yMax, b->yMax)
+	};
+	return result;
+}
+
+/* Bounding box of both */
+inline Rect UniteRects(const Rect* const a, const Rect* const b)
+{
+	const Rect result = {
+		MinInt(a->xMin, b->xMin), MinInt(a->yMin, b->yMin),
+		MaxInt(a->xMax, b->xMax), MaxInt(a->yMax, b->yMax)
+	};
+	return result;
+}
+
+/*	Swizzled layout:
+ *	Optional, enabled with EnableSwizzledLayout. Stored row by row, a tall thin 
+ *	triangle touches a cache line per row, so the back buffer can also be stored 
+ *	in the 8x8 blocks the rasterizers walk: 256 bytes, 4 cache lines each. The 
+ *	blocks of every 64x64 tile are in Morton (Z) order, so blocks which are 
+ *	close on screen are close in memory, and the tiles go row by row: every tile 
+ *	is 16 KB of its own, which threads of tiled rendering never share.
+ *	A row of a block is 8 contiguous pixels, so the span kernels work as they 
+ *	are on block rows and longer spans are split at the block edges. 
+ *	The layout can't be shown as it is, CopyBackBuffer de-tiles it.
+ *
+ *	Reference:
+ *	Fabian Giesen, Texture tiling and swizzling (2011)
+ */
+#define TQ_SW_SWIZZLED_TILE_PIXELS (TQ_SW_TILE_SIZE * TQ_SW_TILE_SIZE)
+
+/*	Block coordinates 0 to 7 with their bits spread out to the even bits, 
+ *	so a Morton index is mortonBits[x] | (mortonBits[y] << 1) */
+static const u8 mortonBits[TQ_SW_TILE_SIZE / TQ_SW_BLOCK_SIZE] = { 0, 1, 4, 5, 16, 17, 20, 21 };
+
+/*	Pixel 0 of row y in the blocks of block column 0, the other blocks of the row 
+ *	are GetSwizzledOffset(x) pixels further */
+inline Pixel* GetSwizzledRow(const BackBuffer* const backBuffer, int y)
+{
+	const uint row = (uint) y;
+	const int block = mortonBits[(row / TQ_SW_BLOCK_SIZE) % 8] << 1;
+	return (Pixel*) (backBuffer->memory + (size_t) (row / TQ_SW_TILE_SIZE) * backBuffer->pitch)
+		+ block * TQ_SW_BLOCK_SIZE * TQ_SW_BLOCK_SIZE + (row % TQ_SW_BLOCK_SIZE) * TQ_SW_BLOCK_SIZE;
+}
+
+inline size_t GetSwizzledOffset(int x)
+{
+	const uint column = (uint) x;
+	return (size_t) (column / TQ_SW_TILE_SIZE) * TQ_SW_SWIZZLED_TILE_PIXELS 
+		+ mortonBits[(column / TQ_SW_BLOCK_SIZE) % 8] * TQ_SW_BLOCK_SIZE * TQ_SW_BLOCK_SIZE 
+		+ column % TQ_SW_BLOCK_SIZE;
+}
+
+inline Pixel* GetSwizzledPixel(const BackBuffer* const backBuffer, int x, int y)
+{
+	return GetSwizzledRow(backBuffer, y) + GetSwizzledOffset(x);
+}
+
+inline Pixel* GetPixelAddress(const BackBuffer* const backBuffer, int x, int y)
+{
+	if (backBuffer->layout == RENDERER_LAYOUT_SWIZZLED) {
+		return GetSwizzledPixel(backBuffer, x, y);
+	}
+	return GetBackBufferRow(backBuffer, y) + x;
+}
+
+/*	Row y of the block column starting at bx, indexed with x like GetBackBufferRow,
+ *	but only x in [bx, bx + TQ_SW_BLOCK_SIZE) are valid for the swizzled layout */
+inline Pixel* GetBlockRow(const BackBuffer* const backBuffer, int bx, int y)
+{
+	if (backBuffer->layout == RENDERER_LAYOUT_SWIZZLED) {
+		return GetSwizzledPixel(backBuffer, bx, y) - bx;
+	}
+	return GetBackBufferRow(backBuffer, y);
+}
+
+/*	Same visible area as DrawPixel */
+static Rect GetDrawableRect(const BackBuffer* const backBuffer)
+{
+	const Rect result = { 0, 0, backBuffer->width, backBuffer->height };
+	return result;
+}
+
+/*	Adds rect to the set, see Dirty rectangles. A merged rect can overlap 
+ *	others again, so merging repeats until it fits in next to the rest. */
+static void AddDirtyRect(DirtyRects* set, Rect rect)
+{
+	if (IsRectEmpty(&rect)) {
+		return;
+	}
+	
+	for (;;) {
+		int merge = -1;
+		for (int i = 0; i < set->numRects && merge < 0; i++) {
+			const Rect* const other = &set->rects[i];
+			const Rect overlap = IntersectRects(other, &rect);
+			const Rect box = UniteRects(other, &rect);
+			if (!IsRectEmpty(&overlap) || GetRectArea(&box) <= GetRectArea(other) + GetRectArea(&rect)) {
+				merge = i;
+			}
+		}
+		
+		if (merge < 0 && set->numRects == TQ_SW_MAX_DIRTY_RECTS) {
+			i64 leastGrowth = 0;
+			for (int i = 0; i < set->numRects; i++) {
+				const Rect box = UniteRects(&set->rects[i], &rect);
+				const i64 growth = GetRectArea(&box) - GetRectArea(&set->rects[i]);
+				if (merge < 0 || growth < leastGrowth) {
+					merge = i;
+					leastGrowth = growth;
+				}
+			}
+		}
+		
+		if (merge < 0) {
+			set->rects[set->numRects++] = rect;
+			return;
+		}
+		
+		rect = UniteRects(&set->rects[merge], &rect);
+		set->rects[merge] = set->rects[--set->numRects];
+	}
+}
+
+/*	Splits drawing inside clip into the parts inside the invalidated rects, or 
+ *	just clip when nothing is invalidated. Returns the number of clips written. */
+static int GetClipRects(const Renderer* const renderer, const Rect* const clip, Rect* clips)
+{
+	const DirtyRects* const invalidRects = &renderer->invalidRects;
+	if (invalidRects->numRects == 0) {
+		clips[0] = *clip;
+		return 1;
+	}
+	
+	int numClips = 0;
+	for (int i = 0; i < invalidRects->numRects; i++) {
+		const Rect rect = IntersectRects(&invalidRects->rects[i], clip);
+		if (!IsRectEmpty(&rect)) {
+			clips[numClips++] = rect;
+		}
+	}
+	return numClips;
+}
+
+/*	Records that the pixels in rect may have changed. Invalidated rects are 
+ *	already dirty and nothing is drawn outside them. */
+static void MarkDirtyRect(Renderer* renderer, const Rect* const rect)
+{
+	if (!renderer->isTrackingDirtyRects || renderer->invalidRects.numRects > 0) {
+		return;
+	}
+	
+	const Rect drawable = GetDrawableRect(&renderer->backBuffer);
+	AddDirtyRect(&renderer->dirtyRects, IntersectRects(rect, &drawable));
+}
+
+static void FillSpan(Pixel* span, int count, Pixel pixel)
+{
+	int i = 0;
+#ifdef TQ_SSE2
+	const __m128i pixels = _mm_set1_epi32((int) pixel);
+	for (; i + 4 <= count; i += 4) {
+		_mm_storeu_si128((__m128i*) (span + i), pixels);
+	}
+#endif
+	for (; i < count; i++) {
+		span[i] = pixel;
+	}
+}
+
+/*	Blend kernels:
+ *	Every blend mode has two span kernels, picked once per draw with
+ *	GetBlendKernels: fill blends one color over a span, span blends a row of
+ *	colors over a span wherever masks[i] is set (all bits). Both work on 4 pixels
+ *	at a time with SSE2, in 16 bits per channel, dividing by 255 with rounding.
+ *	Without SSE2 two channels are blended at once in the 16 bit halves of a u32.
+ *
+ *	Reference:
+ *	Jim Blinn, Three Wrongs Make a Right (IEEE Computer Graphics and Applications, 1995)
+ */
+typedef void BlendFillFunction(Pixel* span, int count, Pixel source);
+typedef void BlendSpanFunction(Pixel* span, int count, const Pixel* sources, const u32* masks);
+
+typedef struct BlendKernels
+{
+	BlendFillFunction* fill;
+	BlendSpanFunction* span;
+} BlendKernels;
+
+/* x / 255 rounded, for both 16 bit fields of x, each at most 255 * 255 */
+inline u32 Div255Packed(u32 x)
+{
+	x += 0x00800080;
+	return ((x + ((x >> 8) & 0x00FF00FF)) >> 8) & 0x00FF00FF;
+}
+
+/* Clamps both 9 bit fields of x to 255 */
+inline u32 SaturatePacked(u32 x)
+{
+	const u32 overflow = (x >> 8) & 0x00010001;
+	return (x | (overflow * 0xFF)) & 0x00FF00FF;
+}
+
+/*	The scalar blends split pixels into (b, r) and (g, a) fields. Where the source
+ *	is multiplied by its own alpha, its alpha field is replaced by 255 first, so 
+ *	the result is the alpha itself. */
+inline Pixel BlendPixelAlpha(Pixel dest, Pixel source)
+{
+	const u32 a = source >> 24;
+	const u32 ia = 255 - a;
+	const u32 rb = Div255Packed((source & 0x00FF00FF) * a + (dest & 0x00FF00FF) * ia);
+	const u32 ag = Div255Packed((((source >> 8) & 0xFF) | 0x00FF0000) * a 
+		+ ((dest >> 8) & 0x00FF00FF) * ia);
+	return rb | (ag << 8);
+}
+
+inline Pixel BlendPixelPremultiplied(Pixel dest, Pixel source)
+{
+	const u32 ia = 255 - (source >> 24);
+	const u32 rb = SaturatePacked((source & 0x00FF00FF) + Div255Packed((dest & 0x00FF00FF) * ia));
+	const u32 ag = SaturatePacked(((source >> 8) & 0x00FF00FF) 
+		+ Div255Packed(((dest >> 8) & 0x00FF00FF) * ia));
+	return rb | (ag << 8);
+}
+
+inline Pixel BlendPixelAdditive(Pixel dest, Pixel source)
+{
+	const u32 a = source >> 24;
+	const u32 rb = SaturatePacked(Div255Packed((source & 0x00FF00FF) * a) + (dest & 0x00FF00FF));
+	const u32 ag = SaturatePacked(Div255Packed((((source >> 8) & 0xFF) | 0x00FF0000) * a) 
+		+ ((dest >> 8) & 0x00FF00FF));
+	return rb | (ag << 8);
+}
+
+#ifdef TQ_SSE2
+/* x / 255 rounded, for every 16 bit lane of x, each at most 255 * 255 */
+inline __m128i Div255Epi16(__m128i x)
+{
+	x = _mm_add_epi16(x, _mm_set1_epi16(128));
+	return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+}
+
+/* Alpha of both pixels in 16 bit lanes, in every lane of its pixel */
+inline __m128i BroadcastAlpha(__m128i pixels)
+{
+	return _mm_shufflehi_epi16(_mm_shufflelo_epi16(pixels, 0xFF), 0xFF);
+}
+
+/* 255 in the alpha lane of both pixels, to multiply the alpha itself by 255 instead of by alpha */
+inline __m128i AlphaLanes()
+{
+	return _mm_setr_epi16(0, 0, 0, 255, 0, 0, 0, 255);
+}
+
+inline __m128i BlendAlpha4(__m128i dest, __m128i source)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i full = _mm_set1_epi16(255);
+	const __m128i sourceLo = _mm_unpacklo_epi8(source, zero);
+	const __m128i sourceHi = _mm_unpackhi_epi8(source, zero);
+	const __m128i alphaLo = BroadcastAlpha(sourceLo);
+	const __m128i alphaHi = BroadcastAlpha(sourceHi);
+	
+	const __m128i lo = Div255Epi16(_mm_add_epi16(
+		_mm_mullo_epi16(sourceLo, _mm_or_si128(alphaLo, AlphaLanes())),
+		_mm_mullo_epi16(_mm_unpacklo_epi8(dest, zero), _mm_sub_epi16(full, alphaLo))));
+	const __m128i hi = Div255Epi16(_mm_add_epi16(
+		_mm_mullo_epi16(sourceHi, _mm_or_si128(alphaHi, AlphaLanes())),
+		_mm_mullo_epi16(_mm_unpackhi_epi8(dest, zero), _mm_sub_epi16(full, alphaHi))));
+	return _mm_packus_epi16(lo, hi);
+}
+
+inline __m128i BlendPremultiplied4(__m128i dest, __m128i source)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i full = _mm_set1_epi16(255);
+	const __m128i inverseLo = _mm_sub_epi16(full, BroadcastAlpha(_mm_unpacklo_epi8(source, zero)));
+	const __m128i inverseHi = _mm_sub_epi16(full, BroadcastAlpha(_mm_unpackhi_epi8(source, zero)));
+	
+	const __m128i lo = Div255Epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(dest, zero), inverseLo));
+	const __m128i hi = Div255Epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(dest, zero), inverseHi));
+	return _mm_adds_epu8(source, _mm_packus_epi16(lo, hi));
+}
+
+inline __m128i BlendAdditive4(__m128i dest, __m128i source)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i sourceLo = _mm_unpacklo_epi8(source, zero);
+	const __m128i sourceHi = _mm_unpackhi_epi8(source, zero);
+	
+	const __m128i lo = Div255Epi16(_mm_mullo_epi16(sourceLo, 
+		_mm_or_si128(BroadcastAlpha(sourceLo), AlphaLanes())));
+	const __m128i hi = Div255Epi16(_mm_mullo_epi16(sourceHi, 
+		_mm_or_si128(BroadcastAlpha(sourceHi), AlphaLanes())));
+	return _mm_adds_epu8(dest, _mm_packus_epi16(lo, hi));
+}
+
+/* dest where mask is clear, blended where it is set */
+inline void StoreMasked4(Pixel* span, __m128i mask, __m128i blended, __m128i old)
+{
+	_mm_storeu_si128((__m128i*) span, _mm_or_si128(_mm_and_si128(mask, blended), 
+		_mm_andnot_si128(mask, old)));
+}
+#endif
+
+static void CopySpanMasked(Pixel* span, int count, const Pixel* sources, const u32* masks)
+{
+	int i = 0;
+#ifdef TQ_SSE2
+	for (; i + 4 <= count; i += 4) {
+		const __m128i mask = _mm_loadu_si128((const __m128i*) (masks + i));
+		StoreMasked4(span + i, mask, _mm_loadu_si128((const __m128i*) (sources + i)),
+			_mm_loadu_si128((const __m128i*) (span + i)));
+	}
+#endif
+	for (; i < count; i++) {
+		if (masks[i]) {
+			span[i] = sources[i];
+		}
+	}
+}
+
+static void BlendFillAlpha(Pixel* span, int count, Pixel source)
+{
+	int i = 0;
+#ifdef TQ_SSE2
+	const __m128i sources = _mm_set1_epi32((int) source);
+	for (; i + 4 <= count; i += 4) {
+		__m128i* dest = (__m128i*) (span + i);
+		_mm_storeu_si128(dest, BlendAlpha4(_mm_loadu_si128(dest), sources));
+	}
+#endif
+	for (; i < count; i++) {
+		span[i] = BlendPixelAlpha(span[i], source);
+	}
+}
+
+static void BlendSpanAlpha(Pixel* span, int count, const Pixel* sources, const u32* masks)
+{
+	int i = 0;
+#ifdef TQ_SSE2
+	for (; i + 4 <= count; i += 4) {
+		const __m128i mask = _mm_loadu_si128((const __m128i*) (masks + i));
+		const __m128i old = _mm_loadu_si128((const __m128i*) (span + i));
+		StoreMasked4(span + i, mask, 
+			BlendAlpha4(old, _mm_loadu_si128((const __m128i*) (sources + i))), old);
+	}
+#endif
+	for (; i < count; i++) {
+		if (masks[i]) {
+			span[i] = BlendPixelAlpha(span[i], sources[i]);
+		}
+	}
+}
+
+static void BlendFillPremultiplied(Pixel* span, int count, Pixel source)
+{
+	int i = 0;
+#ifdef TQ_SSE2
+	const __m128i sources = _mm_set1_epi32((int) source);
+	for (; i + 4 <= count; i += 4) {
+		__m128i* dest = (__m128i*) (span + i);
+		_mm_storeu_si128(dest, BlendPremultiplied4(_mm_loadu_si128(dest), sources));
+	}
+#endif
+	for (; i < count; i++) {
+		span[i] = BlendPixelPremultiplied(span[i], source);
+	}
+}
+
+static void BlendSpanPremultiplied(Pixel* span, int count, const Pixel* sources, const u32* masks)
+{
+	int i = 0;
+#ifdef TQ_SSE2
+	for (; i + 4 <= count; i += 4) {
+		const __m128i mask = _mm_loadu_si128((const __m128i*) (masks + i));
+		const __m128i old = _mm_loadu_si128((const __m128i*) (span + i));
+		StoreMasked4(span + i, mask, 
+			BlendPremultiplied4(old, _mm_loadu_si128((const __m128i*) (sources + i))), old);
+	}
+#endif
+	for (; i < count; i++) {
+		if (masks[i]) {
+			span[i] = BlendPixelPremultiplied(span[i], sources[i]);
+		}
+	}
+}
+
+static void BlendFillAdditive(Pixel* span, int count, Pixel source)
+{
+	int i = 0;
+#ifdef TQ_SSE2
+	const __m128i sources = _mm_set1_epi32((int) source);
+	for (; i + 4 <= count; i += 4) {
+		__m128i* dest = (__m128i*) (span + i);
+		_mm_storeu_si128(dest, BlendAdditive4(_mm_loadu_si128(dest), sources));
+	}
+#endif
+	for (; i < count; i++) {
+		span[i] = BlendPixelAdditive(span[i], source);
+	}
+}
+
+static void BlendSpanAdditive(Pixel* span, int count, const Pixel* sources, const u32* masks)
+{
+	int i = 0;
+#ifdef TQ_SSE2
+	for (; i + 4 <= count; i += 4) {
+		const __m128i mask = _mm_loadu_si128((const __m128i*) (masks + i));
+		const __m128i old = _mm_loadu_si128((const __m128i*) (span + i));
+		StoreMasked4(span + i, mask, 
+			BlendAdditive4(old, _mm_loadu_si128((const __m128i*) (sources + i))), old);
+	}
+#endif
+	for (; i < count; i++) {
+		if (masks[i]) {
+			span[i] = BlendPixelAdditive(span[i], sources[i]);
+		}
+	}
+}
+
+static BlendKernels GetBlendKernels(BlendMode mode)
+{
+	BlendKernels result;
+	switch (mode) {
+		case RENDERER_BLEND_ALPHA:
+			result.fill = BlendFillAlpha;
+			result.span = BlendSpanAlpha;
+			break;
+		case RENDERER_BLEND_PREMULTIPLIED:
+			result.fill = BlendFillPremultiplied;
+			result.span = BlendSpanPremultiplied;
+			break;
+		case RENDERER_BLEND_ADDITIVE:
+			result.fill = BlendFillAdditive;
+			result.span = BlendSpanAdditive;
+			break;
+		default:
+			result.fill = FillSpan;
+			result.span = CopySpanMasked;
+			break;
+	}
+	return result;
+}
+
+inline u16 DepthToU16(float depth)
+{
+	if (depth <= 0.0f) {
+		return 0;
+	}
+	if (depth >= 1.0f) {
+		return 0xFFFF;
+	}
+	return (u16) (depth * 65535.0f + 0.5f);
+}
+
+/* depth as stored in format, for the hi-Z bounds */
+inline float QuantizeDepth(DepthFormat format, float depth)
+{
+	if (format == RENDERER_DEPTH_16) {
+		return DepthToU16(depth) * (1.0f / 65535.0f);
+	}
+	return depth;
+}
+
+/*	Textures:
+ *	Mipmapped, every level is a 2x2 box filtered version of the one above it.
+ *	Width and height have to be powers of two, so wrapping is a mask.
+ *	Sampling is bilinear within one level (chosen per 8x8 block), with texel
+ *	coordinates in 16.16 fixed-point. */
+#define TQ_SW_MAX_TEXTURE_LEVELS 16
+
+typedef struct TextureLevel
+{
+	Pixel* pixels;
+	int width;
+	int height;
+	int widthShift;	/* log2(width) */
+} TextureLevel;
+
+typedef struct Texture
+{
+	Pixel* memory;
+	TextureLevel levels[TQ_SW_MAX_TEXTURE_LEVELS];
+	int numLevels;	/* 0 when the texture couldn't be created */
+} Texture;
+
+inline bool IsPowerOfTwo(int x)
+{
+	return x > 0 && (x & (x - 1)) == 0;
+}
+
+/* Average of 4 pixels, per channel */
+inline Pixel AveragePixels(Pixel p00, Pixel p01, Pixel p10, Pixel p11)
+{
+	const u32 rb = (p00 & 0x00FF00FF) + (p01 & 0x00FF00FF) + (p10 & 0x00FF00FF) + (p11 & 0x00FF00FF)
+		+ 0x00020002;
+	const u32 ag = ((p00 >> 8) & 0x00FF00FF) + ((p01 >> 8) & 0x00FF00FF) 
+		+ ((p10 >> 8) & 0x00FF00FF) + ((p11 >> 8) & 0x00FF00FF) + 0x00020002;
+	return ((rb >> 2) & 0x00FF00FF) | (((ag >> 2) & 0x00FF00FF) << 8);
+}
+
+/* Copies pixels (rows of width pixels) and builds all mip levels */
+Texture CreateTexture(const Pixel* pixels, int width, int height)
+{
+	Texture result;
+	result.memory = NULL;
+	result.numLevels = 0;
+	
+	if (!IsPowerOfTwo(width) || !IsPowerOfTwo(height)) {
+		return result;
+	}
+	
+	size_t memorySize = 0;
+	int levelWidth = width;
+	int levelHeight = height;
+	for (;;) {
+		TextureLevel* level = &result.levels[result.numLevels++];
+		level->width = levelWidth;
+		level->height = levelHeight;
+		level->widthShift = 0;
+		while ((1 << level->widthShift) < levelWidth) {
+			level->widthShift++;
+		}
+		memorySize += (size_t) levelWidth * levelHeight;
+		
+		if ((levelWidth == 1 && levelHeight == 1) || result.numLevels == TQ_SW_MAX_TEXTURE_LEVELS) {
+			break;
+		}
+		levelWidth = MaxInt(levelWidth / 2, 1);
+		levelHeight = MaxInt(levelHeight / 2, 1);
+	}
+	
+	result.memory = (Pixel*) malloc(sizeof(Pixel) * memorySize);
+	
+	Pixel* memory = result.memory;
+	for (int i = 0; i < result.numLevels; i++) {
+		result.levels[i].pixels = memory;
+		memory += (size_t) result.levels[i].width * result.levels[i].height;
+	}
+	memcpy(result.levels[0].pixels, pixels, sizeof(Pixel) * width * height);
+	
+	for (int i = 1; i < result.numLevels; i++) {
+		const TextureLevel* const source = &result.levels[i - 1];
+		TextureLevel* level = &result.levels[i];
+		
+		/* A side which is already 1 is not halved, so it reads the same texel twice */
+		const int sx = (source->width > 1) ? 2 : 1;
+		const int sy = (source->height > 1) ? 2 : 1;
+		const int dx = sx - 1;
+		const int dy = (sy - 1) * source->width;
+		
+		for (int y = 0; y < level->height; y++) {
+			for (int x = 0; x < level->width; x++) {
+				const Pixel* const p = source->pixels + (size_t) sy * y * source->width + sx * x;
+				level->pixels[y * level->width + x] = AveragePixels(p[0], p[dx], p[dy], p[dx + dy]);
+			}
+		}
+	}
+	
+	return result;
+}
+
+void DestroyTexture(Texture* texture)
+{
+	free(texture->memory);
+	texture->memory = NULL;
+	texture->numLevels = 0;
+}
+
+/*	Bilinear sample, u and v are 16.16 fixed-point texel coordinates
+ *	(already offset by half a texel, so 0 is the center of texel 0). */
+inline Pixel SampleBilinear(const TextureLevel* const level, int u, int v)
+{
+	const int x0 = (u >> 16) & (level->width - 1);
+	const int y0 = (v >> 16) & (level->height - 1);
+	const int x1 = (x0 + 1) & (level->width - 1);
+	const int y1 = (y0 + 1) & (level->height - 1);
+	const u32 fx = (u >> 8) & 0xFF;
+	const u32 fy = (v >> 8) & 0xFF;
+	
+	const Pixel* const row0 = level->pixels + y0 * level->width;
+	const Pixel* const row1 = level->pixels + y1 * level->width;
+	const Pixel p00 = row0[x0];
+	const Pixel p01 = row0[x1];
+	const Pixel p10 = row1[x0];
+	const Pixel p11 = row1[x1];
+	
+	/*	Two channels at a time: 8 bit channel times 8 bit weight fits in the 
+	 *	16 bits between them. Weights are out of 256. */
+	const u32 rbTop = ((p00 & 0x00FF00FF) * (256 - fx) + (p01 & 0x00FF00FF) * fx) >> 8;
+	const u32 agTop = (((p00 >> 8) & 0x00FF00FF) * (256 - fx) + ((p01 >> 8) & 0x00FF00FF) * fx) >> 8;
+	const u32 rbBottom = ((p10 & 0x00FF00FF) * (256 - fx) + (p11 & 0x00FF00FF) * fx) >> 8;
+	const u32 agBottom = (((p10 >> 8) & 0x00FF00FF) * (256 - fx) + ((p11 >> 8) & 0x00FF00FF) * fx) >> 8;
+	
+	const u32 rb = (((rbTop & 0x00FF00FF) * (256 - fy) + (rbBottom & 0x00FF00FF) * fy) >> 8) & 0x00FF00FF;
+	const u32 ag = (((agTop & 0x00FF00FF) * (256 - fy) + (agBottom & 0x00FF00FF) * fy) >> 8) & 0x00FF00FF;
+	
+	return rb | (ag << 8);
+}
+
+#ifdef TQ_SSE2
+/* (a * (256 - f) + b * f) >> 8 per 16 bit channel */
+inline __m128i Lerp16(__m128i a, __m128i b, __m128i f)
+{
+	return _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(a, _mm_sub_epi16(_mm_set1_epi16(256), f)), 
+		_mm_mullo_epi16(b, f)), 8);
+}
+
+/*	SampleBilinear for 4 pixels. The texels are fetched one by one (SSE2 has no
+ *	gathers), the filtering is done on 16 bits per channel: a * (256 - f) + b * f
+ *	is at most 255 * 256, which still fits when read back as unsigned. */
+static __m128i SampleBilinear4(const TextureLevel* const level, __m128i u, __m128i v)
+{
+	const __m128i xMask = _mm_set1_epi32(level->width - 1);
+	const __m128i yMask = _mm_set1_epi32(level->height - 1);
+	const __m128i one = _mm_set1_epi32(1);
+	const __m128i shift = _mm_cvtsi32_si128(level->widthShift);
+	
+	const __m128i x0 = _mm_and_si128(_mm_srai_epi32(u, 16), xMask);
+	const __m128i y0 = _mm_and_si128(_mm_srai_epi32(v, 16), yMask);
+	const __m128i x1 = _mm_and_si128(_mm_add_epi32(x0, one), xMask);
+	const __m128i y1 = _mm_and_si128(_mm_add_epi32(y0, one), yMask);
+	const __m128i row0 = _mm_sll_epi32(y0, shift);
+	const __m128i row1 = _mm_sll_epi32(y1, shift);
+	
+	TQ_ALIGN(16) int offsets[4][4];
+	_mm_store_si128((__m128i*) offsets[0], _mm_add_epi32(row0, x0));
+	_mm_store_si128((__m128i*) offsets[1], _mm_add_epi32(row0, x1));
+	_mm_store_si128((__m128i*) offsets[2], _mm_add_epi32(row1, x0));
+	_mm_store_si128((__m128i*) offsets[3], _mm_add_epi32(row1, x1));
+	
+	const Pixel* const pixels = level->pixels;
+	const __m128i p00 = _mm_setr_epi32((int) pixels[offsets[0][0]], (int) pixels[offsets[0][1]], 
+		(int) pixels[offsets[0][2]], (int) pixels[offsets[0][3]]);
+	const __m128i p01 = _mm_setr_epi32((int) pixels[offsets[1][0]], (int) pixels[offsets[1][1]], 
+		(int) pixels[offsets[1][2]], (int) pixels[offsets[1][3]]);
+	const __m128i p10 = _mm_setr_epi32((int) pixels[offsets[2][0]], (int) pixels[offsets[2][1]], 
+		(int) pixels[offsets[2][2]], (int) pixels[offsets[2][3]]);
+	const __m128i p11 = _mm_setr_epi32((int) pixels[offsets[3][0]], (int) pixels[offsets[3][1]], 
+		(int) pixels[offsets[3][2]], (int) pixels[offsets[3][3]]);
+	
+	/* 8 bit weights, copied to the 16 bits of every channel */
+	const __m128i byteMask = _mm_set1_epi32(0xFF);
+	__m128i fx = _mm_and_si128(_mm_srli_epi32(u, 8), byteMask);
+	__m128i fy = _mm_and_si128(_mm_srli_epi32(v, 8), byteMask);
+	fx = _mm_or_si128(fx, _mm_slli_epi32(fx, 16));
+	fy = _mm_or_si128(fy, _mm_slli_epi32(fy, 16));
+	const __m128i fxLo = _mm_unpacklo_epi32(fx, fx);
+	const __m128i fxHi = _mm_unpackhi_epi32(fx, fx);
+	const __m128i fyLo = _mm_unpacklo_epi32(fy, fy);
+	const __m128i fyHi = _mm_unpackhi_epi32(fy, fy);
+	const __m128i zero = _mm_setzero_si128();
+	
+	const __m128i topLo = Lerp16(_mm_unpacklo_epi8(p00, zero), _mm_unpacklo_epi8(p01, zero), fxLo);
+	const __m128i topHi = Lerp16(_mm_unpackhi_epi8(p00, zero), _mm_unpackhi_epi8(p01, zero), fxHi);
+	const __m128i bottomLo = Lerp16(_mm_unpacklo_epi8(p10, zero), _mm_unpacklo_epi8(p11, zero), fxLo);
+	const __m128i bottomHi = Lerp16(_mm_unpackhi_epi8(p10, zero), _mm_unpackhi_epi8(p11, zero), fxHi);
+	const __m128i lo = Lerp16(topLo, bottomLo, fyLo);
+	const __m128i hi = Lerp16(topHi, bottomHi, fyHi);
+	
+	return _mm_packus_epi16(lo, hi);
+}
+#endif
+
+/*	Memory:
+ *	Every buffer the renderer allocates starts on a cache line and has rows 
+ *	padded to whole cache lines, so no row shares a line with the next one 
+ *	(tiles on different threads never write the same line) and every row 
+ *	starts aligned for SIMD loads and stores.
+ *	A pitch which is a multiple of TQ_SW_ALIASING_PITCH gets one more line of
+ *	padding, otherwise all rows of a block map to the same cache sets.
+ *	Both can be defined before including this file.
+ *	Memory is zeroed by calloc, which maps fresh pages from the OS for big
+ *	allocations instead of writing zeros.
+ *	Buffers that depend on the size are only reallocated when they grow beyond 
+ *	what was reserved, see ResizeRenderer. */
+#ifndef TQ_SW_ROW_ALIGNMENT
+#define TQ_SW_ROW_ALIGNMENT 64
+#endif
+
+#ifndef TQ_SW_ALIASING_PITCH
+#define TQ_SW_ALIASING_PITCH 4096	/* 0 to never pad more than the alignment */
+#endif
+
+/*	Zeroed memory aligned to TQ_SW_ROW_ALIGNMENT. The pointer from calloc is
+ *	kept right in front of the aligned memory for FreeAligned. */
+static void* AllocateAligned(size_t size)
+{
+	u8* memory = (u8*) calloc(size + TQ_SW_ROW_ALIGNMENT + sizeof(void*), 1);
+	if (!memory) {
+		return NULL;
+	}
+	
+	const uintptr_t aligned = ((uintptr_t) memory + sizeof(void*) + TQ_SW_ROW_ALIGNMENT - 1) 
+		& ~(uintptr_t) (TQ_SW_ROW_ALIGNMENT - 1);
+	((void**) aligned)[-1] = memory;
+	return (void*) aligned;
+}
+
+static void FreeAligned(void* memory)
+{
+	if (memory) {
+		free(((void**) memory)[-1]);
+	}
+}
+
+/* Bytes per row of a buffer the renderer allocates */
+inline int GetPaddedPitch(int width, int bytesPerElement)
+{
+	int pitch = (width * bytesPerElement + TQ_SW_ROW_ALIGNMENT - 1) & ~(TQ_SW_ROW_ALIGNMENT - 1);
+	if (TQ_SW_ALIASING_PITCH > 0 && pitch % TQ_SW_ALIASING_PITCH == 0) {
+		pitch += TQ_SW_ROW_ALIGNMENT;
+	}
+	return pitch;
+}
+
+/*	Makes room for size bytes, keeping memory when it is big enough already.
+ *	Otherwise it grows by at least half, so a window that is resized a few pixels
+ *	at a time doesn't reallocate every frame. The old contents are lost, 
+ *	new memory is zeroed. */
+static u8* ReserveBuffer(u8* memory, size_t* capacity, size_t size)
+{
+	if (size <= *capacity) {
+		return memory;
+	}
+	
+	FreeAligned(memory);
+	const size_t grown = *capacity + *capacity / 2;
+	*capacity = (size > grown) ? size : grown;
+	return (u8*) AllocateAligned(*capacity);
+}
+
+/*	Sets the pitch of the renderer's own memory for the layout and returns 
+ *	the bytes it takes. Swizzled buffers are whole tiles. */
+static size_t LayoutBackBuffer(BackBuffer* backBuffer)
+{
+	if (backBuffer->layout == RENDERER_LAYOUT_SWIZZLED) {
+		const int numTilesX = (backBuffer->width + TQ_SW_TILE_SIZE - 1) / TQ_SW_TILE_SIZE;
+		const int numTilesY = (backBuffer->height + TQ_SW_TILE_SIZE - 1) / TQ_SW_TILE_SIZE;
+		backBuffer->pitch = numTilesX * TQ_SW_SWIZZLED_TILE_PIXELS * sizeof(Pixel);
+		return (size_t) backBuffer->pitch * numTilesY;
+	}
+	
+	backBuffer->pitch = GetPaddedPitch(backBuffer->width, sizeof(Pixel));
+	return (size_t) backBuffer->pitch * backBuffer->height;
+}
+
+void ResizeRenderer(Renderer* renderer, int width, int height);
+
+/*	Presentation:
+ *	The renderer allocates a plain back buffer of its own, which is all a
+ *	headless renderer (benchmarks, screenshots) needs. To present without a
+ *	copy, bind the memory of a locked streaming texture with BindBackBuffer
+ *	every frame and unbind it before unlocking the texture. A locked texture
+ *	doesn't keep the previous frame, so every frame has to start with a clear. */
+Renderer CreateRenderer(int width, int height)
+{
+	Renderer result;
+	result.backBuffer.memory = NULL;
+	result.backBuffer.width = 0;
+	result.backBuffer.height = 0;
+	result.backBuffer.layout = RENDERER_LAYOUT_LINEAR;
+	result.headlessMemory = NULL;
+	result.headlessCapacity = 0;
+	
+	result.depthBuffer.memory = NULL;
+	result.depthBuffer.format = RENDERER_DEPTH_NONE;
+	result.depthBuffer.hiZMin = NULL;
+	result.depthBuffer.hiZMax = NULL;
+	
+	result.isMultisampled = false;
+	result.sampleBuffer.memory = NULL;
+	result.sampleCapacity = 0;
+	for (int i = 0; i < TQ_SW_NUM_SAMPLES - 1; i++) {
+		result.sampleDepthBuffers[i].memory = NULL;
+	}
+	
+	result.scanBuffer = NULL;
+	result.maxScanLines = 0;
+	
+	result.rasterizer = RENDERER_RASTERIZER_SCANLINE;
+	result.blendMode = RENDERER_BLEND_NONE;
+	result.cullMode = RENDERER_CULL_NONE;
+	memset(&result.cullStats, 0, sizeof(result.cullStats));
+	result.isTrackingDirtyRects = false;
+	result.dirtyRects.numRects = 0;
+	result.invalidRects.numRects = 0;
+	result.vertices = NULL;
+	result.varyings = NULL;
+	result.maxVertices = 0;
+	result.visibleTriangles = NULL;
+	result.maxVisibleTriangles = 0;
+	result.triangleVaryings = NULL;
+	result.numTriangleVaryings = 0;
+	result.maxTriangleVaryings = 0;
+	result.workQueue = NULL;
+	result.triangles = NULL;
+	result.numTriangles = 0;
+	result.maxTriangles = 0;
+	result.tiles = NULL;
+	result.numTilesX = 0;
+	result.numTilesY = 0;
+	result.maxTiles = 0;
+	
+	/* Everything is allocated zeroed */
+	ResizeRenderer(&result, width, height);
+	
+	return result;
+}
+
+void DisableTiledRendering(Renderer* renderer);
+void DisableDepthBuffer(Renderer* renderer);
+void DisableMultisampling(Renderer* renderer);
+
+void DestroyRenderer(Renderer* renderer)
+{
+	DisableTiledRendering(renderer);
+	DisableMultisampling(renderer);
+	DisableDepthBuffer(renderer);
+	FreeAligned(renderer->headlessMemory);
+	free(renderer->scanBuffer);
+	free(renderer->vertices);
+	free(renderer->varyings);
+	free(renderer->visibleTriangles);
+	free(renderer->triangleVaryings);
+}
+
+/*	Pending triangles which are overwritten by a clear are never rasterized */
+static void DiscardTiles(Renderer* renderer)
+{
+	const int numTiles = renderer->numTilesX * renderer->numTilesY;
+	for (int i = 0; i < numTiles; i++) {
+		renderer->tiles[i].numTriangles = 0;
+	}
+	renderer->numTriangles = 0;
+	renderer->numTriangleVaryings = 0;
+}
+
+void FlushRenderer(Renderer* renderer);
+
+/*	Fills bigger than this use non-temporal stores. Roughly the size of a
+ *	last level cache, there's no portable way to query it. */
+#define TQ_SW_STREAMING_THRESHOLD (8 * 1024 * 1024)
+
+/*	Fills with non-temporal stores, which bypass the cache instead of
+ *	evicting everything else for data that won't be read back soon. */
+static void FillSpanStreaming(Pixel* span, size_t count, Pixel pixel)
+{
+	size_t i = 0;
+#ifdef TQ_SSE2
+	/* Streaming stores need 16 byte alignment */
+	for (; i < count && ((uintptr_t) (span + i) & 15) != 0; i++) {
+		span[i] = pixel;
+	}
+	
+	const __m128i pixels = _mm_set1_epi32((int) pixel);
+	for (; i + 16 <= count; i += 16) {
+		_mm_stream_si128((__m128i*) (span + i), pixels);
+		_mm_stream_si128((__m128i*) (span + i + 4), pixels);
+		_mm_stream_si128((__m128i*) (span + i + 8), pixels);
+		_mm_stream_si128((__m128i*) (span + i + 12), pixels);
+	}
+	for (; i + 4 <= count; i += 4) {
+		_mm_stream_si128((__m128i*) (span + i), pixels);
+	}
+	_mm_sfence();
+#endif
+	for (; i < count; i++) {
+		span[i] = pixel;
+	}
+}
+
+/*	Fills pixels [xMin, xMax) of row y, in pieces that are contiguous in memory.
+ *	fill is a blend kernel or FillSpan. */
+static void FillRowSpan(const BackBuffer* const backBuffer, int y, int xMin, int xMax, 
+	BlendFillFunction* fill, Pixel pixel)
+{
+	if (backBuffer->layout != RENDERER_LAYOUT_SWIZZLED) {
+		fill(GetBackBufferRow(backBuffer, y) + xMin, xMax - xMin, pixel);
+		return;
+	}
+	
+	Pixel* const row = GetSwizzledRow(backBuffer, y);
+	for (int x = xMin; x < xMax; ) {
+		const int end = MinInt((x | (TQ_SW_BLOCK_SIZE - 1)) + 1, xMax);
+		fill(row + GetSwizzledOffset(x), end - x, pixel);
+		x = end;
+	}
+}
+
+/*	Fills rect (clipped to the back buffer) with color.
+ *	Rows are filled as a single span when the rect covers whole rows. */
+static void FillBackBufferRect(BackBuffer* backBuffer, const Rect* rect, Pixel pixel)
+{
+	const int xMin = MaxInt(rect->xMin, 0);
+	const int yMin = MaxInt(rect->yMin, 0);
+	const int xMax = MinInt(rect->xMax, backBuffer->width);
+	const int yMax = MinInt(rect->yMax, backBuffer->height);
+	
+	if (xMin >= xMax || yMin >= yMax) {
+		return;
+	}
+	
+	const size_t bytes = (size_t) (xMax - xMin) * (yMax - yMin) * sizeof(Pixel);
+	const bool isStreaming = (bytes >= TQ_SW_STREAMING_THRESHOLD);
+	const bool isSwizzled = (backBuffer->layout == RENDERER_LAYOUT_SWIZZLED);
+	const bool isWhole = (xMin == 0 && xMax == backBuffer->width && yMin == 0 && yMax == backBuffer->height);
+	const bool isContiguous = (xMin == 0 && xMax == backBuffer->width 
+		&& backBuffer->pitch == backBuffer->width * (int) sizeof(Pixel));
+	
+	if (isSwizzled && !isWhole) {
+		for (int y = yMin; y < yMax; y++) {
+			FillRowSpan(backBuffer, y, xMin, xMax, FillSpan, pixel);
+		}
+		return;
+	}
+	
+	/* A whole swizzled buffer is whole tiles, the pixels outside are never shown */
+	if (isContiguous || isSwizzled) {
+		Pixel* span = isSwizzled ? (Pixel*) backBuffer->memory : GetBackBufferRow(backBuffer, yMin);
+		const int numRows = isSwizzled ? (yMax + TQ_SW_TILE_SIZE - 1) / TQ_SW_TILE_SIZE : yMax - yMin;
+		const size_t count = (size_t) backBuffer->pitch / sizeof(Pixel) * numRows;
+		if (isStreaming) {
+			FillSpanStreaming(span, count, pixel);
+		} else {
+			FillSpan(span, (int) count, pixel);
+		}
+		return;
+	}
+	
+	for (int y = yMin; y < yMax; y++) {
+		Pixel* span = GetBackBufferRow(backBuffer, y) + xMin;
+		if (isStreaming) {
+			FillSpanStreaming(span, xMax - xMin, pixel);
+		} else {
+			FillSpan(span, xMax - xMin, pixel);
+		}
+	}
+}
+
+void ClearBackBuffer(Renderer* renderer, Color* color)
+{
+	if (renderer->numTriangles > 0) {
+		/* Pending triangles still have to write their depth */
+		if (renderer->depthBuffer.memory) {
+			FlushRenderer(renderer);
+		} else {
+			DiscardTiles(renderer);
+		}
+	}
+	
+	const Rect drawable = GetDrawableRect(&renderer->backBuffer);
+	Rect clips[TQ_SW_MAX_DIRTY_RECTS];
+	const int numClips = GetClipRects(renderer, &drawable, clips);
+	MarkDirtyRect(renderer, &drawable);
+	
+	/* With multisampling the back buffer is overwritten by the resolve anyway */
+	const Pixel pixel = PackColor(color);
+	for (int i = 0; i < numClips; i++) {
+		if (renderer->isMultisampled) {
+			Rect samples = clips[i];
+			samples.xMin *= TQ_SW_NUM_SAMPLES;
+			samples.xMax *= TQ_SW_NUM_SAMPLES;
+			FillBackBufferRect(&renderer->sampleBuffer, &samples, pixel);
+		} else {
+			FillBackBufferRect(&renderer->backBuffer, &clips[i], pixel);
+		}
+	}
+}
+
+void FillRect(Renderer* renderer, const Rect* rect, const Color* const color)
+{
+	if (renderer->numTriangles > 0) {
+		FlushRenderer(renderer);
+	}
+	
+	BackBuffer* backBuffer = &renderer->backBuffer;
+	const Rect drawable = GetDrawableRect(backBuffer);
+	const Rect area = IntersectRects(rect, &drawable);
+	Rect clips[TQ_SW_MAX_DIRTY_RECTS];
+	const int numClips = GetClipRects(renderer, &area, clips);
+	MarkDirtyRect(renderer, &area);
+	
+	const Pixel pixel = PackColor(color);
+	for (int i = 0; i < numClips; i++) {
+		const Rect* const clip = &clips[i];
+		if (renderer->blendMode == RENDERER_BLEND_NONE) {
+			FillBackBufferRect(backBuffer, clip, pixel);
+			continue;
+		}
+		
+		/* Blending reads every destination pixel, so no streaming stores */
+		BlendFillFunction* const fill = GetBlendKernels(renderer->blendMode).fill;
+		for (int y = clip->yMin; y < clip->yMax; y++) {
+			FillRowSpan(backBuffer, y, clip->xMin, clip->xMax, fill, pixel);
+		}
+	}
+}
+
+/*	Blend mode of everything drawn from now on. Triangles keep the mode they 
+ *	were drawn with, so changing it does not flush. ClearBackBuffer never blends. */
+void SetBlendMode(Renderer* renderer, BlendMode mode)
+{
+	renderer->blendMode = mode;
+}
+
+/* Which faces the batch draws cull, see Culling */
+void SetCullMode(Renderer* renderer, CullMode mode)
+{
+	renderer->cullMode = mode;
+}
+
+void ResetCullStats(Renderer* renderer)
+{
+	memset(&renderer->cullStats, 0, sizeof(renderer->cullStats));
+}
+
+/*	Starts tracking the dirty rects, see Dirty rectangles. Everything drawn 
+ *	before is not tracked, so present the whole back buffer once. */
+void EnableDirtyRects(Renderer* renderer)
+{
+	renderer->isTrackingDirtyRects = true;
+	renderer->dirtyRects.numRects = 0;
+	renderer->invalidRects.numRects = 0;
+}
+
+void DisableDirtyRects(Renderer* renderer)
+{
+	if (renderer->numTriangles > 0) {
+		FlushRenderer(renderer);
+	}
+	
+	renderer->isTrackingDirtyRects = false;
+	renderer->dirtyRects.numRects = 0;
+	renderer->invalidRects.numRects = 0;
+}
+
+/*	Clips all drawing to the invalidated rects until the next ResetDirtyRects,
+ *	e.g. the old and the new bounds of everything that moved this frame. */
+void InvalidateRect(Renderer* renderer, const Rect* rect)
+{
+	if (!renderer->isTrackingDirtyRects) {
+		return;
+	}
+	
+	/* Pending triangles are clipped to the invalidated rects when they are rasterized */
+	if (renderer->numTriangles > 0) {
+		FlushRenderer(renderer);
+	}
+	
+	const Rect drawable = GetDrawableRect(&renderer->backBuffer);
+	const Rect clipped = IntersectRects(rect, &drawable);
+	AddDirtyRect(&renderer->invalidRects, clipped);
+	AddDirtyRect(&renderer->dirtyRects, clipped);
+}
+
+/*	Rasterizes everything that is pending and forgets the dirty and invalidated 
+ *	rects. Call after presenting the dirty rects of a frame. */
+void ResetDirtyRects(Renderer* renderer)
+{
+	if (renderer->numTriangles > 0) {
+		FlushRenderer(renderer);
+	}
+	
+	renderer->dirtyRects.numRects = 0;
+	renderer->invalidRects.numRects = 0;
+}
+
+/*	Renders into memory (width x height pixels, pitch in bytes) until
+ *	UnbindBackBuffer, e.g. the pixels of a locked streaming texture. 
+ *	Ignored with the swizzled layout, present with CopyBackBuffer instead. */
+void BindBackBuffer(Renderer* renderer, void* memory, int pitch)
+{
+	if (renderer->backBuffer.layout == RENDERER_LAYOUT_SWIZZLED) {
+		return;
+	}
+	
+	if (renderer->numTriangles > 0) {
+		FlushRenderer(renderer);
+	}
+	
+	renderer->backBuffer.memory = (u8*) memory;
+	renderer->backBuffer.pitch = pitch;
+}
+
+/* Rasterizes everything that is pending into the bound memory and goes back to headless */
+void UnbindBackBuffer(Renderer* renderer)
+{
+	if (renderer->numTriangles > 0) {
+		FlushRenderer(renderer);
+	}
+	
+	renderer->backBuffer.memory = renderer->headlessMemory;
+	LayoutBackBuffer(&renderer->backBuffer);
+}
+
+/* Copies row y of a swizzled back buffer to pixels */
+static void DetileRow(Pixel* pixels, const BackBuffer* const backBuffer, int y)
+{
+	const int width = backBuffer->width;
+	const Pixel* const row = GetSwizzledRow(backBuffer, y);
+	int x = 0;
+	for (; x + TQ_SW_BLOCK_SIZE <= width; x += TQ_SW_BLOCK_SIZE) {
+		const Pixel* const source = row + GetSwizzledOffset(x);
+#ifdef TQ_SSE2
+		/* Block rows are 32 bytes into cache line aligned blocks */
+		_mm_storeu_si128((__m128i*) (pixels + x), _mm_load_si128((const __m128i*) source));
+		_mm_storeu_si128((__m128i*) (pixels + x + 4), _mm_load_si128((const __m128i*) (source + 4)));
+#else
+		memcpy(pixels + x, source, TQ_SW_BLOCK_SIZE * sizeof(Pixel));
+#endif
+	}
+	if (x < width) {
+		memcpy(pixels + x, row + GetSwizzledOffset(x), (width - x) * sizeof(Pixel));
+	}
+}
+
+/* Copies pixels to row y of a swizzled back buffer */
+static void SwizzleRow(const BackBuffer* const backBuffer, int y, const Pixel* pixels)
+{
+	Pixel* const row = GetSwizzledRow(backBuffer, y);
+	for (int x = 0; x < backBuffer->width; x += TQ_SW_BLOCK_SIZE) {
+		const int count = MinInt(TQ_SW_BLOCK_SIZE, backBuffer->width - x);
+		memcpy(row + GetSwizzledOffset(x), pixels + x, count * sizeof(Pixel));
+	}
+}
+
+/*	Rasterizes everything that is pending and copies the back buffer to memory 
+ *	(width x height pixels, pitch in bytes), e.g. a locked streaming texture.
+ *	The swizzled layout is de-tiled on the way, a block row at a time, 
+ *	so the stores into memory are still sequential. */
+void CopyBackBuffer(Renderer* renderer, void* memory, int pitch)
+{
+	if (renderer->numTriangles > 0) {
+		FlushRenderer(renderer);
+	}
+	
+	const BackBuffer* const backBuffer = &renderer->backBuffer;
+	for (int y = 0; y < backBuffer->height; y++) {
+		Pixel* pixels = (Pixel*) ((u8*) memory + (size_t) y * pitch);
+		if (backBuffer->layout == RENDERER_LAYOUT_SWIZZLED) {
+			DetileRow(pixels, backBuffer, y);
+		} else {
+			memcpy(pixels, GetBackBufferRow(backBuffer, y), backBuffer->width * sizeof(Pixel));
+		}
+	}
+}
+
+/*	Switches the renderer's own memory to layout, keeping the pixels. Bound 
+ *	memory is copied and unbound, the swizzled layout is never bound. */
+static void ChangeBackBufferLayout(Renderer* renderer, BackBufferLayout layout)
+{
+	if (renderer->numTriangles > 0) {
+		FlushRenderer(renderer);
+	}
+	
+	BackBuffer* backBuffer = &renderer->backBuffer;
+	BackBuffer changed = *backBuffer;
+	changed.layout = layout;
+	size_t capacity = 0;
+	changed.memory = ReserveBuffer(NULL, &capacity, LayoutBackBuffer(&changed));
+	
+	for (int y = 0; y < backBuffer->height; y++) {
+		if (layout == RENDERER_LAYOUT_SWIZZLED) {
+			SwizzleRow(&changed, y, GetBackBufferRow(backBuffer, y));
+		} else {
+			DetileRow(GetBackBufferRow(&changed, y), backBuffer, y);
+		}
+	}
+	
+	FreeAligned(renderer->headlessMemory);
+	renderer->headlessMemory = changed.memory;
+	renderer->headlessCapacity = capacity;
+	*backBuffer = changed;
+}
+
+/* Stores the back buffer in blocks from now on, see Swizzled layout */
+void EnableSwizzledLayout(Renderer* renderer)
+{
+	if (renderer->backBuffer.layout != RENDERER_LAYOUT_SWIZZLED) {
+		ChangeBackBufferLayout(renderer, RENDERER_LAYOUT_SWIZZLED);
+	}
+}
+
+void DisableSwizzledLayout(Renderer* renderer)
+{
+	if (renderer->backBuffer.layout != RENDERER_LAYOUT_LINEAR) {
+		ChangeBackBufferLayout(renderer, RENDERER_LAYOUT_LINEAR);
+	}
+}
+
+/* Depth buffer of sample i, the depth buffer itself for the first sample */
+inline DepthBuffer* GetSampleDepthBuffer(Renderer* renderer, int i)
+{
+	return (i == 0) ? &renderer->depthBuffer : &renderer->sampleDepthBuffers[i - 1];
+}
+
+/* Depths are undefined until the plane is filled */
+static void ResizeDepthPlane(DepthBuffer* depthBuffer, int width, int height)
+{
+	const int bytesPerDepth = (depthBuffer->format == RENDERER_DEPTH_16) ? 2 : 4;
+	
+	depthBuffer->width = width;
+	depthBuffer->height = height;
+	depthBuffer->pitch = GetPaddedPitch(width, bytesPerDepth);
+	depthBuffer->memory = ReserveBuffer(depthBuffer->memory, &depthBuffer->capacity, 
+		(size_t) depthBuffer->pitch * height);
+	
+	depthBuffer->numBlocksX = (width + TQ_SW_BLOCK_SIZE - 1) / TQ_SW_BLOCK_SIZE;
+	depthBuffer->numBlocksY = (height + TQ_SW_BLOCK_SIZE - 1) / TQ_SW_BLOCK_SIZE;
+	const int numBlocks = depthBuffer->numBlocksX * depthBuffer->numBlocksY;
+	if (numBlocks > depthBuffer->maxBlocks) {
+		free(depthBuffer->hiZMin);
+		free(depthBuffer->hiZMax);
+		depthBuffer->maxBlocks = MaxInt(numBlocks, depthBuffer->maxBlocks + depthBuffer->maxBlocks / 2);
+		depthBuffer->hiZMin = (float*) malloc(sizeof(float) * depthBuffer->maxBlocks);
+		depthBuffer->hiZMax = (float*) malloc(sizeof(float) * depthBuffer->maxBlocks);
+	}
+}
+
+static void CreateDepthPlane(DepthBuffer* depthBuffer, int width, int height, DepthFormat format)
+{
+	depthBuffer->memory = NULL;
+	depthBuffer->capacity = 0;
+	depthBuffer->format = format;
+	depthBuffer->hiZMin = NULL;
+	depthBuffer->hiZMax = NULL;
+	depthBuffer->maxBlocks = 0;
+	ResizeDepthPlane(depthBuffer, width, height);
+}
+
+/* Copies the depths and the block bounds of a plane of the same size and format */
+static void CopyDepthPlane(DepthBuffer* dest, const DepthBuffer* const source)
+{
+	const int numBlocks = source->numBlocksX * source->numBlocksY;
+	memcpy(dest->memory, source->memory, (size_t) source->pitch * source->height);
+	memcpy(dest->hiZMin, source->hiZMin, sizeof(float) * numBlocks);
+	memcpy(dest->hiZMax, source->hiZMax, sizeof(float) * numBlocks);
+}
+
+static void FillDepthPlane(DepthBuffer* depthBuffer, float depth)
+{
+	const size_t size = (size_t) depthBuffer->pitch * depthBuffer->height;
+	
+	if (depthBuffer->format == RENDERER_DEPTH_16) {
+		const u16 value = DepthToU16(depth);
+		if ((value & 0xFF) == (value >> 8)) {
+			/* Fast path: 0 and 1 are byte patterns */
+			memset(depthBuffer->memory, value & 0xFF, size);
+		} else {
+			u16* depths = (u16*) depthBuffer->memory;
+			for (size_t i = 0; i < size / 2; i++) {
+				depths[i] = value;
+			}
+		}
+	} else {
+		u32 bits;
+		memcpy(&bits, &depth, sizeof(bits));
+		if (bits == 0) {
+			memset(depthBuffer->memory, 0, size);
+		} else {
+			FillSpan((u32*) depthBuffer->memory, (int) (size / 4), bits);
+		}
+	}
+	
+	const float hiZ = QuantizeDepth(depthBuffer->format, depth);
+	const int numBlocks = depthBuffer->numBlocksX * depthBuffer->numBlocksY;
+	for (int i = 0; i < numBlocks; i++) {
+		depthBuffer->hiZMin[i] = hiZ;
+		depthBuffer->hiZMax[i] = hiZ;
+	}
+}
+
+/*	Fills rect, which is inside the plane. The bounds of blocks which are 
+ *	only partly filled grow to include depth. */
+static void FillDepthRect(DepthBuffer* depthBuffer, const Rect* const rect, float depth)
+{
+	const int count = rect->xMax - rect->xMin;
+	const u16 value = DepthToU16(depth);
+	u32 bits;
+	memcpy(&bits, &depth, sizeof(bits));
+	
+	for (int y = rect->yMin; y < rect->yMax; y++) {
+		u8* row = depthBuffer->memory + (size_t) y * depthBuffer->pitch;
+		if (depthBuffer->format == RENDERER_DEPTH_16) {
+			u16* depths = (u16*) row + rect->xMin;
+			for (int x = 0; x < count; x++) {
+				depths[x] = value;
+			}
+		} else {
+			FillSpan((u32*) row + rect->xMin, count, bits);
+		}
+	}
+	
+	const float hiZ = QuantizeDepth(depthBuffer->format, depth);
+	const int blockXMin = rect->xMin / TQ_SW_BLOCK_SIZE;
+	const int blockYMin = rect->yMin / TQ_SW_BLOCK_SIZE;
+	const int blockXMax = (rect->xMax - 1) / TQ_SW_BLOCK_SIZE;
+	const int blockYMax = (rect->yMax - 1) / TQ_SW_BLOCK_SIZE;
+	
+	for (int by = blockYMin; by <= blockYMax; by++) {
+		for (int bx = blockXMin; bx <= blockXMax; bx++) {
+			const Rect block = {
+				bx * TQ_SW_BLOCK_SIZE, by * TQ_SW_BLOCK_SIZE,
+				MinInt((bx + 1) * TQ_SW_BLOCK_SIZE, depthBuffer->width), 
+				MinInt((by + 1) * TQ_SW_BLOCK_SIZE, depthBuffer->height)
+			};
+			const Rect filled = IntersectRects(&block, rect);
+			const int i = by * depthBuffer->numBlocksX + bx;
+			if (GetRectArea(&filled) == GetRectArea(&block)) {
+				depthBuffer->hiZMin[i] = hiZ;
+				depthBuffer->hiZMax[i] = hiZ;
+			} else {
+				depthBuffer->hiZMin[i] = fminf(depthBuffer->hiZMin[i], hiZ);
+				depthBuffer->hiZMax[i] = fmaxf(depthBuffer->hiZMax[i], hiZ);
+			}
+		}
+	}
+}
+
+static void DestroyDepthPlane(DepthBuffer* depthBuffer)
+{
+	FreeAligned(depthBuffer->memory);
+	free(depthBuffer->hiZMin);
+	free(depthBuffer->hiZMax);
+	depthBuffer->memory = NULL;
+	depthBuffer->capacity = 0;
+	depthBuffer->maxBlocks = 0;
+	depthBuffer->format = RENDERER_DEPTH_NONE;
+	depthBuffer->hiZMin = NULL;
+	depthBuffer->hiZMax = NULL;
+}
+
+void ClearDepthBuffer(Renderer* renderer, float depth)
+{
+	DepthBuffer* depthBuffer = &renderer->depthBuffer;
+	if (!depthBuffer->memory) {
+		return;
+	}
+	
+	if (renderer->numTriangles > 0) {
+		FlushRenderer(renderer);
+	}
+	
+	const int numPlanes = renderer->isMultisampled ? TQ_SW_NUM_SAMPLES : 1;
+	if (renderer->invalidRects.numRects == 0) {
+		for (int i = 0; i < numPlanes; i++) {
+			FillDepthPlane(GetSampleDepthBuffer(renderer, i), depth);
+		}
+		return;
+	}
+	
+	const Rect drawable = GetDrawableRect(&renderer->backBuffer);
+	Rect clips[TQ_SW_MAX_DIRTY_RECTS];
+	const int numClips = GetClipRects(renderer, &drawable, clips);
+	for (int i = 0; i < numPlanes; i++) {
+		for (int j = 0; j < numClips; j++) {
+			FillDepthRect(GetSampleDepthBuffer(renderer, i), &clips[j], depth);
+		}
+	}
+}
+
+void EnableDepthBuffer(Renderer* renderer, DepthFormat format)
+{
+	DisableDepthBuffer(renderer);
+	
+	if (format == RENDERER_DEPTH_NONE) {
+		return;
+	}
+	
+	const int width = renderer->backBuffer.width;
+	const int height = renderer->backBuffer.height;
+	const int numPlanes = renderer->isMultisampled ? TQ_SW_NUM_SAMPLES : 1;
+	for (int i = 0; i < numPlanes; i++) {
+		CreateDepthPlane(GetSampleDepthBuffer(renderer, i), width, height, format);
+	}
+	
+	ClearDepthBuffer(renderer, 1.0f);
+}
+
+void DisableDepthBuffer(Renderer* renderer)
+{
+	DepthBuffer* depthBuffer = &renderer->depthBuffer;
+	if (!depthBuffer->memory) {
+		return;
+	}
+	
+	FlushRenderer(renderer);
+	
+	const int numPlanes = renderer->isMultisampled ? TQ_SW_NUM_SAMPLES : 1;
+	for (int i = 0; i < numPlanes; i++) {
+		DestroyDepthPlane(GetSampleDepthBuffer(renderer, i));
+	}
+}
+
+/*	Allocates the sample buffers, which start out as copies of the back buffer
+ *	and the depth buffer, so drawing can go on where it left off. */
+void EnableMultisampling(Renderer* renderer)
+{
+	if (renderer->isMultisampled) {
+		return;
+	}
+	
+	if (renderer->numTriangles > 0) {
+		FlushRenderer(renderer);
+	}
+	
+	const BackBuffer* const backBuffer = &renderer->backBuffer;
+	BackBuffer* sampleBuffer = &renderer->sampleBuffer;
+	sampleBuffer->width = backBuffer->width * TQ_SW_NUM_SAMPLES;
+	sampleBuffer->height = backBuffer->height;
+	sampleBuffer->pitch = GetPaddedPitch(sampleBuffer->width, sizeof(Pixel));
+	sampleBuffer->layout = RENDERER_LAYOUT_LINEAR;
+	sampleBuffer->memory = ReserveBuffer(NULL, &renderer->sampleCapacity, 
+		(size_t) sampleBuffer->pitch * sampleBuffer->height);
+	for (int y = 0; y < backBuffer->height; y++) {
+		Pixel* samples = GetBackBufferRow(sampleBuffer, y);
+		for (int x = 0; x < backBuffer->width; x++) {
+			FillSpan(samples + x * TQ_SW_NUM_SAMPLES, TQ_SW_NUM_SAMPLES, *GetPixelAddress(backBuffer, x, y));
+		}
+	}
+	
+	const DepthBuffer* const depthBuffer = &renderer->depthBuffer;
+	if (depthBuffer->memory) {
+		for (int i = 0; i < TQ_SW_NUM_SAMPLES - 1; i++) {
+			DepthBuffer* plane = &renderer->sampleDepthBuffers[i];
+			CreateDepthPlane(plane, depthBuffer->width, depthBuffer->height, depthBuffer->format);
+			CopyDepthPlane(plane, depthBuffer);
+		}
+	}
+	
+	renderer->isMultisampled = true;
+}
+
+/* Samples which weren't resolved are lost */
+void DisableMultisampling(Renderer* renderer)
+{
+	if (!renderer->isMultisampled) {
+		return;
+	}
+	
+	FlushRenderer(renderer);
+	
+	FreeAligned(renderer->sampleBuffer.memory);
+	renderer->sampleBuffer.memory = NULL;
+	renderer->sampleCapacity = 0;
+	if (renderer->depthBuffer.memory) {
+		for (int i = 0; i < TQ_SW_NUM_SAMPLES - 1; i++) {
+			DestroyDepthPlane(&renderer->sampleDepthBuffers[i]);
+		}
+	}
+	
+	renderer->isMultisampled = false;
+}
+
+static void LayoutTiles(Renderer* renderer);
+
+/*	Changes the size of the back buffer and of everything that depends on it,
+ *	reusing the memory reserved before whenever it fits, see Memory. Pending
+ *	triangles are rasterized first and bound memory is unbound, so bind the 
+ *	memory of the resized texture. Pixels and samples are undefined until the 
+ *	next clear, depths are cleared to 1 like EnableDepthBuffer. */
+void ResizeRenderer(Renderer* renderer, int width, int height)
+{
+	if (renderer->numTriangles > 0) {
+		FlushRenderer(renderer);
+	}
+	
+	BackBuffer* backBuffer = &renderer->backBuffer;
+	backBuffer->width = width;
+	backBuffer->height = height;
+	renderer->headlessMemory = ReserveBuffer(renderer->headlessMemory, &renderer->headlessCapacity,
+		LayoutBackBuffer(backBuffer));
+	backBuffer->memory = renderer->headlessMemory;
+	
+	if (2 * height > renderer->maxScanLines) {
+		free(renderer->scanBuffer);
+		renderer->maxScanLines = MaxInt(2 * height, renderer->maxScanLines + renderer->maxScanLines / 2);
+		renderer->scanBuffer = (int*) calloc(renderer->maxScanLines, sizeof(int));
+	}
+	
+	if (renderer->isMultisampled) {
+		BackBuffer* sampleBuffer = &renderer->sampleBuffer;
+		sampleBuffer->width = width * TQ_SW_NUM_SAMPLES;
+		sampleBuffer->height = height;
+		sampleBuffer->pitch = GetPaddedPitch(sampleBuffer->width, sizeof(Pixel));
+		sampleBuffer->memory = ReserveBuffer(sampleBuffer->memory, &renderer->sampleCapacity,
+			(size_t) sampleBuffer->pitch * height);
+	}
+	
+	/* Nothing can be clipped to rects of the old size, and every pixel changed */
+	renderer->invalidRects.numRects = 0;
+	renderer->dirtyRects.numRects = 0;
+	const Rect drawable = GetDrawableRect(backBuffer);
+	MarkDirtyRect(renderer, &drawable);
+	
+	if (renderer->depthBuffer.memory) {
+		const int numPlanes = renderer->isMultisampled ? TQ_SW_NUM_SAMPLES : 1;
+		for (int i = 0; i < numPlanes; i++) {
+			ResizeDepthPlane(GetSampleDepthBuffer(renderer, i), width, height);
+		}
+		ClearDepthBuffer(renderer, 1.0f);
+	}
+	
+	if (renderer->workQueue) {
+		LayoutTiles(renderer);
+	}
+}
+
+/* Average of the 4 samples of count pixels, rounded like AveragePixels */
+static void ResolveSpan(Pixel* dest, const Pixel* samples, int count)
+{
+	int x = 0;
+#ifdef TQ_SSE2
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i two = _mm_set1_epi16(2);
+	
+	/*	Every load is one pixel: samples 0 and 1 are added to 2 and 3 in 16 bits per 
+	 *	channel, then the two halves of 2 pixels at once. 4 * 255 + 2 still fits. */
+	for (; x + 4 <= count; x += 4) {
+		const __m128i* const source = (const __m128i*) (samples + x * TQ_SW_NUM_SAMPLES);
+		__m128i sums[4];
+		for (int i = 0; i < 4; i++) {
+			/* Sample rows are aligned and every pixel is 16 bytes of samples */
+			const __m128i p = _mm_load_si128(source + i);
+			sums[i] = _mm_add_epi16(_mm_unpacklo_epi8(p, zero), _mm_unpackhi_epi8(p, zero));
+		}
+		
+		__m128i lo = _mm_add_epi16(_mm_unpacklo_epi64(sums[0], sums[1]), _mm_unpackhi_epi64(sums[0], sums[1]));
+		__m128i hi = _mm_add_epi16(_mm_unpacklo_epi64(sums[2], sums[3]), _mm_unpackhi_epi64(sums[2], sums[3]));
+		lo = _mm_srli_epi16(_mm_add_epi16(lo, two), 2);
+		hi = _mm_srli_epi16(_mm_add_epi16(hi, two), 2);
+		_mm_storeu_si128((__m128i*) (dest + x), _mm_packus_epi16(lo, hi));
+	}
+#endif
+	for (; x < count; x++) {
+		const Pixel* const p = samples + x * TQ_SW_NUM_SAMPLES;
+		dest[x] = AveragePixels(p[0], p[1], p[2], p[3]);
+	}
+}
+
+/*	Rasterizes everything that is pending and averages the samples into the back 
+ *	buffer. Call once per frame, before drawing on top and presenting.
+ *	When tracking dirty rects only those are resolved. */
+void ResolveMultisampling(Renderer* renderer)
+{
+	if (!renderer->isMultisampled) {
+		return;
+	}
+	
+	if (renderer->numTriangles > 0) {
+		FlushRenderer(renderer);
+	}
+	
+	BackBuffer* backBuffer = &renderer->backBuffer;
+	const Rect drawable = GetDrawableRect(backBuffer);
+	const Rect* rects = &drawable;
+	int numRects = 1;
+	if (renderer->isTrackingDirtyRects) {
+		rects = renderer->dirtyRects.rects;
+		numRects = renderer->dirtyRects.numRects;
+	}
+	
+	for (int i = 0; i < numRects; i++) {
+		const Rect* const rect = &rects[i];
+		for (int y = rect->yMin; y < rect->yMax; y++) {
+			const Pixel* const samples = GetBackBufferRow(&renderer->sampleBuffer, y);
+			for (int x = rect->xMin; x < rect->xMax; ) {
+				/* In pieces which are contiguous in the back buffer, see FillRowSpan */
+				const int end = (backBuffer->layout == RENDERER_LAYOUT_SWIZZLED) 
+					? MinInt((x | (TQ_SW_BLOCK_SIZE - 1)) + 1, rect->xMax) : rect->xMax;
+				ResolveSpan(GetPixelAddress(backBuffer, x, y), samples + TQ_SW_NUM_SAMPLES * x, end - x);
+				x = end;
+			}
+		}
+	}
+}
+
+void DrawPixel(Renderer* renderer, int x, int y, const Color* const color)
+{
+	BackBuffer* backBuffer = &(renderer->backBuffer);
+	
+	if (renderer->numTriangles > 0) {
+		FlushRenderer(renderer);
+	}
+	
+	/* Single pixels can be anywhere, triangles are clipped before rasterization */
+	const Rect drawable = GetDrawableRect(backBuffer);
+	const Rect rect = { x, y, x + 1, y + 1 };
+	const Rect area = IntersectRects(&rect, &drawable);
+	Rect clips[TQ_SW_MAX_DIRTY_RECTS];
+	if (IsRectEmpty(&area) || GetClipRects(renderer, &area, clips) == 0) {
+		return;
+	}
+	
+	MarkDirtyRect(renderer, &area);
+	BlendFillFunction* const fill = GetBlendKernels(renderer->blendMode).fill;
+	fill(GetPixelAddress(backBuffer, x, y), 1, PackColor(color));
+}
+
+/*	ceil(numerator / denominator) for 0 < denominator < 2^31, with the reciprocal of
+ *	denominator precomputed so several quotients share one division. The estimate 
+ *	is off by at most one and corrected exactly in integers. */
+inline i64 CeilDiv(i64 numerator, i64 denominator, double invDenominator)
+{
+	i64 result = (i64) ((double) numerator * invDenominator);
+	
+	/* Branchless, the corrections are as good as random */
+	result += (result * denominator < numerator);
+	result -= ((result - 1) * denominator >= numerator);
+	return result;
+}
+
+/*	The first pixel whose center is at or after p (28.4).
+ *	Relies on >> rounding down, also for negative values. */
+inline int FirstPixelCenter(int p)
+{
+	return (p - TQ_SW_SUBPIXEL_HALF + TQ_SW_SUBPIXEL_ONE - 1) >> TQ_SW_SUBPIXEL_BITS;
+}
+
+/*	Stores, for every row in [yMin, yMax) whose center lies in [y0, y1), the
+ *	first pixel whose center is at or right of the edge, relative to yMin.
+ *	The pixel centers are computed exactly in integers, so both triangles
+ *	sharing an edge get the same column on every row. The min side starts at
+ *	that column and the max side ends before it, which is the left part of
+ *	the top-left rule. Rows are half-open too, which is the top part. */
+static void ScanConvertLine(int* scanBuffer, int yMin, int yMax,
+	int x0, int y0, int x1, int y1, int isMaxSide)
+{
+	const i64 dx = x1 - x0;
+	const i64 dy = y1 - y0;
+	
+	if (dy <= 0) {
+		return;
+	}
+	
+	const int rowMin = MaxInt(FirstPixelCenter(y0), yMin);
+	const int rowMax = MinInt(FirstPixelCenter(y1), yMax);
+	if (rowMin >= rowMax) {
+		return;
+	}
+	
+	/*	The edge crosses the center of row y at x0 + dx * (center - y0) / dy, the 
+	 *	first pixel from there is ceil((x - half) / one). Stepped as quotient and 
+	 *	remainder of numerator / denominator, with the remainder in (-denominator, 0]. */
+	const i64 denominator = dy * TQ_SW_SUBPIXEL_ONE;
+	const double invDenominator = 1.0 / (double) denominator;
+	const i64 centerY = (i64) rowMin * TQ_SW_SUBPIXEL_ONE + TQ_SW_SUBPIXEL_HALF;
+	const i64 numerator = (x0 - TQ_SW_SUBPIXEL_HALF) * dy + dx * (centerY - y0);
+	
+	int x = (int) CeilDiv(numerator, denominator, invDenominator);
+	i64 remainder = numerator - (i64) x * denominator;
+	
+	const i64 rowStep = dx * TQ_SW_SUBPIXEL_ONE;
+	const int xStep = (int) CeilDiv(rowStep, denominator, invDenominator);
+	const i64 remainderStep = rowStep - (i64) xStep * denominator;
+	
+	int* entry = scanBuffer + (rowMin - yMin) * 2 + isMaxSide;
+	for (int y = rowMin; y < rowMax; y++, entry += 2) {
+		*entry = x;
+		
+		/* Branchless wrap, it is taken at random for most slopes */
+		remainder += remainderStep;
+		const i64 wrap = (remainder + denominator - 1) >> 63;	/* -1 when remainder <= -denominator */
+		x += xStep + (int) wrap;
+		remainder += denominator & wrap;
+	}
+}
+
+/*	Rasterizes the part of the triangle inside clip.
+ *	scanBuffer needs room for 2 * (clip->yMax - clip->yMin) entries. */
+static void RasterizeTriangleScanline(BackBuffer* backBuffer, int* scanBuffer, const Rect* clip,
+	const TriangleCommand* const triangle)
+{
+	int v1x = triangle->v1x;
+	int v1y = triangle->v1y;
+	int v2x = triangle->v2x;
+	int v2y = triangle->v2y;
+	int v3x = triangle->v3x;
+	int v3y = triangle->v3y;
+	
+	/* 1) Preprocessing: Convert triangle to scan-buffer-friendly triangle */
+	/* 1a) Perspective divide and 1b) viewport transform: see DrawTriangles */
+	
+	/* 1c) Bubble sort vertices by y-coordinate in increasing order */
+	if (v1y > v2y) {
+		/* swap v1 v2 */
+		int temp = v1x;
+		v1x = v2x;
+		v2x = temp;
+		temp = v1y;
+		v1y = v2y;
+		v2y = temp;
+	}	
+	if (v2y > v3y) {
+		/* swap v2 v3 */
+		int temp = v2x;
+		v2x = v3x;
+		v3x = temp;
+		temp = v2y;
+		v2y = v3y;
+		v3y = temp;
+	}
+	if (v1y > v2y) {
+		/* swap v1 v2 */
+		int temp = v1x;
+		v1x = v2x;
+		v2x = temp;
+		temp = v1y;
+		v1y = v2y;
+		v2y = temp;
+	}
+	
+	/* Rows whose centers are in [v1y, v3y) */
+	const int yMin = MaxInt(FirstPixelCenter(v1y), clip->yMin); 
+	const int yMax = MinInt(FirstPixelCenter(v3y), clip->yMax);
+	if (yMin >= yMax) {
+		return;
+	}
+	
+	/* 1d) Determine handedness by area of parallellogram
+	 *		Area: 2D cross product */
+	const i64 area = (i64) (v3x - v1x) * (v2y - v1y) - (i64) (v3y - v1y) * (v2x - v1x);
+	if (area == 0) {
+		return;
+	}
+	int handedness = (area > 0) 
+		? 1		/* v1v2 is to the right of v1v3 */
+		: 0;	/* v1v2 is to the left of v1v3 */
+	
+	/* 2) Fill scan buffer
+	 *		First define min side for scanbuffer
+	 *		Next define the two max sides for scanbuffer */
+	ScanConvertLine(scanBuffer, yMin, yMax, v1x, v1y, v3x, v3y, handedness);
+	ScanConvertLine(scanBuffer, yMin, yMax, v1x, v1y, v2x, v2y, 1 - handedness);
+	ScanConvertLine(scanBuffer, yMin, yMax, v2x, v2y, v3x, v3y, 1 - handedness);
+	
+	/* 3)	Read scan buffer and draw to back buffer */
+	const Pixel pixel = PackColor(&triangle->color);
+	BlendFillFunction* const fill = GetBlendKernels(triangle->blendMode).fill;
+	
+	for (int j = yMin; j < yMax; j++) {			
+		const size_t minIndex = (j - yMin) * 2;
+		const size_t maxIndex = minIndex + 1;
+		const int xMin = MaxInt(scanBuffer[minIndex], clip->xMin);
+		const int xMax = MinInt(scanBuffer[maxIndex], clip->xMax);
+		
+		if (xMin < xMax) {
+			FillRowSpan(backBuffer, j, xMin, xMax, fill, pixel);
+		}
+	}
+}
+
+/*	Half-space rasterizer:
+ *	A pixel (x, y) is covered when its center lies on the inner side of all three
+ *	edges, i.e. when the edge functions E(x, y) = a * x + b * y + c are all >= 0.
+ *	The edge functions are integers, stepped incrementally over 8x8 blocks:
+ *	blocks completely outside one edge are skipped, blocks completely inside
+ *	all edges are filled without any per-pixel test and only the blocks on an
+ *	edge are tested per pixel (4 pixels at a time with SSE2).
+ *	With 28.4 vertices c needs 64 bits, so every block starts from a 64-bit
+ *	evaluation, clamped to a range where the 32-bit steps inside the block
+ *	can't overflow or change sign.
+ *
+ *	References:
+ *	Juan Pineda, A Parallel Algorithm for Polygon Rasterization (1988)
+ *	Nicolas Capens, Advanced Rasterization (devmaster.net)
+ *	Fabian Giesen, Triangle rasterization in practice (2013)
+ */
+typedef struct EdgeFunction
+{
+	int a;	/* step per pixel */
+	int b;
+	i64 c;
+} EdgeFunction;
+
+/*	Positive on the left of v0 -> v1 when going counter-clockwise on screen,
+ *	evaluated at pixel centers: x and y are whole pixels. Edges which aren't
+ *	top or left edges are biased by -1 to exclude the pixel centers exactly on them. */
+static EdgeFunction CreateEdgeFunction(int v0x, int v0y, int v1x, int v1y)
+{
+	const int a = v0y - v1y;
+	const int b = v1x - v0x;
+	const bool isTopLeft = (a > 0) || (a == 0 && b > 0);
+	
+	EdgeFunction result;
+	result.a = a * TQ_SW_SUBPIXEL_ONE;
+	result.b = b * TQ_SW_SUBPIXEL_ONE;
+	result.c = (i64) v0x * v1y - (i64) v0y * v1x 
+		+ (i64) (a + b) * TQ_SW_SUBPIXEL_HALF 
+		- (isTopLeft ? 0 : 1);
+	return result;
+}
+
+/*	Only the sign matters, and within a block the steps add less than 2^26 
+ *	(|a|, |b| < 2^22 inside the guard band), so anything beyond 2^30 can be clamped. */
+#define TQ_SW_EDGE_CLAMP (1 << 30)
+
+inline int EvaluateEdgeFunction(const EdgeFunction* const e, int x, int y)
+{
+	const i64 value = (i64) e->a * x + (i64) e->b * y + e->c;
+	if (value > TQ_SW_EDGE_CLAMP) {
+		return TQ_SW_EDGE_CLAMP;
+	}
+	if (value < -TQ_SW_EDGE_CLAMP) {
+		return -TQ_SW_EDGE_CLAMP;
+	}
+	return (int) value;
+}
+
+/*	Bounding box of the pixels whose centers can be inside the triangle, intersected 
+ *	with clip, max is exclusive. */
+static Rect GetTriangleBounds(int v1x, int v1y, int v2x, int v2y, int v3x, int v3y, const Rect* clip)
+{
+	const int xMin = MinInt(v1x, MinInt(v2x, v3x));
+	const int yMin = MinInt(v1y, MinInt(v2y, v3y));
+	const int xMax = MaxInt(v1x, MaxInt(v2x, v3x));
+	const int yMax = MaxInt(v1y, MaxInt(v2y, v3y));
+	
+	Rect result;
+	result.xMin = MaxInt(FirstPixelCenter(xMin), clip->xMin);
+	result.yMin = MaxInt(FirstPixelCenter(yMin), clip->yMin);
+	result.xMax = MinInt(((xMax - TQ_SW_SUBPIXEL_HALF) >> TQ_SW_SUBPIXEL_BITS) + 1, clip->xMax);
+	result.yMax = MinInt(((yMax - TQ_SW_SUBPIXEL_HALF) >> TQ_SW_SUBPIXEL_BITS) + 1, clip->yMax);
+	return result;
+}
+
+/*	Tests and writes the pixels [xMin, xMax) of one row of a partially covered block.
+ *	w0, w1, w2 are the edge functions at xMin. With masks, nothing is written
+ *	but the coverage of every pixel goes to masks[x - xMin], to blend afterwards. */
+static void RasterizeBlockRow(Pixel* row, int xMin, int xMax, int w0, int w1, int w2,
+	const EdgeFunction* const e0, const EdgeFunction* const e1, const EdgeFunction* const e2,
+	Pixel pixel, u32* masks)
+{
+	int x = xMin;
+#ifdef TQ_SSE2
+	const __m128i pixels = _mm_set1_epi32((int) pixel);
+	const __m128i minusOne = _mm_set1_epi32(-1);
+	
+	/* [0, a, 2a, 3a] per edge, built without SSE4.1 mullo */
+	const __m128i step0 = _mm_setr_epi32(0, e0->a, 2 * e0->a, 3 * e0->a);
+	const __m128i step1 = _mm_setr_epi32(0, e1->a, 2 * e1->a, 3 * e1->a);
+	const __m128i step2 = _mm_setr_epi32(0, e2->a, 2 * e2->a, 3 * e2->a);
+	
+	for (; x + 4 <= xMax; x += 4) {
+		const __m128i v0 = _mm_add_epi32(_mm_set1_epi32(w0), step0);
+		const __m128i v1 = _mm_add_epi32(_mm_set1_epi32(w1), step1);
+		const __m128i v2 = _mm_add_epi32(_mm_set1_epi32(w2), step2);
+		
+		/* Sign bit of the OR is set when any edge function is negative */
+		const __m128i inside = _mm_cmpgt_epi32(_mm_or_si128(_mm_or_si128(v0, v1), v2), minusOne);
+		
+		if (masks) {
+			_mm_storeu_si128((__m128i*) (masks + x - xMin), inside);
+		} else if (_mm_movemask_epi8(inside) != 0) {
+			__m128i* dest = (__m128i*) (row + x);
+			const __m128i old = _mm_loadu_si128(dest);
+			const __m128i result = _mm_or_si128(_mm_and_si128(inside, pixels), 
+				_mm_andnot_si128(inside, old));
+			_mm_storeu_si128(dest, result);
+		}
+		
+		w0 += 4 * e0->a;
+		w1 += 4 * e1->a;
+		w2 += 4 * e2->a;
+	}
+#endif
+	for (; x < xMax; x++) {
+		const bool inside = ((w0 | w1 | w2) >= 0);
+		if (masks) {
+			masks[x - xMin] = inside ? 0xFFFFFFFF : 0;
+		} else if (inside) {
+			row[x] = pixel;
+		}
+		w0 += e0->a;
+		w1 += e1->a;
+		w2 += e2->a;
+	}
+}
+
+/*	Depth-tested version of RasterizeBlockRow.
+ *	z is the depth at xMin and zStep the depth increment per pixel. Passing
+ *	pixels (z < stored depth) write both the color and the depth, or only the 
+ *	depth and their mask with masks. Returns true if any pixel was written. */
+static bool RasterizeBlockRowDepth(Pixel* row, void* depthRow, DepthFormat format,
+	int xMin, int xMax, int w0, int w1, int w2,
+	const EdgeFunction* const e0, const EdgeFunction* const e1, const EdgeFunction* const e2,
+	float z, float zStep, Pixel pixel, u32* masks)
+{
+	int x = xMin;
+	int written = 0;
+	
+	if (masks) {
+		memset(masks, 0, sizeof(u32) * (xMax - xMin));
+	}
+	
+	if (format == RENDERER_DEPTH_32) {
+		float* depths = (float*) depthRow;
+#ifdef TQ_SSE2
+		const __m128i pixels = _mm_set1_epi32((int) pixel);
+		const __m128i minusOne = _mm_set1_epi32(-1);
+		const __m128i step0 = _mm_setr_epi32(0, e0->a, 2 * e0->a, 3 * e0->a);
+		const __m128i step1 = _mm_setr_epi32(0, e1->a, 2 * e1->a, 3 * e1->a);
+		const __m128i step2 = _mm_setr_epi32(0, e2->a, 2 * e2->a, 3 * e2->a);
+		const __m128 zRamp = _mm_setr_ps(0.0f, zStep, 2.0f * zStep, 3.0f * zStep);
+		
+		for (; x + 4 <= xMax; x += 4) {
+			const __m128i v0 = _mm_add_epi32(_mm_set1_epi32(w0), step0);
+			const __m128i v1 = _mm_add_epi32(_mm_set1_epi32(w1), step1);
+			const __m128i v2 = _mm_add_epi32(_mm_set1_epi32(w2), step2);
+			const __m128i inside = _mm_cmpgt_epi32(_mm_or_si128(_mm_or_si128(v0, v1), v2), minusOne);
+			
+			const __m128 zs = _mm_add_ps(_mm_set1_ps(z), zRamp);
+			const __m128 oldDepths = _mm_loadu_ps(depths + x);
+			const __m128i pass = _mm_and_si128(inside, _mm_castps_si128(_mm_cmplt_ps(zs, oldDepths)));
+			
+			if (_mm_movemask_epi8(pass) != 0) {
+				const __m128 passMask = _mm_castsi128_ps(pass);
+				_mm_storeu_ps(depths + x, _mm_or_ps(_mm_and_ps(passMask, zs), 
+					_mm_andnot_ps(passMask, oldDepths)));
+				
+				if (masks) {
+					_mm_storeu_si128((__m128i*) (masks + x - xMin), pass);
+				} else {
+					__m128i* dest = (__m128i*) (row + x);
+					const __m128i old = _mm_loadu_si128(dest);
+					_mm_storeu_si128(dest, _mm_or_si128(_mm_and_si128(pass, pixels), 
+						_mm_andnot_si128(pass, old)));
+				}
+				written = 1;
+			}
+			
+			w0 += 4 * e0->a;
+			w1 += 4 * e1->a;
+			w2 += 4 * e2->a;
+			z += 4.0f * zStep;
+		}
+#endif
+		for (; x < xMax; x++) {
+			if ((w0 | w1 | w2) >= 0 && z < depths[x]) {
+				depths[x] = z;
+				if (masks) {
+					masks[x - xMin] = 0xFFFFFFFF;
+				} else {
+					row[x] = pixel;
+				}
+				written = 1;
+			}
+			w0 += e0->a;
+			w1 += e1->a;
+			w2 += e2->a;
+			z += zStep;
+		}
+	} else {
+		u16* depths = (u16*) depthRow;
+		
+		for (; x < xMax; x++) {
+			if ((w0 | w1 | w2) >= 0) {
+				const u16 depth = DepthToU16(z);
+				if (depth < depths[x]) {
+					depths[x] = depth;
+					if (masks) {
+						masks[x - xMin] = 0xFFFFFFFF;
+					} else {
+						row[x] = pixel;
+					}
+					written = 1;
+				}
+			}
+			w0 += e0->a;
+			w1 += e1->a;
+			w2 += e2->a;
+			z += zStep;
+		}
+	}
+	
+	return written != 0;
+}
+
+/* Writes the depth of a span which is known to pass the depth test */
+static void WriteDepthSpan(void* depthRow, DepthFormat format, int xMin, int xMax, float z, float zStep)
+{
+	if (format == RENDERER_DEPTH_32) {
+		float* depths = (float*) depthRow;
+		for (int x = xMin; x < xMax; x++, z += zStep) {
+			depths[x] = z;
+		}
+	} else {
+		u16* depths = (u16*) depthRow;
+		for (int x = xMin; x < xMax; x++, z += zStep) {
+			depths[x] = DepthToU16(z);
+		}
+	}
+}
+
+static void RasterizeTriangleHalfSpace(BackBuffer* backBuffer, DepthBuffer* depthBuffer, 
+	const Rect* clip, const TriangleCommand* const triangle)
+{
+	int v1x = triangle->v1x;
+	int v1y = triangle->v1y;
+	int v2x = triangle->v2x;
+	int v2y = triangle->v2y;
+	const int v3x = triangle->v3x;
+	const int v3y = triangle->v3y;
+	float z1 = triangle->z1;
+	float z2 = triangle->z2;
+	const float z3 = triangle->z3;
+	
+	/* Make the winding counter-clockwise, so the inside is positive for all edges */
+	const i64 area = (i64) (v2x - v1x) * (v3y - v1y) - (i64) (v2y - v1y) * (v3x - v1x);
+	if (area == 0) {
+		return;
+	}
+	if (area < 0) {
+		int temp = v1x;
+		v1x = v2x;
+		v2x = temp;
+		temp = v1y;
+		v1y = v2y;
+		v2y = temp;
+		const float tempZ = z1;
+		z1 = z2;
+		z2 = tempZ;
+	}
+	
+	const EdgeFunction e0 = CreateEdgeFunction(v2x, v2y, v3x, v3y);
+	const EdgeFunction e1 = CreateEdgeFunction(v3x, v3y, v1x, v1y);
+	const EdgeFunction e2 = CreateEdgeFunction(v1x, v1y, v2x, v2y);
+	
+	const Rect bounds = GetTriangleBounds(v1x, v1y, v2x, v2y, v3x, v3y, clip);
+	const int xMin = bounds.xMin;
+	const int yMin = bounds.yMin;
+	const int xMax = bounds.xMax;
+	const int yMax = bounds.yMax;
+	
+	if (xMin >= xMax || yMin >= yMax) {
+		return;
+	}
+	
+	/*	Depth plane z(x, y) = z1 + zA * (x - originX) + zB * (y - originY), in pixels 
+	 *	from v1 (pixel centers are at + 0.5, so the origin is half a pixel before v1).
+	 *	z is already divided by w, which makes it linear in screen space.
+	 *	The edge function opposite a vertex equals area at that vertex, so
+	 *	the barycentric weights are the edge functions divided by area. */
+	const bool hasDepth = triangle->isDepthTested && depthBuffer->memory != NULL;
+	const float invArea = 1.0f / (float) ((area < 0) ? -area : area);
+	const float originX = (float) v1x / TQ_SW_SUBPIXEL_ONE - 0.5f;
+	const float originY = (float) v1y / TQ_SW_SUBPIXEL_ONE - 0.5f;
+	const float zA = (e0.a * z1 + e1.a * z2 + e2.a * z3) * invArea;
+	const float zB = (e0.b * z1 + e1.b * z2 + e2.b * z3) * invArea;
+	const float triangleZMin = fminf(z1, fminf(z2, z3));
+	const float triangleZMax = fmaxf(z1, fmaxf(z2, z3));
+	
+	const Pixel pixel = PackColor(&triangle->color);
+	const int blockXMin = xMin & ~(TQ_SW_BLOCK_SIZE - 1);
+	const int blockYMin = yMin & ~(TQ_SW_BLOCK_SIZE - 1);
+	const int last = TQ_SW_BLOCK_SIZE - 1;
+	
+	/*	Blended partial rows collect their coverage in masks first and then 
+	 *	blend the whole row in one kernel call, opaque ones write directly. */
+	const BlendKernels kernels = GetBlendKernels(triangle->blendMode);
+	const bool isBlended = (triangle->blendMode != RENDERER_BLEND_NONE);
+	Pixel sources[TQ_SW_BLOCK_SIZE];
+	u32 masks[TQ_SW_BLOCK_SIZE];
+	u32* const rowMasks = isBlended ? masks : NULL;
+	for (int i = 0; i < TQ_SW_BLOCK_SIZE; i++) {
+		sources[i] = pixel;
+	}
+	
+	for (int by = blockYMin; by < yMax; by += TQ_SW_BLOCK_SIZE) {
+		const int rowMin = MaxInt(by, yMin);
+		const int rowMax = MinInt(by + TQ_SW_BLOCK_SIZE, yMax);
+		
+		for (int bx = blockXMin; bx < xMax; bx += TQ_SW_BLOCK_SIZE) {
+			const int columnMin = MaxInt(bx, xMin);
+			const int columnMax = MinInt(bx + TQ_SW_BLOCK_SIZE, xMax);
+			
+			/* Edge functions at the top-left corner of the block */
+			const int w0 = EvaluateEdgeFunction(&e0, bx, by);
+			const int w1 = EvaluateEdgeFunction(&e1, bx, by);
+			const int w2 = EvaluateEdgeFunction(&e2, bx, by);
+			
+			/* Edge functions are linear, so the extremes are at the corners */
+			const int w0Right = w0 + e0.a * last;
+			const int w0Bottom = w0 + e0.b * last;
+			const int w0Corner = w0Right + e0.b * last;
+			const int w1Right = w1 + e1.a * last;
+			const int w1Bottom = w1 + e1.b * last;
+			const int w1Corner = w1Right + e1.b * last;
+			const int w2Right = w2 + e2.a * last;
+			const int w2Bottom = w2 + e2.b * last;
+			const int w2Corner = w2Right + e2.b * last;
+			
+			/* Trivial reject: all corners outside one edge */
+			if ((w0 & w0Right & w0Bottom & w0Corner) < 0
+				|| (w1 & w1Right & w1Bottom & w1Corner) < 0
+				|| (w2 & w2Right & w2Bottom & w2Corner) < 0) {
+				continue;
+			}
+			
+			const bool isCovered = ((w0 | w0Right | w0Bottom | w0Corner
+				| w1 | w1Right | w1Bottom | w1Corner
+				| w2 | w2Right | w2Bottom | w2Corner) >= 0);
+			
+			if (!hasDepth) {
+				if (isCovered) {
+					/* Trivial accept: all corners inside all edges */
+					for (int y = rowMin; y < rowMax; y++) {
+						Pixel* row = GetBlockRow(backBuffer, bx, y);
+						kernels.fill(row + columnMin, columnMax - columnMin, pixel);
+					}
+				} else {
+					const int dx = columnMin - bx;
+					for (int y = rowMin; y < rowMax; y++) {
+						const int dy = y - by;
+						Pixel* row = GetBlockRow(backBuffer, bx, y);
+						RasterizeBlockRow(row, columnMin, columnMax,
+							w0 + e0.a * dx + e0.b * dy,
+							w1 + e1.a * dx + e1.b * dy,
+							w2 + e2.a * dx + e2.b * dy,
+							&e0, &e1, &e2, pixel, rowMasks);
+						if (isBlended) {
+							kernels.span(row + columnMin, columnMax - columnMin, sources, masks);
+						}
+					}
+				}
+				continue;
+			}
+			
+			/* Depth range of the triangle inside this block */
+			const float zCorner = z1 + zA * (columnMin - originX) + zB * (rowMin - originY);
+			const float zDx = zA * (columnMax - 1 - columnMin);
+			const float zDy = zB * (rowMax - 1 - rowMin);
+			const float blockZMin = QuantizeDepth(depthBuffer->format,
+				fmaxf(zCorner + fminf(zDx, 0.0f) + fminf(zDy, 0.0f), triangleZMin));
+			const float blockZMax = QuantizeDepth(depthBuffer->format,
+				fminf(zCorner + fmaxf(zDx, 0.0f) + fmaxf(zDy, 0.0f), triangleZMax));
+			
+			/* Hierarchical early-Z: nothing in front of what is already there */
+			const int hiZIndex = (by / TQ_SW_BLOCK_SIZE) * depthBuffer->numBlocksX + bx / TQ_SW_BLOCK_SIZE;
+			if (blockZMin >= depthBuffer->hiZMax[hiZIndex]) {
+				continue;
+			}
+			
+			bool written = false;
+			
+			if (isCovered && blockZMax < depthBuffer->hiZMin[hiZIndex]) {
+				/* Everything passes, no need to read the depth buffer */
+				for (int y = rowMin; y < rowMax; y++) {
+					Pixel* row = GetBlockRow(backBuffer, bx, y);
+					u8* depthRow = depthBuffer->memory + y * depthBuffer->pitch;
+					kernels.fill(row + columnMin, columnMax - columnMin, pixel);
+					WriteDepthSpan(depthRow, depthBuffer->format, columnMin, columnMax,
+						zCorner + zB * (y - rowMin), zA);
+				}
+				written = true;
+			} else {
+				const int dx = columnMin - bx;
+				for (int y = rowMin; y < rowMax; y++) {
+					const int dy = y - by;
+					Pixel* row = GetBlockRow(backBuffer, bx, y);
+					u8* depthRow = depthBuffer->memory + y * depthBuffer->pitch;
+					const bool isRowWritten = RasterizeBlockRowDepth(row, depthRow, depthBuffer->format,
+						columnMin, columnMax,
+						w0 + e0.a * dx + e0.b * dy,
+						w1 + e1.a * dx + e1.b * dy,
+						w2 + e2.a * dx + e2.b * dy,
+						&e0, &e1, &e2, 
+						zCorner + zB * (y - rowMin), zA, pixel, rowMasks);
+					if (isBlended && isRowWritten) {
+						kernels.span(row + columnMin, columnMax - columnMin, sources, masks);
+					}
+					written |= isRowWritten;
+				}
+			}
+			
+			/*	Keep the bounds conservative: written depths can only lower the minimum,
+			 *	and a fully covered block can't hold anything behind this triangle anymore. */
+			if (written) {
+				depthBuffer->hiZMin[hiZIndex] = fminf(depthBuffer->hiZMin[hiZIndex], blockZMin);
+			}
+			if (isCovered && columnMin == bx && columnMax == bx + TQ_SW_BLOCK_SIZE 
+				&& rowMin == by && rowMax == by + TQ_SW_BLOCK_SIZE) {
+				depthBuffer->hiZMax[hiZIndex] = fminf(depthBuffer->hiZMax[hiZIndex], blockZMax);
+			}
+		}
+	}
+}
+
+/*	Shaded triangles:
+ *	Varyings divided by w are linear in screen space, just like 1/w, so both
+ *	are set up as planes and every pixel divides one by the other. With SSE2
+ *	that is 4 pixels at a time, using a reciprocal estimate refined by one
+ *	Newton-Raphson step, and the colors are converted and packed with saturation.
+ *	Textures are sampled bilinearly from one mip level per 8x8 block, chosen
+ *	from the texel footprint of a pixel at the center of the block.
+ *
+ *	Reference:
+ *	Chris Hecker, Perspective Texture Mapping (Game Developer, 1995-1996)
+ */
+
+/* Varyings the built-in fragment stage reads: color and uv */
+#define TQ_SW_SHADED_VARYINGS 6
+
+/*	Shaders:
+ *	DrawTrianglesWithShader replaces the built-in stages with two callbacks.
+ *	The vertex shader runs once per vertex and returns the clip space position,
+ *	writing numVaryings varyings. The fragment shader runs once per span: the 
+ *	pixels of one row of an 8x8 block, up to TQ_SW_BLOCK_SIZE at a time. Coverage,
+ *	depth test and the perspective-correct interpolation are done for the whole
+ *	span before the call, so the shader is a plain loop over arrays and the 
+ *	indirect call is paid once per span instead of once per pixel. 
+ *	uniforms is passed to both as is, e.g. the transform and vertex arrays.
+ *	PackSpanColors converts color varyings to pixels like the built-in stage. */
+typedef Vec4 VertexShaderFunction(const void* uniforms, u32 index, float* varyings);
+
+typedef struct FragmentSpan
+{
+	int x;	/* first pixel */
+	int y;
+	int count;
+	const u32* masks;	/* all bits set where the pixel is written, the others are ignored */
+	float varyings[TQ_SW_MAX_VARYINGS][TQ_SW_BLOCK_SIZE];	/* varying j of pixel i at [j][i] */
+	const void* uniforms;
+} FragmentSpan;
+
+/* Writes the colors of the count pixels of span, blended with the blend mode of the draw */
+typedef void FragmentShaderFunction(const FragmentSpan* span, Pixel* colors);
+
+typedef struct Shader
+{
+	VertexShaderFunction* vertex;
+	FragmentShaderFunction* fragment;
+	int numVaryings;	/* at most TQ_SW_MAX_VARYINGS */
+	const void* uniforms;
+} Shader;
+
+/* value(x, y) = value + a * (x - originX) + b * (y - originY), see RasterizeTriangleHalfSpace */
+typedef struct AttributePlane
+{
+	float a;
+	float b;
+	float value;
+} AttributePlane;
+
+static AttributePlane CreateAttributePlane(const EdgeFunction* const e0, const EdgeFunction* const e1,
+	const EdgeFunction* const e2, float value1, float value2, float value3, float invArea)
+{
+	AttributePlane result;
+	result.a = (e0->a * value1 + e1->a * value2 + e2->a * value3) * invArea;
+	result.b = (e0->b * value1 + e1->b * value2 + e2->b * value3) * invArea;
+	result.value = value1;
+	return result;
+}
+
+inline float EvaluatePlane(const AttributePlane* const plane, float dx, float dy)
+{
+	return plane->value + plane->a * dx + plane->b * dy;
+}
+
+/* 1/w and the varyings divided by w at the start of a span, and their steps per pixel */
+typedef struct ShadedSpan
+{
+	float q;
+	float qStep;
+	float varyings[TQ_SW_MAX_VARYINGS];
+	float steps[TQ_SW_MAX_VARYINGS];
+	
+	/* 16.16 texel coordinates of level are ((uv - base) * size - 0.5) * 65536 */
+	const TextureLevel* level;
+	float uBase;
+	float vBase;
+} ShadedSpan;
+
+/* Per channel texel * color, with 255 * 255 = 255 */
+inline Pixel ModulatePixel(Pixel texel, Pixel color)
+{
+	Pixel result = 0;
+	for (int shift = 0; shift < 32; shift += 8) {
+		const u32 t = (texel >> shift) & 0xFF;
+		const u32 c = (color >> shift) & 0xFF;
+		result |= ((t * (c + 1)) >> 8) << shift;
+	}
+	return result;
+}
+
+inline u32 ColorToU8(float value)
+{
+	if (value <= 0.0f) {
+		return 0;
+	}
+	if (value >= 1.0f) {
+		return 255;
+	}
+	return (u32) (value * 255.0f + 0.5f);
+}
+
+/* Pixel i of the span */
+static Pixel ShadePixel(const ShadedSpan* const span, int i)
+{
+	const float w = 1.0f / (span->q + span->qStep * i);
+	float values[TQ_SW_SHADED_VARYINGS];
+	for (int j = 0; j < TQ_SW_SHADED_VARYINGS; j++) {
+		values[j] = (span->varyings[j] + span->steps[j] * i) * w;
+	}
+	
+	const Pixel color = ColorToU8(values[VARYING_COLOR + 2])
+		| (ColorToU8(values[VARYING_COLOR + 1]) << 8)
+		| (ColorToU8(values[VARYING_COLOR]) << 16)
+		| (ColorToU8(values[VARYING_COLOR + 3]) << 24);
+	
+	const TextureLevel* const level = span->level;
+	if (!level) {
+		return color;
+	}
+	
+	const int u = (int) (((values[VARYING_UV] - span->uBase) * level->width - 0.5f) * 65536.0f);
+	const int v = (int) (((values[VARYING_UV + 1] - span->vBase) * level->height - 0.5f) * 65536.0f);
+	return ModulatePixel(SampleBilinear(level, u, v), color);
+}
+
+#ifdef TQ_SSE2
+/* 4 pixels from their channels in [0, 1], rounded to nearest */
+static __m128i PackColors4(__m128 r, __m128 g, __m128 b, __m128 a)
+{
+	const __m128 scale = _mm_set1_ps(255.0f);
+	const __m128i r8 = _mm_cvtps_epi32(_mm_mul_ps(r, scale));
+	const __m128i g8 = _mm_cvtps_epi32(_mm_mul_ps(g, scale));
+	const __m128i b8 = _mm_cvtps_epi32(_mm_mul_ps(b, scale));
+	const __m128i a8 = _mm_cvtps_epi32(_mm_mul_ps(a, scale));
+	
+	/*	Saturating packs clamp to [0, 255]: bytes b0-b3 r0-r3 g0-g3 a0-a3,
+	 *	then interleaved into b g r a per pixel */
+	const __m128i bytes = _mm_packus_epi16(_mm_packs_epi32(b8, r8), _mm_packs_epi32(g8, a8));
+	const __m128i bg = _mm_unpacklo_epi8(bytes, _mm_srli_si128(bytes, 8));
+	return _mm_unpacklo_epi16(bg, _mm_srli_si128(bg, 8));
+}
+
+/* Pixels i to i + 3 of the span */
+static __m128i ShadePixels4(const ShadedSpan* const span, int i)
+{
+	const __m128 index = _mm_add_ps(_mm_set1_ps((float) i), _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f));
+	const __m128 q = _mm_add_ps(_mm_set1_ps(span->q), _mm_mul_ps(_mm_set1_ps(span->qStep), index));
+	
+	/* w = r * (2 - q * r), the estimate alone only has 12 bits */
+	const __m128 estimate = _mm_rcp_ps(q);
+	const __m128 w = _mm_mul_ps(estimate, _mm_sub_ps(_mm_set1_ps(2.0f), _mm_mul_ps(q, estimate)));
+	
+	__m128 values[TQ_SW_SHADED_VARYINGS];
+	for (int j = 0; j < TQ_SW_SHADED_VARYINGS; j++) {
+		values[j] = _mm_mul_ps(_mm_add_ps(_mm_set1_ps(span->varyings[j]), 
+			_mm_mul_ps(_mm_set1_ps(span->steps[j]), index)), w);
+	}
+	
+	const __m128i colors = PackColors4(values[VARYING_COLOR], values[VARYING_COLOR + 1],
+		values[VARYING_COLOR + 2], values[VARYING_COLOR + 3]);
+	
+	const TextureLevel* const level = span->level;
+	if (!level) {
+		return colors;
+	}
+	
+	const __m128 half = _mm_set1_ps(0.5f);
+	const __m128 fixedScale = _mm_set1_ps(65536.0f);
+	const __m128 u = _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(_mm_sub_ps(values[VARYING_UV], 
+		_mm_set1_ps(span->uBase)), _mm_set1_ps((float) level->width)), half), fixedScale);
+	const __m128 v = _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(_mm_sub_ps(values[VARYING_UV + 1], 
+		_mm_set1_ps(span->vBase)), _mm_set1_ps((float) level->height)), half), fixedScale);
+	
+	const __m128i t = SampleBilinear4(level, _mm_cvttps_epi32(u), _mm_cvttps_epi32(v));
+	
+	/* texel * (color + 1) >> 8 in 16 bits per channel */
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i one = _mm_set1_epi16(1);
+	const __m128i lo = _mm_srli_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(t, zero), 
+		_mm_add_epi16(_mm_unpacklo_epi8(colors, zero), one)), 8);
+	const __m128i hi = _mm_srli_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(t, zero), 
+		_mm_add_epi16(_mm_unpackhi_epi8(colors, zero), one)), 8);
+	return _mm_packus_epi16(lo, hi);
+}
+#endif
+
+/*	Tests (coverage and depth, RENDERER_DEPTH_NONE skips the depth test), shades 
+ *	and writes the pixels [xMin, xMax) of one row of a block. span starts at xMin.
+ *	With masks, the colors go to sources[x - xMin] and the passing pixels to 
+ *	masks[x - xMin] instead of the row, to blend afterwards.
+ *	Returns true if any pixel was written. */
+static bool ShadeBlockRow(Pixel* row, void* depthRow, DepthFormat format,
+	int xMin, int xMax, int w0, int w1, int w2,
+	const EdgeFunction* const e0, const EdgeFunction* const e1, const EdgeFunction* const e2,
+	float z, float zStep, const ShadedSpan* const span, Pixel* sources, u32* masks)
+{
+	int x = xMin;
+	int written = 0;
+#ifdef TQ_SSE2
+	const __m128i minusOne = _mm_set1_epi32(-1);
+	const __m128i step0 = _mm_setr_epi32(0, e0->a, 2 * e0->a, 3 * e0->a);
+	const __m128i step1 = _mm_setr_epi32(0, e1->a, 2 * e1->a, 3 * e1->a);
+	const __m128i step2 = _mm_setr_epi32(0, e2->a, 2 * e2->a, 3 * e2->a);
+	const __m128 zRamp = _mm_setr_ps(0.0f, zStep, 2.0f * zStep, 3.0f * zStep);
+	
+	for (; x + 4 <= xMax; x += 4) {
+		const __m128i v0 = _mm_add_epi32(_mm_set1_epi32(w0), step0);
+		const __m128i v1 = _mm_add_epi32(_mm_set1_epi32(w1), step1);
+		const __m128i v2 = _mm_add_epi32(_mm_set1_epi32(w2), step2);
+		__m128i pass = _mm_cmpgt_epi32(_mm_or_si128(_mm_or_si128(v0, v1), v2), minusOne);
+		
+		const __m128 zs = _mm_add_ps(_mm_set1_ps(z), zRamp);
+		if (format == RENDERER_DEPTH_32) {
+			const __m128 oldDepths = _mm_loadu_ps((float*) depthRow + x);
+			pass = _mm_and_si128(pass, _mm_castps_si128(_mm_cmplt_ps(zs, oldDepths)));
+		} else if (format == RENDERER_DEPTH_16) {
+			const u16* const depths = (u16*) depthRow + x;
+			const int inside = _mm_movemask_ps(_mm_castsi128_ps(pass));
+			TQ_ALIGN(16) int depthPass[4];
+			for (int j = 0; j < 4; j++) {
+				depthPass[j] = ((inside >> j) & 1) && DepthToU16(z + j * zStep) < depths[j] ? -1 : 0;
+			}
+			pass = _mm_load_si128((const __m128i*) depthPass);
+		}
+		
+		if (masks) {
+			_mm_storeu_si128((__m128i*) (masks + x - xMin), pass);
+		}
+		
+		if (_mm_movemask_epi8(pass) != 0) {
+			const __m128i colors = ShadePixels4(span, x - xMin);
+			if (masks) {
+				_mm_storeu_si128((__m128i*) (sources + x - xMin), colors);
+			} else {
+				__m128i* dest = (__m128i*) (row + x);
+				const __m128i old = _mm_loadu_si128(dest);
+				_mm_storeu_si128(dest, _mm_or_si128(_mm_and_si128(pass, colors), 
+					_mm_andnot_si128(pass, old)));
+			}
+			
+			if (format == RENDERER_DEPTH_32) {
+				float* depths = (float*) depthRow + x;
+				const __m128 passMask = _mm_castsi128_ps(pass);
+				_mm_storeu_ps(depths, _mm_or_ps(_mm_and_ps(passMask, zs), 
+					_mm_andnot_ps(passMask, _mm_loadu_ps(depths))));
+			} else if (format == RENDERER_DEPTH_16) {
+				u16* depths = (u16*) depthRow + x;
+				const int mask = _mm_movemask_ps(_mm_castsi128_ps(pass));
+				for (int j = 0; j < 4; j++) {
+					if ((mask >> j) & 1) {
+						depths[j] = DepthToU16(z + j * zStep);
+					}
+				}
+			}
+			written = 1;
+		}
+		
+		w0 += 4 * e0->a;
+		w1 += 4 * e1->a;
+		w2 += 4 * e2->a;
+		z += 4.0f * zStep;
+	}
+#endif
+	for (; x < xMax; x++) {
+		if (masks) {
+			masks[x - xMin] = 0;
+		}
+		
+		if ((w0 | w1 | w2) >= 0) {
+			bool pass = true;
+			if (format == RENDERER_DEPTH_32) {
+				float* depth = (float*) depthRow + x;
+				pass = (z < *depth);
+				if (pass) {
+					*depth = z;
+				}
+			} else if (format == RENDERER_DEPTH_16) {
+				u16* depth = (u16*) depthRow + x;
+				const u16 value = DepthToU16(z);
+				pass = (value < *depth);
+				if (pass) {
+					*depth = value;
+				}
+			}
+			
+			if (pass && masks) {
+				sources[x - xMin] = ShadePixel(span, x - xMin);
+				masks[x - xMin] = 0xFFFFFFFF;
+				written = 1;
+			} else if (pass) {
+				row[x] = ShadePixel(span, x - xMin);
+				written = 1;
+			}
+		}
+		
+		w0 += e0->a;
+		w1 += e1->a;
+		w2 += e2->a;
+		z += zStep;
+	}
+	
+	return written != 0;
+}
+
+/* Perspective-correct values of the first numVaryings varyings of pixels [0, count) of span */
+static void InterpolateSpan(const ShadedSpan* const span, int numVaryings, int count,
+	float varyings[][TQ_SW_BLOCK_SIZE])
+{
+	int i = 0;
+#ifdef TQ_SSE2
+	for (; i + 4 <= count; i += 4) {
+		const __m128 index = _mm_add_ps(_mm_set1_ps((float) i), _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f));
+		const __m128 q = _mm_add_ps(_mm_set1_ps(span->q), _mm_mul_ps(_mm_set1_ps(span->qStep), index));
+		const __m128 estimate = _mm_rcp_ps(q);
+		const __m128 w = _mm_mul_ps(estimate, _mm_sub_ps(_mm_set1_ps(2.0f), _mm_mul_ps(q, estimate)));
+		
+		for (int j = 0; j < numVaryings; j++) {
+			_mm_storeu_ps(varyings[j] + i, _mm_mul_ps(_mm_add_ps(_mm_set1_ps(span->varyings[j]), 
+				_mm_mul_ps(_mm_set1_ps(span->steps[j]), index)), w));
+		}
+	}
+#endif
+	for (; i < count; i++) {
+		const float w = 1.0f / (span->q + span->qStep * i);
+		for (int j = 0; j < numVaryings; j++) {
+			varyings[j][i] = (span->varyings[j] + span->steps[j] * i) * w;
+		}
+	}
+}
+
+/*	The colors of the pixels of span from the 4 varyings at varying (rgba in [0, 1]),
+ *	converted like the built-in fragment stage: a fragment shader that writes its
+ *	colors with this matches DrawShadedTriangles without a texture exactly. */
+void PackSpanColors(const FragmentSpan* span, int varying, Pixel* colors)
+{
+	const float (*values)[TQ_SW_BLOCK_SIZE] = span->varyings + varying;
+	int i = 0;
+#ifdef TQ_SSE2
+	for (; i + 4 <= span->count; i += 4) {
+		_mm_storeu_si128((__m128i*) (colors + i), PackColors4(_mm_loadu_ps(values[0] + i),
+			_mm_loadu_ps(values[1] + i), _mm_loadu_ps(values[2] + i), _mm_loadu_ps(values[3] + i)));
+	}
+#endif
+	for (; i < span->count; i++) {
+		colors[i] = ColorToU8(values[2][i])
+			| (ColorToU8(values[1][i]) << 8)
+			| (ColorToU8(values[0][i]) << 16)
+			| (ColorToU8(values[3][i]) << 24);
+	}
+}
+
+/*	ShadeBlockRow for triangles with a shader: tests the whole row first, then
+ *	interpolates and shades it with one call and blends the passing pixels.
+ *	Returns true if any pixel was written. */
+static bool ShadeBlockRowWithShader(Pixel* row, void* depthRow, DepthFormat format,
+	int xMin, int xMax, int y, int w0, int w1, int w2,
+	const EdgeFunction* const e0, const EdgeFunction* const e1, const EdgeFunction* const e2,
+	float z, float zStep, const ShadedSpan* const span, const Shader* const shader, 
+	BlendSpanFunction* blend)
+{
+	u32 masks[TQ_SW_BLOCK_SIZE];
+	const int count = xMax - xMin;
+	
+	if (format == RENDERER_DEPTH_NONE) {
+		RasterizeBlockRow(row, xMin, xMax, w0, w1, w2, e0, e1, e2, 0, masks);
+		u32 any = 0;
+		for (int i = 0; i < count; i++) {
+			any |= masks[i];
+		}
+		if (!any) {
+			return false;
+		}
+	} else if (!RasterizeBlockRowDepth(row, depthRow, format, xMin, xMax, w0, w1, w2, 
+		e0, e1, e2, z, zStep, 0, masks)) {
+		return false;
+	}
+	
+	FragmentSpan fragments;
+	fragments.x = xMin;
+	fragments.y = y;
+	fragments.count = count;
+	fragments.masks = masks;
+	fragments.uniforms = shader->uniforms;
+	InterpolateSpan(span, shader->numVaryings, count, fragments.varyings);
+	
+	Pixel colors[TQ_SW_BLOCK_SIZE];
+	shader->fragment(&fragments, colors);
+	blend(row + xMin, count, colors, masks);
+	return true;
+}
+
+/*	Setup of a shaded triangle, shared with the multisampled rasterizer: 
+ *	the edge functions with counter-clockwise winding and the planes of
+ *	depth, 1/w and the varyings divided by w. Flat triangles only get depth. */
+typedef struct ShadedTriangle
+{
+	EdgeFunction e0;
+	EdgeFunction e1;
+	EdgeFunction e2;
+	float originX;
+	float originY;
+	AttributePlane zPlane;
+	AttributePlane qPlane;
+	AttributePlane planes[TQ_SW_MAX_VARYINGS];
+	int numPlanes;
+	float zMin;
+	float zMax;
+	float qMin;
+	float qMax;
+	const Texture* texture;
+	const Shader* shader;
+} ShadedTriangle;
+
+/* Returns false for triangles without area, varyings is NULL for flat triangles */
+static bool SetupShadedTriangle(const TriangleCommand* const triangle, 
+	const TriangleVaryings* const varyings, ShadedTriangle* setup)
+{
+	int v1x = triangle->v1x;
+	int v1y = triangle->v1y;
+	int v2x = triangle->v2x;
+	int v2y = triangle->v2y;
+	const int v3x = triangle->v3x;
+	const int v3y = triangle->v3y;
+	int i1 = 0;
+	int i2 = 1;
+	const int i3 = 2;
+	
+	/* Make the winding counter-clockwise, so the inside is positive for all edges */
+	const i64 area = (i64) (v2x - v1x) * (v3y - v1y) - (i64) (v2y - v1y) * (v3x - v1x);
+	if (area == 0) {
+		return false;
+	}
+	if (area < 0) {
+		int temp = v1x;
+		v1x = v2x;
+		v2x = temp;
+		temp = v1y;
+		v1y = v2y;
+		v2y = temp;
+		i1 = 1;
+		i2 = 0;
+	}
+	
+	const EdgeFunction e0 = CreateEdgeFunction(v2x, v2y, v3x, v3y);
+	const EdgeFunction e1 = CreateEdgeFunction(v3x, v3y, v1x, v1y);
+	const EdgeFunction e2 = CreateEdgeFunction(v1x, v1y, v2x, v2y);
+	setup->e0 = e0;
+	setup->e1 = e1;
+	setup->e2 = e2;
+	
+	/* Planes are in pixels from half a pixel before v1, see RasterizeTriangleHalfSpace */
+	const float invArea = 1.0f / (float) ((area < 0) ? -area : area);
+	setup->originX = (float) v1x / TQ_SW_SUBPIXEL_ONE - 0.5f;
+	setup->originY = (float) v1y / TQ_SW_SUBPIXEL_ONE - 0.5f;
+	const float z1 = (i1 == 0) ? triangle->z1 : triangle->z2;
+	const float z2 = (i2 == 0) ? triangle->z1 : triangle->z2;
+	const float z3 = triangle->z3;
+	setup->zPlane = CreateAttributePlane(&e0, &e1, &e2, z1, z2, z3, invArea);
+	setup->zMin = fminf(z1, fminf(z2, z3));
+	setup->zMax = fmaxf(z1, fmaxf(z2, z3));
+	
+	/* A shader has its own varyings, the built-in stage only reads color and uv */
+	if (!varyings) {
+		const AttributePlane none = { 0.0f, 0.0f, 0.0f };
+		setup->qPlane = none;
+		setup->numPlanes = 0;
+		setup->shader = NULL;
+		setup->texture = NULL;
+		return true;
+	}
+	const Shader* const shader = (const Shader*) varyings->shader;
+	setup->shader = shader;
+	setup->texture = (const Texture*) varyings->texture;
+	setup->numPlanes = shader ? shader->numVaryings : TQ_SW_SHADED_VARYINGS;
+	
+	const float q1 = varyings->invW[i1];
+	const float q2 = varyings->invW[i2];
+	const float q3 = varyings->invW[i3];
+	setup->qPlane = CreateAttributePlane(&e0, &e1, &e2, q1, q2, q3, invArea);
+	setup->qMin = fminf(q1, fminf(q2, q3));
+	setup->qMax = fmaxf(q1, fmaxf(q2, q3));
+	
+	for (int i = 0; i < setup->numPlanes; i++) {
+		setup->planes[i] = CreateAttributePlane(&e0, &e1, &e2, 
+			varyings->values[i1][i] * q1, 
+			varyings->values[i2][i] * q2, 
+			varyings->values[i3][i] * q3, invArea);
+	}
+	return true;
+}
+
+static void InitShadedSpan(const ShadedTriangle* const setup, ShadedSpan* span)
+{
+	span->qStep = setup->qPlane.a;
+	for (int i = 0; i < setup->numPlanes; i++) {
+		span->steps[i] = setup->planes[i].a;
+	}
+	span->level = NULL;
+	span->uBase = 0.0f;
+	span->vBase = 0.0f;
+}
+
+/* Starts span at pixel (x, y) */
+static void MoveShadedSpan(const ShadedTriangle* const setup, int x, int y, ShadedSpan* span)
+{
+	const float dx = x - setup->originX;
+	const float dy = y - setup->originY;
+	span->q = EvaluatePlane(&setup->qPlane, dx, dy);
+	for (int i = 0; i < setup->numPlanes; i++) {
+		span->varyings[i] = EvaluatePlane(&setup->planes[i], dx, dy);
+	}
+}
+
+/*	Picks the mip level of the block at (bx, by) from the texel footprint at its center.
+ *	Derivatives of u = U / q, where du/dx = (dU/dx * q - U * dq/dx) / q^2. The center
+ *	can be outside the triangle, so q is kept in the range it has inside. */
+static void SelectMipLevel(const ShadedTriangle* const setup, int bx, int by, ShadedSpan* span)
+{
+	const Texture* const texture = setup->texture;
+	const AttributePlane* const qPlane = &setup->qPlane;
+	const AttributePlane* const uPlane = &setup->planes[VARYING_UV];
+	const AttributePlane* const vPlane = &setup->planes[VARYING_UV + 1];
+	
+	const float centerX = (bx + TQ_SW_BLOCK_SIZE / 2) - setup->originX;
+	const float centerY = (by + TQ_SW_BLOCK_SIZE / 2) - setup->originY;
+	const float q = fminf(fmaxf(EvaluatePlane(qPlane, centerX, centerY), setup->qMin), setup->qMax);
+	const float invQ = 1.0f / q;
+	const float u = EvaluatePlane(uPlane, centerX, centerY) * invQ;
+	const float v = EvaluatePlane(vPlane, centerX, centerY) * invQ;
+	const float width = (float) texture->levels[0].width;
+	const float height = (float) texture->levels[0].height;
+	const float dudx = (uPlane->a - u * qPlane->a) * invQ * width;
+	const float dudy = (uPlane->b - u * qPlane->b) * invQ * width;
+	const float dvdx = (vPlane->a - v * qPlane->a) * invQ * height;
+	const float dvdy = (vPlane->b - v * qPlane->b) * invQ * height;
+	const float footprint = fmaxf(dudx * dudx + dvdx * dvdx, dudy * dudy + dvdy * dvdy);
+	
+	/* log2 of the squared footprint is twice the level */
+	const int lod = (footprint > 1.0f) ? (int) (0.5f * log2f(footprint)) : 0;
+	span->level = &texture->levels[MinInt(lod, texture->numLevels - 1)];
+	
+	/* Whole repeats are subtracted to keep the fixed-point coordinates small */
+	span->uBase = floorf(u);
+	span->vBase = floorf(v);
+}
+
+static void RasterizeTriangleShaded(BackBuffer* backBuffer, DepthBuffer* depthBuffer, 
+	const Rect* clip, const TriangleCommand* const triangle, const TriangleVaryings* const varyings)
+{
+	ShadedTriangle setup;
+	if (!SetupShadedTriangle(triangle, varyings, &setup)) {
+		return;
+	}
+	
+	const Rect bounds = GetTriangleBounds(triangle->v1x, triangle->v1y, triangle->v2x, triangle->v2y, 
+		triangle->v3x, triangle->v3y, clip);
+	const int xMin = bounds.xMin;
+	const int yMin = bounds.yMin;
+	const int xMax = bounds.xMax;
+	const int yMax = bounds.yMax;
+	
+	if (xMin >= xMax || yMin >= yMax) {
+		return;
+	}
+	
+	const EdgeFunction e0 = setup.e0;
+	const EdgeFunction e1 = setup.e1;
+	const EdgeFunction e2 = setup.e2;
+	const AttributePlane zPlane = setup.zPlane;
+	const Shader* const shader = setup.shader;
+	
+	const bool hasDepth = triangle->isDepthTested && depthBuffer->memory != NULL;
+	const DepthFormat depthFormat = hasDepth ? depthBuffer->format : RENDERER_DEPTH_NONE;
+	const int blockXMin = xMin & ~(TQ_SW_BLOCK_SIZE - 1);
+	const int blockYMin = yMin & ~(TQ_SW_BLOCK_SIZE - 1);
+	const int last = TQ_SW_BLOCK_SIZE - 1;
+	
+	ShadedSpan span;
+	InitShadedSpan(&setup, &span);
+	
+	/* Blended rows are shaded into sources first, see RasterizeTriangleHalfSpace */
+	const BlendKernels kernels = GetBlendKernels(triangle->blendMode);
+	const bool isBlended = (triangle->blendMode != RENDERER_BLEND_NONE);
+	Pixel sources[TQ_SW_BLOCK_SIZE];
+	u32 masks[TQ_SW_BLOCK_SIZE];
+	u32* const rowMasks = isBlended ? masks : NULL;
+	
+	for (int by = blockYMin; by < yMax; by += TQ_SW_BLOCK_SIZE) {
+		const int rowMin = MaxInt(by, yMin);
+		const int rowMax = MinInt(by + TQ_SW_BLOCK_SIZE, yMax);
+		
+		for (int bx = blockXMin; bx < xMax; bx += TQ_SW_BLOCK_SIZE) {
+			const int columnMin = MaxInt(bx, xMin);
+			const int columnMax = MinInt(bx + TQ_SW_BLOCK_SIZE, xMax);
+			
+			/* Edge functions at the top-left corner of the block */
+			const int w0 = EvaluateEdgeFunction(&e0, bx, by);
+			const int w1 = EvaluateEdgeFunction(&e1, bx, by);
+			const int w2 = EvaluateEdgeFunction(&e2, bx, by);
+			
+			const int w0Right = w0 + e0.a * last;
+			const int w0Bottom = w0 + e0.b * last;
+			const int w0Corner = w0Right + e0.b * last;
+			const int w1Right = w1 + e1.a * last;
+			const int w1Bottom = w1 + e1.b * last;
+			const int w1Corner = w1Right + e1.b * last;
+			const int w2Right = w2 + e2.a * last;
+			const int w2Bottom = w2 + e2.b * last;
+			const int w2Corner = w2Right + e2.b * last;
+			
+			if ((w0 & w0Right & w0Bottom & w0Corner) < 0
+				|| (w1 & w1Right & w1Bottom & w1Corner) < 0
+				|| (w2 & w2Right & w2Bottom & w2Corner) < 0) {
+				continue;
+			}
+			
+			const bool isCovered = ((w0 | w0Right | w0Bottom | w0Corner
+				| w1 | w1Right | w1Bottom | w1Corner
+				| w2 | w2Right | w2Bottom | w2Corner) >= 0);
+			
+			const float zCorner = EvaluatePlane(&zPlane, columnMin - setup.originX, rowMin - setup.originY);
+			const float zDx = zPlane.a * (columnMax - 1 - columnMin);
+			const float zDy = zPlane.b * (rowMax - 1 - rowMin);
+			const float blockZMin = QuantizeDepth(depthFormat,
+				fmaxf(zCorner + fminf(zDx, 0.0f) + fminf(zDy, 0.0f), setup.zMin));
+			const float blockZMax = QuantizeDepth(depthFormat,
+				fminf(zCorner + fmaxf(zDx, 0.0f) + fmaxf(zDy, 0.0f), setup.zMax));
+			
+			int hiZIndex = 0;
+			if (hasDepth) {
+				hiZIndex = (by / TQ_SW_BLOCK_SIZE) * depthBuffer->numBlocksX + bx / TQ_SW_BLOCK_SIZE;
+				if (blockZMin >= depthBuffer->hiZMax[hiZIndex]) {
+					continue;
+				}
+			}
+			
+			if (setup.texture) {
+				SelectMipLevel(&setup, bx, by, &span);
+			}
+			
+			bool written = false;
+			
+			for (int y = rowMin; y < rowMax; y++) {
+				MoveShadedSpan(&setup, columnMin, y, &span);
+				
+				const int blockDx = columnMin - bx;
+				const int blockDy = y - by;
+				Pixel* row = GetBlockRow(backBuffer, bx, y);
+				u8* depthRow = hasDepth ? depthBuffer->memory + y * depthBuffer->pitch : NULL;
+				if (shader) {
+					written |= ShadeBlockRowWithShader(row, depthRow, depthFormat, 
+						columnMin, columnMax, y,
+						w0 + e0.a * blockDx + e0.b * blockDy,
+						w1 + e1.a * blockDx + e1.b * blockDy,
+						w2 + e2.a * blockDx + e2.b * blockDy,
+						&e0, &e1, &e2,
+						zCorner + zPlane.b * (y - rowMin), zPlane.a, &span, shader, kernels.span);
+					continue;
+				}
+				
+				const bool isRowWritten = ShadeBlockRow(row, depthRow, depthFormat, columnMin, columnMax,
+					w0 + e0.a * blockDx + e0.b * blockDy,
+					w1 + e1.a * blockDx + e1.b * blockDy,
+					w2 + e2.a * blockDx + e2.b * blockDy,
+					&e0, &e1, &e2,
+					zCorner + zPlane.b * (y - rowMin), zPlane.a, &span, 
+					sources, rowMasks);
+				if (isBlended && isRowWritten) {
+					kernels.span(row + columnMin, columnMax - columnMin, sources, masks);
+				}
+				written |= isRowWritten;
+			}
+			
+			if (hasDepth) {
+				if (written) {
+					depthBuffer->hiZMin[hiZIndex] = fminf(depthBuffer->hiZMin[hiZIndex], blockZMin);
+				}
+				if (isCovered && columnMin == bx && columnMax == bx + TQ_SW_BLOCK_SIZE 
+					&& rowMin == by && rowMax == by + TQ_SW_BLOCK_SIZE) {
+					depthBuffer->hiZMax[hiZIndex] = fminf(depthBuffer->hiZMax[hiZIndex], blockZMax);
+				}
+			}
+		}
+	}
+}
+
+/* Pixels shaded once per pixel, at its center, into the colors of the pixels [0, count) with masks set */
+static void ShadeSpan(const ShadedSpan* const span, int count, const u32* masks, Pixel* colors)
+{
+	int i = 0;
+#ifdef TQ_SSE2
+	for (; i + 4 <= count; i += 4) {
+		if (masks[i] | masks[i + 1] | masks[i + 2] | masks[i + 3]) {
+			_mm_storeu_si128((__m128i*) (colors + i), ShadePixels4(span, i));
+		}
+	}
+#endif
+	for (; i < count; i++) {
+		if (masks[i]) {
+			colors[i] = ShadePixel(span, i);
+		}
+	}
+}
+
+/*	What e changes by at an offset of (dx, dy) 28.4 units from the pixel centers.
+ *	Exact, the steps are whole multiples of TQ_SW_SUBPIXEL_ONE. Less than 2^23 inside
+ *	the guard band, so adding it to a clamped value keeps the sign. */
+inline int GetEdgeOffset(const EdgeFunction* const e, int dx, int dy)
+{
+	return (e->a * dx + e->b * dy) / TQ_SW_SUBPIXEL_ONE;
+}
+
+/* Bounding box of the pixels which can have a sample inside the triangle */
+static Rect GetMultisampledTriangleBounds(const TriangleCommand* const triangle, const Rect* clip)
+{
+	Rect result = { clip->xMax, clip->yMax, clip->xMin, clip->yMin };
+	for (int i = 0; i < TQ_SW_NUM_SAMPLES; i++) {
+		const int dx = sampleOffsets[i][0];
+		const int dy = sampleOffsets[i][1];
+		const Rect bounds = GetTriangleBounds(triangle->v1x - dx, triangle->v1y - dy, 
+			triangle->v2x - dx, triangle->v2y - dy, triangle->v3x - dx, triangle->v3y - dy, clip);
+		result.xMin = MinInt(result.xMin, bounds.xMin);
+		result.yMin = MinInt(result.yMin, bounds.yMin);
+		result.xMax = MaxInt(result.xMax, bounds.xMax);
+		result.yMax = MaxInt(result.yMax, bounds.yMax);
+	}
+	return result;
+}
+
+/*	Every kind of triangle with multisampling, see Multisampling. Coverage and depth
+ *	go through the same rows as RasterizeTriangleHalfSpace, once per sample, then
+ *	the pixels in the union of the sample masks are shaded and written to the 
+ *	samples in the masks. Pixels on an edge are shaded at their center even when 
+ *	it is outside the triangle, like GPUs without centroid sampling. */
+static void RasterizeTriangleMultisampled(Renderer* renderer, const Rect* clip, 
+	const TriangleCommand* const triangle)
+{
+	ShadedTriangle setup;
+	if (!SetupShadedTriangle(triangle, GetTriangleVaryings(renderer, triangle), &setup)) {
+		return;
+	}
+	
+	const Rect bounds = GetMultisampledTriangleBounds(triangle, clip);
+	const int xMin = bounds.xMin;
+	const int yMin = bounds.yMin;
+	const int xMax = bounds.xMax;
+	const int yMax = bounds.yMax;
+	
+	if (xMin >= xMax || yMin >= yMax) {
+		return;
+	}
+	
+	/* Edge function and depth offsets of every sample from the pixel center */
+	const EdgeFunction edges[3] = { setup.e0, setup.e1, setup.e2 };
+	int edgeOffsets[TQ_SW_NUM_SAMPLES][3];
+	float sampleZ[TQ_SW_NUM_SAMPLES];
+	const AttributePlane zPlane = setup.zPlane;
+	for (int i = 0; i < TQ_SW_NUM_SAMPLES; i++) {
+		const int dx = sampleOffsets[i][0];
+		const int dy = sampleOffsets[i][1];
+		for (int j = 0; j < 3; j++) {
+			edgeOffsets[i][j] = GetEdgeOffset(&edges[j], dx, dy);
+		}
+		sampleZ[i] = (zPlane.a * dx + zPlane.b * dy) / TQ_SW_SUBPIXEL_ONE;
+	}
+	
+	const DepthFormat depthFormat = renderer->depthBuffer.format;
+	const bool hasDepth = triangle->isDepthTested && renderer->depthBuffer.memory != NULL;
+	const float zExtent = (fabsf(zPlane.a) + fabsf(zPlane.b)) * TQ_SW_SAMPLE_EXTENT / TQ_SW_SUBPIXEL_ONE;
+	const int blockXMin = xMin & ~(TQ_SW_BLOCK_SIZE - 1);
+	const int blockYMin = yMin & ~(TQ_SW_BLOCK_SIZE - 1);
+	const int last = TQ_SW_BLOCK_SIZE - 1;
+	
+	ShadedSpan span;
+	InitShadedSpan(&setup, &span);
+	
+	const BlendKernels kernels = GetBlendKernels(triangle->blendMode);
+	const Pixel pixel = PackColor(&triangle->color);
+	Pixel sources[TQ_SW_BLOCK_SIZE];
+	u32 masks[TQ_SW_NUM_SAMPLES][TQ_SW_BLOCK_SIZE];
+	u32 coverage[TQ_SW_BLOCK_SIZE];
+	Pixel sampleSources[TQ_SW_NUM_SAMPLES * TQ_SW_BLOCK_SIZE];
+	u32 sampleMasks[TQ_SW_NUM_SAMPLES * TQ_SW_BLOCK_SIZE];
+	
+	if (setup.numPlanes == 0) {
+		FillSpan(sources, TQ_SW_BLOCK_SIZE, pixel);
+	}
+	
+	for (int by = blockYMin; by < yMax; by += TQ_SW_BLOCK_SIZE) {
+		const int rowMin = MaxInt(by, yMin);
+		const int rowMax = MinInt(by + TQ_SW_BLOCK_SIZE, yMax);
+		
+		for (int bx = blockXMin; bx < xMax; bx += TQ_SW_BLOCK_SIZE) {
+			const int columnMin = MaxInt(bx, xMin);
+			const int columnMax = MinInt(bx + TQ_SW_BLOCK_SIZE, xMax);
+			const int count = columnMax - columnMin;
+			const bool isFullBlock = (columnMin == bx && columnMax == bx + TQ_SW_BLOCK_SIZE 
+				&& rowMin == by && rowMax == by + TQ_SW_BLOCK_SIZE);
+			
+			/* Depth range of all samples in the block */
+			const float zCorner = EvaluatePlane(&zPlane, columnMin - setup.originX, rowMin - setup.originY);
+			const float zDx = zPlane.a * (count - 1);
+			const float zDy = zPlane.b * (rowMax - 1 - rowMin);
+			const float blockZMin = QuantizeDepth(depthFormat,
+				fmaxf(zCorner + fminf(zDx, 0.0f) + fminf(zDy, 0.0f) - zExtent, setup.zMin));
+			const float blockZMax = QuantizeDepth(depthFormat,
+				fminf(zCorner + fmaxf(zDx, 0.0f) + fmaxf(zDy, 0.0f) + zExtent, setup.zMax));
+			const int hiZIndex = hasDepth 
+				? (by / TQ_SW_BLOCK_SIZE) * renderer->depthBuffer.numBlocksX + bx / TQ_SW_BLOCK_SIZE : 0;
+			
+			/*	Samples which can be inside somewhere in the block and pass the early-Z 
+			 *	test, samples inside all over the block, and covered samples which pass 
+			 *	the depth test everywhere (every covered sample without depth), as bits */
+			int active = 0;
+			int covered = 0;
+			int passing = 0;
+			int centers[3];
+			for (int j = 0; j < 3; j++) {
+				centers[j] = EvaluateEdgeFunction(&edges[j], bx, by);
+			}
+			
+			int w[TQ_SW_NUM_SAMPLES][3];
+			for (int i = 0; i < TQ_SW_NUM_SAMPLES; i++) {
+				int outside = 0;
+				int partial = 0;
+				for (int j = 0; j < 3; j++) {
+					const EdgeFunction* const e = &edges[j];
+					const int corner = centers[j] + edgeOffsets[i][j];
+					const int right = corner + e->a * last;
+					const int bottom = corner + e->b * last;
+					const int opposite = right + e->b * last;
+					outside |= ((corner & right & bottom & opposite) < 0);
+					partial |= ((corner | right | bottom | opposite) < 0);
+					w[i][j] = corner;
+				}
+				if (outside) {
+					continue;
+				}
+				const DepthBuffer* const depthBuffer = hasDepth ? GetSampleDepthBuffer(renderer, i) : NULL;
+				if (hasDepth && blockZMin >= depthBuffer->hiZMax[hiZIndex]) {
+					continue;
+				}
+				active |= 1 << i;
+				covered |= (!partial) << i;
+				passing |= (!partial && (!hasDepth || blockZMax < depthBuffer->hiZMin[hiZIndex])) << i;
+			}
+			
+			if (!active) {
+				continue;
+			}
+			
+			/* Passing samples are written without tests, with depth when there is a depth buffer */
+			int written = passing;
+			const int allSamples = (1 << TQ_SW_NUM_SAMPLES) - 1;
+			const bool isFlatFill = (passing == allSamples && setup.numPlanes == 0);
+			
+			if (setup.texture && !isFlatFill) {
+				SelectMipLevel(&setup, bx, by, &span);
+			}
+			
+			for (int y = rowMin; y < rowMax; y++) {
+				const float z = zCorner + zPlane.b * (y - rowMin);
+				if (hasDepth) {
+					for (int i = 0; i < TQ_SW_NUM_SAMPLES; i++) {
+						if ((passing >> i) & 1) {
+							DepthBuffer* depthBuffer = GetSampleDepthBuffer(renderer, i);
+							WriteDepthSpan(depthBuffer->memory + y * depthBuffer->pitch, depthFormat, 
+								columnMin, columnMax, z + sampleZ[i], zPlane.a);
+						}
+					}
+				}
+				
+				/* Flat and every sample passes, like the full blocks of RasterizeTriangleHalfSpace */
+				if (isFlatFill) {
+					Pixel* row = GetBackBufferRow(&renderer->sampleBuffer, y);
+					kernels.fill(row + TQ_SW_NUM_SAMPLES * columnMin, TQ_SW_NUM_SAMPLES * count, pixel);
+					continue;
+				}
+				
+				const int blockDx = columnMin - bx;
+				const int blockDy = y - by;
+				memset(coverage, 0, sizeof(coverage));
+				
+				for (int i = 0; i < TQ_SW_NUM_SAMPLES; i++) {
+					if (!((active >> i) & 1)) {
+						continue;
+					}
+					
+					if ((passing >> i) & 1) {
+						memset(masks[i], 0xFF, sizeof(masks[i]));
+						memset(coverage, 0xFF, sizeof(coverage));
+						continue;
+					}
+					
+					const int w0 = w[i][0] + edges[0].a * blockDx + edges[0].b * blockDy;
+					const int w1 = w[i][1] + edges[1].a * blockDx + edges[1].b * blockDy;
+					const int w2 = w[i][2] + edges[2].a * blockDx + edges[2].b * blockDy;
+					if (hasDepth) {
+						DepthBuffer* depthBuffer = GetSampleDepthBuffer(renderer, i);
+						if (RasterizeBlockRowDepth(NULL, depthBuffer->memory + y * depthBuffer->pitch, 
+							depthFormat, columnMin, columnMax, w0, w1, w2, &edges[0], &edges[1], &edges[2], 
+							z + sampleZ[i], zPlane.a, 0, masks[i])) {
+							written |= 1 << i;
+						}
+					} else {
+						RasterizeBlockRow(NULL, columnMin, columnMax, w0, w1, w2, 
+							&edges[0], &edges[1], &edges[2], 0, masks[i]);
+					}
+					
+					for (int x = 0; x < count; x++) {
+						coverage[x] |= masks[i][x];
+					}
+				}
+				
+				u32 any = 0;
+				for (int x = 0; x < count; x++) {
+					any |= coverage[x];
+				}
+				if (!any) {
+					continue;
+				}
+				
+				if (setup.shader) {
+					MoveShadedSpan(&setup, columnMin, y, &span);
+					FragmentSpan fragments;
+					fragments.x = columnMin;
+					fragments.y = y;
+					fragments.count = count;
+					fragments.masks = coverage;
+					fragments.uniforms = setup.shader->uniforms;
+					InterpolateSpan(&span, setup.numPlanes, count, fragments.varyings);
+					setup.shader->fragment(&fragments, sources);
+				} else if (setup.numPlanes > 0) {
+					MoveShadedSpan(&setup, columnMin, y, &span);
+					ShadeSpan(&span, count, coverage, sources);
+				}
+				
+				/* Inactive samples were never tested, their masks are stale */
+				for (int x = 0; x < count; x++) {
+					for (int i = 0; i < TQ_SW_NUM_SAMPLES; i++) {
+						sampleSources[x * TQ_SW_NUM_SAMPLES + i] = sources[x];
+						sampleMasks[x * TQ_SW_NUM_SAMPLES + i] = ((active >> i) & 1) ? masks[i][x] : 0;
+					}
+				}
+				Pixel* row = GetBackBufferRow(&renderer->sampleBuffer, y);
+				kernels.span(row + TQ_SW_NUM_SAMPLES * columnMin, TQ_SW_NUM_SAMPLES * count, 
+					sampleSources, sampleMasks);
+			}
+			
+			if (hasDepth) {
+				for (int i = 0; i < TQ_SW_NUM_SAMPLES; i++) {
+					DepthBuffer* depthBuffer = GetSampleDepthBuffer(renderer, i);
+					if ((written >> i) & 1) {
+						depthBuffer->hiZMin[hiZIndex] = fminf(depthBuffer->hiZMin[hiZIndex], blockZMin);
+					}
+					if (((covered >> i) & 1) && isFullBlock) {
+						depthBuffer->hiZMax[hiZIndex] = fminf(depthBuffer->hiZMax[hiZIndex], blockZMax);
+					}
+				}
+			}
+		}
+	}
+}
+
+/*	Pixels inside clip which triangle can touch: the rasterizers only write 
+ *	pixels whose centers (or samples) are inside the triangle */
+static Rect GetTriangleCommandBounds(const Renderer* const renderer, const TriangleCommand* const triangle,
+	const Rect* clip)
+{
+	if (renderer->isMultisampled) {
+		return GetMultisampledTriangleBounds(triangle, clip);
+	}
+	return GetTriangleBounds(triangle->v1x, triangle->v1y, triangle->v2x, triangle->v2y,
+		triangle->v3x, triangle->v3y, clip);
+}
+
+static void RasterizeTriangle(Renderer* renderer, int* scanBuffer, const Rect* clip,
+	const TriangleCommand* const triangle)
+{
+	if (renderer->isMultisampled) {
+		RasterizeTriangleMultisampled(renderer, clip, triangle);
+		return;
+	}
+	
+	if (triangle->varyings != TQ_SW_FLAT) {
+		RasterizeTriangleShaded(&renderer->backBuffer, &renderer->depthBuffer, clip, triangle,
+			GetTriangleVaryings(renderer, triangle));
+		return;
+	}
+	
+	if (renderer->depthBuffer.memory && triangle->isDepthTested) {
+		RasterizeTriangleHalfSpace(&renderer->backBuffer, &renderer->depthBuffer, clip, triangle);
+		return;
+	}
+	
+	switch (renderer->rasterizer) {
+		case RENDERER_RASTERIZER_HALFSPACE:
+			RasterizeTriangleHalfSpace(&renderer->backBuffer, &renderer->depthBuffer, clip, triangle);
+			break;
+		default:
+			RasterizeTriangleScanline(&renderer->backBuffer, scanBuffer, clip, triangle);
+			break;
+	}
+}
+
+/*	Lines:
+ *	Bresenham's line, for all octants, written as runs instead of single pixels.
+ *	Along the major axis, step i lands on minor coordinate k_i = floor((2 * dMinor * i + dMajor) / (2 * dMajor)),
+ *	which is what the Bresenham error term computes incrementally, so the steps
+ *	of one run (same k) can be computed directly and written as one span: 
+ *	horizontal spans for x-major lines, vertical spans for y-major lines.
+ *	The line is first clipped with Cohen-Sutherland to find the visible steps,
+ *	so lines far outside the screen don't cost anything.
+ */
+enum OutCode
+{
+	OUTCODE_INSIDE = 0,
+	OUTCODE_LEFT = 1,
+	OUTCODE_RIGHT = 2,
+	OUTCODE_BOTTOM = 4,
+	OUTCODE_TOP = 8
+};
+
+/*	Clip window in pixel coordinates, a pixel covers [x - 0.5, x + 0.5] */
+typedef struct LineClipWindow
+{
+	double xMin;
+	double yMin;
+	double xMax;
+	double yMax;
+} LineClipWindow;
+
+static int ComputeOutCode(double x, double y, const LineClipWindow* const window)
+{
+	int code = OUTCODE_INSIDE;
+	
+	if (x < window->xMin) {
+		code |= OUTCODE_LEFT;
+	} else if (x > window->xMax) {
+		code |= OUTCODE_RIGHT;
+	}
+	if (y < window->yMin) {
+		code |= OUTCODE_BOTTOM;
+	} else if (y > window->yMax) {
+		code |= OUTCODE_TOP;
+	}
+	
+	return code;
+}
+
+/*	Cohen-Sutherland, returns false if the line is completely outside. */
+static bool ClipLine(double* x0, double* y0, double* x1, double* y1, const LineClipWindow* const window)
+{
+	int code0 = ComputeOutCode(*x0, *y0, window);
+	int code1 = ComputeOutCode(*x1, *y1, window);
+	
+	for (;;) {
+		if (!(code0 | code1)) {
+			return true;
+		}
+		if (code0 & code1) {
+			return false;
+		}
+		
+		const int code = code0 ? code0 : code1;
+		double x;
+		double y;
+		
+		if (code & OUTCODE_TOP) {
+			y = window->yMax;
+			x = *x0 + (*x1 - *x0) * (y - *y0) / (*y1 - *y0);
+		} else if (code & OUTCODE_BOTTOM) {
+			y = window->yMin;
+			x = *x0 + (*x1 - *x0) * (y - *y0) / (*y1 - *y0);
+		} else if (code & OUTCODE_RIGHT) {
+			x = window->xMax;
+			y = *y0 + (*y1 - *y0) * (x - *x0) / (*x1 - *x0);
+		} else {
+			x = window->xMin;
+			y = *y0 + (*y1 - *y0) * (x - *x0) / (*x1 - *x0);
+		}
+		
+		if (code == code0) {
+			*x0 = x;
+			*y0 = y;
+			code0 = ComputeOutCode(x, y, window);
+		} else {
+			*x1 = x;
+			*y1 = y;
+			code1 = ComputeOutCode(x, y, window);
+		}
+	}
+}
+
+inline i64 FloorDiv(i64 numerator, i64 denominator)
+{
+	/* denominator > 0 */
+	const i64 quotient = numerator / denominator;
+	return (numerator % denominator < 0) ? quotient - 1 : quotient;
+}
+
+/*	Below this, 2 * dMajor * dMinor fits in an i64 and the line steps are one division */
+#define TQ_SW_LINE_SMALL (1 << 30)
+
+/*	The minor step of major step i of a line, floor((2 * dMinor * i + dMajor) / (2 * dMajor)).
+ *	With 0 <= i <= dMajor and 0 <= dMinor <= dMajor < 2^32, dMinor * i only fits in
+ *	a u64, so the quotient by dMajor is taken before the rest is doubled. */
+inline i64 GetLineMinorStep(i64 i, i64 dMajor, i64 dMinor)
+{
+	if (dMajor < TQ_SW_LINE_SMALL) {
+		return (2 * dMinor * i + dMajor) / (2 * dMajor);
+	}
+	
+	const u64 product = (u64) dMinor * (u64) i;
+	const i64 quotient = (i64) (product / (u64) dMajor);
+	const i64 remainder = (i64) (product % (u64) dMajor);
+	return quotient + (2 * remainder + dMajor) / (2 * dMajor);
+}
+
+/*	The first major step with minor step k, ceil((2 * dMajor * k - dMajor) / (2 * dMinor)),
+ *	for 0 < dMinor and 0 <= k <= dMinor + 1. Split like GetLineMinorStep. */
+inline i64 GetLineMajorStep(i64 k, i64 dMajor, i64 dMinor)
+{
+	if (dMajor < TQ_SW_LINE_SMALL) {
+		return -FloorDiv(dMajor - 2 * dMajor * k, 2 * dMinor);
+	}
+	
+	const u64 product = (u64) dMajor * (u64) k;
+	const i64 quotient = (i64) (product / (u64) dMinor);
+	const i64 remainder = (i64) (product % (u64) dMinor);
+	return quotient - FloorDiv(dMajor - 2 * remainder, 2 * dMinor);
+}
+
+/* blend is NULL for opaque pixels */
+static void FillColumn(const BackBuffer* const backBuffer, int x, int yMin, int yMax, Pixel pixel,
+	BlendFillFunction* blend)
+{
+	if (backBuffer->layout == RENDERER_LAYOUT_SWIZZLED) {
+		const size_t offset = GetSwizzledOffset(x);
+		for (int y = yMin; y < yMax; y++) {
+			Pixel* destination = GetSwizzledRow(backBuffer, y) + offset;
+			if (blend) {
+				blend(destination, 1, pixel);
+			} else {
+				*destination = pixel;
+			}
+		}
+		return;
+	}
+	
+	u8* memory = (u8*) (GetBackBufferRow(backBuffer, yMin) + x);
+	for (int y = yMin; y < yMax; y++) {
+		if (blend) {
+			blend((Pixel*) memory, 1, pixel);
+		} else {
+			*(Pixel*) memory = pixel;
+		}
+		memory += backBuffer->pitch;
+	}
+}
+
+/* blend is NULL for opaque pixels, fill writes single pixels and horizontal runs */
+static void DrawClippedLine(const BackBuffer* const backBuffer, const Rect* const clip, int x0, int y0, int x1, int y1, 
+	Pixel pixel, BlendFillFunction* fill, BlendFillFunction* blend)
+{
+	const LineClipWindow window = {
+		clip->xMin - 0.5, clip->yMin - 0.5, clip->xMax - 0.5, clip->yMax - 0.5
+	};
+	
+	double clippedX0 = x0;
+	double clippedY0 = y0;
+	double clippedX1 = x1;
+	double clippedY1 = y1;
+	if (!ClipLine(&clippedX0, &clippedY0, &clippedX1, &clippedY1, &window)) {
+		return;
+	}
+	
+	/* Endpoints can be up to 2^32 - 1 apart */
+	const i64 dx = (x1 >= x0) ? (i64) x1 - x0 : (i64) x0 - x1;
+	const i64 dy = (y1 >= y0) ? (i64) y1 - y0 : (i64) y0 - y1;
+	const int sx = (x1 >= x0) ? 1 : -1;
+	const int sy = (y1 >= y0) ? 1 : -1;
+	
+	if (dx == 0 && dy == 0) {
+		fill(GetPixelAddress(backBuffer, x0, y0), 1, pixel);
+		return;
+	}
+	
+	const bool isXMajor = (dx >= dy);
+	const i64 dMajor = isXMajor ? dx : dy;
+	const i64 dMinor = isXMajor ? dy : dx;
+	
+	/*	Visible steps along the major axis, padded by one: the runs themselves are 
+	 *	clipped exactly, this only skips the invisible part of the line. */
+	const double i0 = isXMajor ? (clippedX0 - x0) * sx : (clippedY0 - y0) * sy;
+	const double i1 = isXMajor ? (clippedX1 - x0) * sx : (clippedY1 - y0) * sy;
+	/* Clamped before the casts, the steps can be out of int range */
+	const i64 iStart = (i64) fmax(floor(fmin(i0, i1)) - 1.0, 0.0);
+	const i64 iEnd = (i64) fmin(ceil(fmax(i0, i1)) + 1.0, (double) dMajor);
+	
+	const i64 kStart = GetLineMinorStep(iStart, dMajor, dMinor);
+	const i64 kEnd = GetLineMinorStep(iEnd, dMajor, dMinor);
+	
+	/* The first step of the next run, so every run costs one GetLineMajorStep */
+	i64 nextRunStart = (dMinor > 0) ? GetLineMajorStep(kStart, dMajor, dMinor) : iStart;
+	for (i64 k = kStart; k <= kEnd; k++) {
+		/* Steps i with k_i == k */
+		i64 runStart = iStart;
+		i64 runEnd = iEnd;
+		if (dMinor > 0) {
+			runStart = nextRunStart;
+			nextRunStart = GetLineMajorStep(k + 1, dMajor, dMinor);
+			runEnd = nextRunStart - 1;
+			runStart = (runStart < iStart) ? iStart : runStart;
+			runEnd = (runEnd > iEnd) ? iEnd : runEnd;
+		}
+		if (runStart > runEnd) {
+			continue;
+		}
+		
+		/* Coordinates in i64 until they are clipped to the int range of clip */
+		if (isXMajor) {
+			const i64 y = y0 + sy * k;
+			if (y < clip->yMin || y >= clip->yMax) {
+				continue;
+			}
+			const i64 xa = x0 + sx * ((sx > 0) ? runStart : runEnd);
+			const i64 xb = x0 + sx * ((sx > 0) ? runEnd : runStart);
+			const i64 xMin = (xa > clip->xMin) ? xa : clip->xMin;
+			const i64 xMax = (xb + 1 < clip->xMax) ? xb + 1 : clip->xMax;
+			if (xMin < xMax) {
+				FillRowSpan(backBuffer, (int) y, (int) xMin, (int) xMax, fill, pixel);
+			}
+		} else {
+			const i64 x = x0 + sx * k;
+			if (x < clip->xMin || x >= clip->xMax) {
+				continue;
+			}
+			const i64 ya = y0 + sy * ((sy > 0) ? runStart : runEnd);
+			const i64 yb = y0 + sy * ((sy > 0) ? runEnd : runStart);
+			const i64 yMin = (ya > clip->yMin) ? ya : clip->yMin;
+			const i64 yMax = (yb + 1 < clip->yMax) ? yb + 1 : clip->yMax;
+			if (yMin < yMax) {
+				FillColumn(backBuffer, (int) x, (int) yMin, (int) yMax, pixel, blend);
+			}
+		}
+	}
+}
+
+void DrawLine(Renderer* renderer, int x0, int y0, int x1, int y1, const Color* const color)
 {
-	u8 r;
-	u8 g;
-	u8 b;
-	u8 a;
-} Color;
+	if (renderer->numTriangles > 0) {
+		FlushRenderer(renderer);
+	}
+	
+	const BackBuffer* const backBuffer = &renderer->backBuffer;
+	const Rect drawable = GetDrawableRect(backBuffer);
+	Rect clips[TQ_SW_MAX_DIRTY_RECTS];
+	const int numClips = GetClipRects(renderer, &drawable, clips);
+	
+	/* Clamped to the drawable first, + 1 overflows for INT_MAX */
+	const Rect bounds = {
+		MinInt(x0, x1), MinInt(y0, y1),
+		MinInt(MaxInt(x0, x1), drawable.xMax) + 1, MinInt(MaxInt(y0, y1), drawable.yMax) + 1
+	};
+	MarkDirtyRect(renderer, &bounds);
+	
+	const Pixel pixel = PackColor(color);
+	BlendFillFunction* const fill = GetBlendKernels(renderer->blendMode).fill;
+	BlendFillFunction* const blend = (renderer->blendMode != RENDERER_BLEND_NONE) ? fill : NULL;
+	for (int i = 0; i < numClips; i++) {
+		DrawClippedLine(backBuffer, &clips[i], x0, y0, x1, y1, pixel, fill, blend);
+	}
+}
 
-typedef struct Renderer
+static void RasterizeTileWork(void* data)
 {
-	BackBuffer backBuffer;
-	int* scanBuffer;
-} Renderer;
+	RenderTile* tile = (RenderTile*) data;
+	Renderer* renderer = tile->renderer;
+	int scanBuffer[2 * TQ_SW_TILE_SIZE];
+	Rect clips[TQ_SW_MAX_DIRTY_RECTS];
+	const int numClips = GetClipRects(renderer, &tile->rect, clips);
+	
+	for (int i = 0; i < tile->numTriangles; i++) {
+		const TriangleCommand* const triangle = &renderer->triangles[tile->triangles[i]];
+		for (int j = 0; j < numClips; j++) {
+			RasterizeTriangle(renderer, scanBuffer, &clips[j], triangle);
+		}
+	}
+}
 
-Renderer CreateRenderer(int width, int height)
+/*	Splits the back buffer into tiles. The bins are empty, so tiles which 
+ *	already exist keep their bin memory, wherever they end up in the grid. */
+static void LayoutTiles(Renderer* renderer)
 {
-	const int bytesPerPixel = 4;
-	const int pitch = width * bytesPerPixel;
-	const int memorySize = pitch * height;
+	const BackBuffer* const backBuffer = &renderer->backBuffer;
+	const Rect drawable = GetDrawableRect(backBuffer);
+	const int numTilesX = (backBuffer->width + TQ_SW_TILE_SIZE - 1) / TQ_SW_TILE_SIZE;
+	const int numTilesY = (backBuffer->height + TQ_SW_TILE_SIZE - 1) / TQ_SW_TILE_SIZE;
+	const int numTiles = numTilesX * numTilesY;
 	
-	Renderer result;
-	result.backBuffer.bytesPerPixel = bytesPerPixel;
-	result.backBuffer.pitch = pitch;
-	result.backBuffer.memory = (u8*) malloc(sizeof(u8) * memorySize);
+	if (numTiles > renderer->maxTiles) {
+		renderer->tiles = (RenderTile*) realloc(renderer->tiles, sizeof(RenderTile) * numTiles);
+		for (int i = renderer->maxTiles; i < numTiles; i++) {
+			renderer->tiles[i].triangles = NULL;
+			renderer->tiles[i].numTriangles = 0;
+			renderer->tiles[i].maxTriangles = 0;
+		}
+		renderer->maxTiles = numTiles;
+	}
+	renderer->numTilesX = numTilesX;
+	renderer->numTilesY = numTilesY;
+	
+	for (int y = 0; y < numTilesY; y++) {
+		for (int x = 0; x < numTilesX; x++) {
+			RenderTile* tile = &renderer->tiles[y * numTilesX + x];
+			tile->renderer = renderer;
+			tile->rect.xMin = MaxInt(x * TQ_SW_TILE_SIZE, drawable.xMin);
+			tile->rect.yMin = MaxInt(y * TQ_SW_TILE_SIZE, drawable.yMin);
+			tile->rect.xMax = MinInt((x + 1) * TQ_SW_TILE_SIZE, drawable.xMax);
+			tile->rect.yMax = MinInt((y + 1) * TQ_SW_TILE_SIZE, drawable.yMax);
+		}
+	}
+}
+
+void EnableTiledRendering(Renderer* renderer, WorkQueue* workQueue)
+{
+	DisableTiledRendering(renderer);
 	
-	for (int i = 0; i < memorySize; i++) {
-		result.backBuffer.memory[i] = 0;
+	renderer->workQueue = workQueue;
+	LayoutTiles(renderer);
+}
+
+void DisableTiledRendering(Renderer* renderer)
+{
+	if (!renderer->workQueue) {
+		return;
 	}
 	
-	result.backBuffer.width = width;
-	result.backBuffer.height = height;
+	FlushRenderer(renderer);
 	
-	const int scanBufferSize = 2 * height;
-	result.scanBuffer = (int*) malloc(sizeof(int) * scanBufferSize);
-	for (int i = 0; i < scanBufferSize; i++) {
-		result.scanBuffer[i] = 0;
+	for (int i = 0; i < renderer->maxTiles; i++) {
+		free(renderer->tiles[i].triangles);
 	}
+	free(renderer->tiles);
+	free(renderer->triangles);
 	
-	return result;
+	renderer->workQueue = NULL;
+	renderer->triangles = NULL;
+	renderer->numTriangles = 0;
+	renderer->maxTriangles = 0;
+	renderer->tiles = NULL;
+	renderer->numTilesX = 0;
+	renderer->numTilesY = 0;
+	renderer->maxTiles = 0;
 }
 
-void DestroyRenderer(Renderer* renderer)
+/*	Rasterizes all binned triangles, one work queue entry per non-empty tile.
+ *	Call before presenting the back buffer. */
+void FlushRenderer(Renderer* renderer)
 {
-	free(renderer->backBuffer.memory);
-	free(renderer->scanBuffer);
+	if (renderer->numTriangles == 0) {
+		return;
+	}
+	
+	const int numTiles = renderer->numTilesX * renderer->numTilesY;
+	for (int i = 0; i < numTiles; i++) {
+		RenderTile* tile = &renderer->tiles[i];
+		if (tile->numTriangles > 0) {
+			/* Renderer is returned by value from CreateRenderer, so refresh the back pointer */
+			tile->renderer = renderer;
+			AddWorkQueueEntry(renderer->workQueue, RasterizeTileWork, tile);
+		}
+	}
+	CompleteAllWork(renderer->workQueue);
+	
+	DiscardTiles(renderer);
 }
 
-void ClearBackBuffer(Renderer* renderer, Color* color)
+static void BinTriangle(Renderer* renderer, const TriangleCommand* const triangle)
 {
-	BackBuffer* backBuffer = &renderer->backBuffer;
-	const size_t columns = backBuffer->width * backBuffer->bytesPerPixel;
-	const size_t rows = backBuffer->height;
-        
-	for (size_t i = 0; i < rows; i++) {
-		for (size_t j = 0; j < columns; j += backBuffer->bytesPerPixel) {
-	        /* Format: BGRA */
-	        const size_t index = i * columns + j;
-	        backBuffer->memory[index] = color->b;
-	        backBuffer->memory[index + 1] = color->g;
-	        backBuffer->memory[index + 2] = color->r;
-	        backBuffer->memory[index + 3] = color->a;  
-	    }
+	const Rect drawable = GetDrawableRect(&renderer->backBuffer);
+	const Rect bounds = GetTriangleCommandBounds(renderer, triangle, &drawable);
+	const int xMin = bounds.xMin;
+	const int yMin = bounds.yMin;
+	const int xMax = bounds.xMax;
+	const int yMax = bounds.yMax;
+	
+	if (xMin >= xMax || yMin >= yMax) {
+		return;
+	}
+	
+	if (renderer->numTriangles == renderer->maxTriangles) {
+		renderer->maxTriangles = (renderer->maxTriangles > 0) ? 2 * renderer->maxTriangles : 1024;
+		renderer->triangles = (TriangleCommand*) realloc(renderer->triangles,
+			sizeof(TriangleCommand) * renderer->maxTriangles);
+	}
+	
+	const u32 index = renderer->numTriangles++;
+	renderer->triangles[index] = *triangle;
+	
+	const int tileXMin = xMin / TQ_SW_TILE_SIZE;
+	const int tileYMin = yMin / TQ_SW_TILE_SIZE;
+	const int tileXMax = (xMax - 1) / TQ_SW_TILE_SIZE;
+	const int tileYMax = (yMax - 1) / TQ_SW_TILE_SIZE;
+	
+	for (int y = tileYMin; y <= tileYMax; y++) {
+		for (int x = tileXMin; x <= tileXMax; x++) {
+			RenderTile* tile = &renderer->tiles[y * renderer->numTilesX + x];
+			if (tile->numTriangles == tile->maxTriangles) {
+				tile->maxTriangles = (tile->maxTriangles > 0) ? 2 * tile->maxTriangles : 64;
+				tile->triangles = (u32*) realloc(tile->triangles, sizeof(u32) * tile->maxTriangles);
+			}
+			tile->triangles[tile->numTriangles++] = index;
+		}
 	}
 }
 
-/* TODO: Resize? */
+/*	Clipping:
+ *	Triangles are clipped in homogeneous clip space, before the perspective divide,
+ *	against the near plane and against a guard band of TQ_SW_GUARD_BAND pixels
+ *	around the viewport. Triangles crossing the viewport edges inside the guard
+ *	band are left as they are: the rasterizers only walk their bounding box
+ *	inside the clip rect, so the fill loops never need a per-pixel bounds check.
+ *	The guard band keeps 28.4 screen coordinates small enough for the 
+ *	integer edge functions.
+ *
+ *	Reference:
+ *	Blinn & Newell, Clipping using homogeneous coordinates (1978)
+ */
+#define TQ_SW_GUARD_BAND 4096
+
+/* 3 vertices, plus at most 1 extra per clip plane */
+#define TQ_SW_MAX_CLIP_VERTICES 8
 
-void DrawPixel(Renderer* renderer, int x, int y, const Color* const color)
+enum ClipCode
 {
-	BackBuffer* backBuffer = &(renderer->backBuffer);
-	const int width = backBuffer->width;
-	const int height = backBuffer->height;
+	CLIP_LEFT = 1 << 0,
+	CLIP_RIGHT = 1 << 1,
+	CLIP_BOTTOM = 1 << 2,
+	CLIP_TOP = 1 << 3,
+	CLIP_NEAR = 1 << 4,
+	CLIP_FAR = 1 << 5,
+	CLIP_GUARD_LEFT = 1 << 6,
+	CLIP_GUARD_RIGHT = 1 << 7,
+	CLIP_GUARD_BOTTOM = 1 << 8,
+	CLIP_GUARD_TOP = 1 << 9,
 	
-	/* TODO: remove check if clipping for lines and polygons works */
-	if (x > 0 && y > 0 && x < width && y < height) {
-		const size_t index = (x + y * width) * backBuffer->bytesPerPixel;
-		backBuffer->memory[index] = color->b;
-		backBuffer->memory[index + 1] = color->g;
-		backBuffer->memory[index + 2] = color->r;
-		backBuffer->memory[index + 3] = color->a; 
+	/* Outside the view volume, used for trivial rejects */
+	CLIP_FRUSTUM = CLIP_LEFT | CLIP_RIGHT | CLIP_BOTTOM | CLIP_TOP | CLIP_NEAR | CLIP_FAR,
+	/* Planes that are actually clipped against */
+	CLIP_PLANES = CLIP_NEAR | CLIP_GUARD_LEFT | CLIP_GUARD_RIGHT | CLIP_GUARD_BOTTOM | CLIP_GUARD_TOP
+};
+
+typedef struct ClipVertex
+{
+	Vec4 position;
+	float varyings[TQ_SW_MAX_VARYINGS];
+} ClipVertex;
+
+/* Guard band as a multiple of w in clip space */
+typedef struct GuardBand
+{
+	float x;
+	float y;
+} GuardBand;
+
+static GuardBand CreateGuardBand(const BackBuffer* const backBuffer)
+{
+	/* screen x = halfWidth * x / w + halfWidth, which is -TQ_SW_GUARD_BAND at x = -gx * w */
+	const float halfWidth = 0.5f * backBuffer->width;
+	const float halfHeight = 0.5f * backBuffer->height;
+	
+	GuardBand result;
+	result.x = (TQ_SW_GUARD_BAND + halfWidth) / halfWidth;
+	result.y = (TQ_SW_GUARD_BAND + halfHeight) / halfHeight;
+	return result;
+}
+
+static u32 ComputeClipCode(const Vec4* const p, const GuardBand* const guardBand)
+{
+	u32 code = 0;
+	
+	if (p->x < -p->w) code |= CLIP_LEFT;
+	if (p->x > p->w) code |= CLIP_RIGHT;
+	if (p->y < -p->w) code |= CLIP_BOTTOM;
+	if (p->y > p->w) code |= CLIP_TOP;
+	if (p->z < -p->w) code |= CLIP_NEAR;
+	if (p->z > p->w) code |= CLIP_FAR;
+	if (p->x < -guardBand->x * p->w) code |= CLIP_GUARD_LEFT;
+	if (p->x > guardBand->x * p->w) code |= CLIP_GUARD_RIGHT;
+	if (p->y < -guardBand->y * p->w) code |= CLIP_GUARD_BOTTOM;
+	if (p->y > guardBand->y * p->w) code |= CLIP_GUARD_TOP;
+	
+	return code;
+}
+
+/* Signed distance to a clip plane, >= 0 is inside */
+static float GetClipDistance(const Vec4* const p, u32 plane, const GuardBand* const guardBand)
+{
+	switch (plane) {
+		case CLIP_NEAR: return p->z + p->w;
+		case CLIP_GUARD_LEFT: return p->x + guardBand->x * p->w;
+		case CLIP_GUARD_RIGHT: return guardBand->x * p->w - p->x;
+		case CLIP_GUARD_BOTTOM: return p->y + guardBand->y * p->w;
+		case CLIP_GUARD_TOP: return guardBand->y * p->w - p->y;
+		default: return 0.0f;
 	}
 }
 
-/*	Currently drawing with Digital Differential Analyzer (DDA)
- *	TODO: Change to Bresenham's line drawing algorithm
- */
-void DrawLine(Renderer* renderer, int x0, int y0, int x1, int y1, const Color* const color)
+/* Varyings are linear in clip space, so they are interpolated like the position */
+static ClipVertex LerpClipVertex(const ClipVertex* const a, const ClipVertex* const b, float t,
+	int numVaryings)
+{
+	ClipVertex result;
+	for (int i = 0; i < 4; i++) {
+		result.position.values[i] = a->position.values[i] 
+			+ t * (b->position.values[i] - a->position.values[i]);
+	}
+	for (int i = 0; i < numVaryings; i++) {
+		result.varyings[i] = a->varyings[i] + t * (b->varyings[i] - a->varyings[i]);
+	}
+	return result;
+}
+
+/*	Sutherland-Hodgman: clips the polygon in against the planes in clipCode.
+ *	Returns the number of vertices in out, which is < 3 when nothing is left. */
+static int ClipPolygon(const ClipVertex* in, int numVertices, int numVaryings, u32 clipCode,
+	const GuardBand* const guardBand, ClipVertex* out)
 {
-	float m = (y1 - y0) / (float) (x1 - x0);
+	ClipVertex buffers[2][TQ_SW_MAX_CLIP_VERTICES];
+	const ClipVertex* source = in;
+	int current = 0;
 	
-	if (x0 <= x1) {
-		if (m > 1.0f) {
-		    m = 1.0f / m;
-		    float x = (float) x0;
-		    for (int y = y0; y <= y1; y++, x += m)
-		        DrawPixel(renderer, (int) floor(x + 0.5f), y, color);
+	for (u32 plane = CLIP_NEAR; plane <= CLIP_GUARD_TOP; plane <<= 1) {
+		if (!(clipCode & plane & CLIP_PLANES)) {
+			continue;
+		}
 		
-		} else if (m < -1.0f) {
-		    m = 1.0f / m;
-		    float x = (float) x0;
-		    for (int y = y0; y >= y1; y--, x -= m)
-		        DrawPixel(renderer, (int) floor(x - 0.5f), y, color);
+		ClipVertex* destination = buffers[current];
+		int numClipped = 0;
 		
-		} else {
-		    float y = (float) y0;
-		    for (int x = x0; x <= x1; x++, y += m)
-		        DrawPixel(renderer, x, (int) floor(y + 0.5f), color);
+		for (int i = 0; i < numVertices; i++) {
+			const ClipVertex* const a = &source[i];
+			const ClipVertex* const b = &source[(i + 1) % numVertices];
+			const float da = GetClipDistance(&a->position, plane, guardBand);
+			const float db = GetClipDistance(&b->position, plane, guardBand);
+			
+			if (da >= 0.0f) {
+				destination[numClipped++] = *a;
+			}
+			if ((da >= 0.0f) != (db >= 0.0f)) {
+				destination[numClipped++] = LerpClipVertex(a, b, da / (da - db), numVaryings);
+			}
 		}
 		
-	} else {
-		if (m > 1.0f) {
-		    m = 1.0f / m;
-		    float x = (float) x0;
-		    for (int y = y0; y >= y1; y--, x -= m)
-		        DrawPixel(renderer, (int) floor(x - 0.5f), y, color);
-		
-		} else if (m < -1.0f) {
-		    m = 1.0f / m;
-		    float x = (float) x0;
-		    for (int y = y0; y <= y1; y++, x += m)
-		        DrawPixel(renderer, (int) floor(x + 0.5f), y, color);
+		source = destination;
+		numVertices = numClipped;
+		current = 1 - current;
 		
-		} else {
-		    float y = (float) y1;
-		    for (int x = x1; x <= x0; x++, y += m)
-		        DrawPixel(renderer, x, (int) floor(y + 0.5), color);    
+		if (numVertices < 3) {
+			return 0;
 		}
 	}
+	
+	for (int i = 0; i < numVertices; i++) {
+		out[i] = source[i];
+	}
+	return numVertices;
+}
+
+/* 1a) Perspective divide and 1b) viewport transform */
+static void ProjectVertex(const Vec4* const clip, const Matrix4x4* const viewport, 
+	TransformedVertex* vertex)
+{
+	Vec4 ndc = PerspectiveDivide(*clip);
+	ndc.w = 1.0f;	/* PerspectiveDivide keeps w, the viewport transform needs a point */
+	const Vec4 screen = (*viewport) * ndc;
+	vertex->x = (int) floor(screen.x * TQ_SW_SUBPIXEL_ONE + 0.5f);
+	vertex->y = (int) floor(screen.y * TQ_SW_SUBPIXEL_ONE + 0.5f);
+	vertex->z = 0.5f * screen.z + 0.5f;
+	vertex->invW = 1.0f / clip->w;
+}
+
+static void SubmitTriangle(Renderer* renderer, const Rect* drawable, 
+	const TriangleCommand* const triangle)
+{
+	if (renderer->isTrackingDirtyRects) {
+		const Rect bounds = GetTriangleCommandBounds(renderer, triangle, drawable);
+		MarkDirtyRect(renderer, &bounds);
+	}
+	
+	if (renderer->workQueue) {
+		BinTriangle(renderer, triangle);
+		return;
+	}
+	
+	Rect clips[TQ_SW_MAX_DIRTY_RECTS];
+	const int numClips = GetClipRects(renderer, drawable, clips);
+	for (int i = 0; i < numClips; i++) {
+		RasterizeTriangle(renderer, renderer->scanBuffer, &clips[i], triangle);
+	}
 }
 
-/* TODO: make this working for every slope */
-void DrawLineBresenham(Renderer* renderer, int x0, int y0, int x1, int y1, const Color* const color)
+/*	Room for the varyings of one more shaded triangle. Binned triangles keep
+ *	theirs until the tiles are discarded, otherwise the triangle is rasterized
+ *	right away and the next one reuses the slot. */
+static int AddTriangleVaryings(Renderer* renderer)
 {
-	const int dy = y1 - y0;
-	const int dx = x1 - x0;
-	const int incrE = 2 * dy;
-	const int incrNE = 2 * (dy - dx);
-	int d = incrE - dx;
-	int y = y0;
-	int x = x0;	
+	if (!renderer->workQueue) {
+		renderer->numTriangleVaryings = 0;
+	}
 	
-	DrawPixel(renderer, x, y, color);
+	if (renderer->numTriangleVaryings == renderer->maxTriangleVaryings) {
+		renderer->maxTriangleVaryings = (renderer->maxTriangleVaryings > 0) ? 2 * renderer->maxTriangleVaryings : 256;
+		renderer->triangleVaryings = (TriangleVaryings*) realloc(renderer->triangleVaryings,
+			sizeof(TriangleVaryings) * renderer->maxTriangleVaryings);
+	}
+	return renderer->numTriangleVaryings++;
+}
+
+/*	shading is NULL for flat triangles. Otherwise the triangle gets varyings
+ *	with the numVaryings, texture and shader of shading, the rest of it isn't read. */
+static void SubmitTransformedTriangle(Renderer* renderer, const Rect* drawable,
+	const TransformedVertex* const v1, const TransformedVertex* const v2, 
+	const TransformedVertex* const v3, 
+	const float* varyings1, const float* varyings2, const float* varyings3,
+	const TriangleVaryings* const shading, TriangleCommand* triangle)
+{
+	triangle->v1x = v1->x;
+	triangle->v1y = v1->y;
+	triangle->v2x = v2->x;
+	triangle->v2y = v2->y;
+	triangle->v3x = v3->x;
+	triangle->v3y = v3->y;
+	triangle->z1 = v1->z;
+	triangle->z2 = v2->z;
+	triangle->z3 = v3->z;
+	triangle->varyings = TQ_SW_FLAT;
 	
-	while (x < x1) {
-		if (d <= 0) {
-			d += incrE;
-		} else {
-			d += incrNE;
-			y++;
-		}
-		x++;
-		DrawPixel(renderer, x, y, color);
+	if (shading) {
+		triangle->varyings = AddTriangleVaryings(renderer);
+		TriangleVaryings* varyings = &renderer->triangleVaryings[triangle->varyings];
+		varyings->invW[0] = v1->invW;
+		varyings->invW[1] = v2->invW;
+		varyings->invW[2] = v3->invW;
+		varyings->numVaryings = shading->numVaryings;
+		varyings->texture = shading->texture;
+		varyings->shader = shading->shader;
+		
+		const size_t size = sizeof(float) * shading->numVaryings;
+		memcpy(varyings->values[0], varyings1, size);
+		memcpy(varyings->values[1], varyings2, size);
+		memcpy(varyings->values[2], varyings3, size);
 	}
+	
+	SubmitTriangle(renderer, drawable, triangle);
 }
 
-void ScanConvertLine(Renderer* renderer, int x0, int y0, int x1, int y1, int isMaxSide)
+/* Clips, then triangulates the remaining polygon as a fan */
+static void SubmitClippedTriangle(Renderer* renderer, const Rect* drawable,
+	const TransformedVertex* const v1, const TransformedVertex* const v2, 
+	const TransformedVertex* const v3, 
+	const float* varyings1, const float* varyings2, const float* varyings3, u32 clipCode,
+	const GuardBand* const guardBand, const Matrix4x4* const viewport,
+	const TriangleVaryings* const shading, TriangleCommand* triangle)
 {
-	const int dx = x1 - x0;
-	const int dy = y1 - y0;
+	const int numVaryings = shading ? shading->numVaryings : 0;
+	const size_t size = sizeof(float) * numVaryings;
 	
-	if (dy <= 0) {
-		return;
+	ClipVertex polygon[3];
+	polygon[0].position = v1->clip;
+	polygon[1].position = v2->clip;
+	polygon[2].position = v3->clip;
+	if (numVaryings > 0) {
+		memcpy(polygon[0].varyings, varyings1, size);
+		memcpy(polygon[1].varyings, varyings2, size);
+		memcpy(polygon[2].varyings, varyings3, size);
 	}
 	
-	const float m = (float) dx / dy;
-	float x = (float) x0;
+	ClipVertex clipped[TQ_SW_MAX_CLIP_VERTICES];
+	const int numVertices = ClipPolygon(polygon, 3, numVaryings, clipCode, guardBand, clipped);
+	
+	TransformedVertex projected[TQ_SW_MAX_CLIP_VERTICES];
+	for (int i = 0; i < numVertices; i++) {
+		ProjectVertex(&clipped[i].position, viewport, &projected[i]);
+	}
 	
-	for (int y = y0; y < y1; y++) {
-		renderer->scanBuffer[y * 2 + isMaxSide] = (int) x;
-		x += m;
+	for (int i = 1; i + 1 < numVertices; i++) {
+		SubmitTransformedTriangle(renderer, drawable, 
+			&projected[0], &projected[i], &projected[i + 1], 
+			clipped[0].varyings, clipped[i].varyings, clipped[i + 1].varyings, shading, triangle);
 	}
 }
 
-/* TODO: Optimize for parallellisation */
-void DrawTriangle(Renderer* renderer, int v1x, int v1y,
+/*	Twice the signed screen space area of a triangle that doesn't need clipping.
+ *	Inside the guard band 28.4 coordinates have less than 20 bits, so the products
+ *	fit in the mantissa of a double and the area is exact. Front faces are negative, 
+ *	the viewport flips y. */
+inline double GetTriangleArea(const TransformedVertex* const v1, 
+	const TransformedVertex* const v2, const TransformedVertex* const v3)
+{
+	return (double) (v2->x - v1->x) * (v3->y - v1->y) - (double) (v2->y - v1->y) * (v3->x - v1->x);
+}
+
+/*	Same sign as GetTriangleArea, for triangles that need clipping: the 
+ *	determinant of the homogeneous x, y and w is the orientation seen from 
+ *	the eye, also with vertices behind it. */
+inline double GetHomogeneousArea(const TransformedVertex* const v1, 
+	const TransformedVertex* const v2, const TransformedVertex* const v3)
+{
+	const Vec4* const a = &v1->clip;
+	const Vec4* const b = &v2->clip;
+	const Vec4* const c = &v3->clip;
+	return -((double) a->x * ((double) b->y * c->w - (double) b->w * c->y)
+		- (double) a->y * ((double) b->x * c->w - (double) b->w * c->x)
+		+ (double) a->w * ((double) b->x * c->y - (double) b->y * c->x));
+}
+
+/* area is GetTriangleArea for triangles that don't need clipping */
+static bool IsTriangleVisible(CullStats* stats, CullMode mode, const TransformedVertex* const v1, 
+	const TransformedVertex* const v2, const TransformedVertex* const v3, double area)
+{
+	/* Trivial reject: all vertices outside the same frustum plane */
+	if (v1->clipCode & v2->clipCode & v3->clipCode & CLIP_FRUSTUM) {
+		stats->numFrustumCulled++;
+		return false;
+	}
+	
+	if ((v1->clipCode | v2->clipCode | v3->clipCode) & CLIP_PLANES) {
+		area = GetHomogeneousArea(v1, v2, v3);
+	}
+	
+	if (area == 0.0) {
+		stats->numDegenerateCulled++;
+		return false;
+	}
+	if ((mode == RENDERER_CULL_BACK && area > 0.0) || (mode == RENDERER_CULL_FRONT && area < 0.0)) {
+		stats->numBackFaceCulled++;
+		return false;
+	}
+	return true;
+}
+
+/*	Culls the triangles of a batch with numVertices transformed vertices and 
+ *	writes the offset of the first index of every visible one to 
+ *	renderer->visibleTriangles, in order. Returns the number of visible triangles. */
+static int CullTriangles(Renderer* renderer, int numVertices, const u32* indices, int numIndices)
+{
+	const TransformedVertex* const vertices = renderer->vertices;
+	const int numTriangles = numIndices / 3;
+	CullStats* stats = &renderer->cullStats;
+	stats->numTriangles += numTriangles;
+	
+	u32 batchClipCode = ~0u;
+	for (int i = 0; i < numVertices; i++) {
+		batchClipCode &= vertices[i].clipCode;
+	}
+	if (numVertices > 0 && (batchClipCode & CLIP_FRUSTUM)) {
+		stats->numFrustumCulled += numTriangles;
+		return 0;
+	}
+	
+	if (numTriangles > renderer->maxVisibleTriangles) {
+		free(renderer->visibleTriangles);
+		renderer->maxVisibleTriangles = numTriangles;
+		renderer->visibleTriangles = (u32*) malloc(sizeof(u32) * numTriangles);
+	}
+	
+	u32* visible = renderer->visibleTriangles;
+	const CullMode mode = renderer->cullMode;
+	int numVisible = 0;
+	for (int i = 0; i + 3 <= 3 * numTriangles; i += 3) {
+		const TransformedVertex* const v1 = &vertices[indices[i]];
+		const TransformedVertex* const v2 = &vertices[indices[i + 1]];
+		const TransformedVertex* const v3 = &vertices[indices[i + 2]];
+		if (IsTriangleVisible(stats, mode, v1, v2, v3, GetTriangleArea(v1, v2, v3))) {
+			visible[numVisible++] = (u32) i;
+		}
+	}
+	
+	return numVisible;
+}
+
+/*	Returns true (and counts numTriangles as culled) when the sphere around a mesh
+ *	is completely outside the frustum of transform (model-view-projection), so the
+ *	mesh can be skipped before its vertices are transformed. center and radius are
+ *	in model space. Meshes that pass are counted by the draw that follows. */
+bool CullBoundingSphere(Renderer* renderer, const Matrix4x4* transform, 
+	const Vec3* center, float radius, int numTriangles)
+{
+	const Matrix4x4* const m = transform;
+	
+	/*	The planes are w + x, w - x, w + y, w - y, w + z and w - z of clip space, 
+	 *	which are rows of the matrix in model space. Normalized, the plane 
+	 *	equation is the distance to the plane. */
+	const float planes[6][4] = {
+		{ m->a41 + m->a11, m->a42 + m->a12, m->a43 + m->a13, m->a44 + m->a14 },
+		{ m->a41 - m->a11, m->a42 - m->a12, m->a43 - m->a13, m->a44 - m->a14 },
+		{ m->a41 + m->a21, m->a42 + m->a22, m->a43 + m->a23, m->a44 + m->a24 },
+		{ m->a41 - m->a21, m->a42 - m->a22, m->a43 - m->a23, m->a44 - m->a24 },
+		{ m->a41 + m->a31, m->a42 + m->a32, m->a43 + m->a33, m->a44 + m->a34 },
+		{ m->a41 - m->a31, m->a42 - m->a32, m->a43 - m->a33, m->a44 - m->a34 }
+	};
+	
+	for (int i = 0; i < 6; i++) {
+		const float* const p = planes[i];
+		const float distance = p[0] * center->x + p[1] * center->y + p[2] * center->z + p[3];
+		const float length = sqrtf(p[0] * p[0] + p[1] * p[1] + p[2] * p[2]);
+		if (distance < -radius * length) {
+			renderer->cullStats.numTriangles += numTriangles;
+			renderer->cullStats.numFrustumCulled += numTriangles;
+			return true;
+		}
+	}
+	
+	return false;
+}
+
+/*	Screen space triangle in 28.4 fixed point (pixels * TQ_SW_SUBPIXEL_ONE),
+ *	coordinates have to be inside the guard band:
+ *	[-TQ_SW_GUARD_BAND, width + TQ_SW_GUARD_BAND] pixels */
+void DrawTriangleSubpixel(Renderer* renderer, int v1x, int v1y,
 	int v2x, int v2y, 
 	int v3x, int v3y,
 	const Color* const color)
 {	
-	/* 1) Preprocessing: Convert triangle to scan-buffer-friendly triangle */
-	/* 1a) Perspective divide */
+	TriangleCommand triangle;
+	triangle.v1x = v1x;
+	triangle.v1y = v1y;
+	triangle.v2x = v2x;
+	triangle.v2y = v2y;
+	triangle.v3x = v3x;
+	triangle.v3y = v3y;
+	triangle.z1 = 0.0f;
+	triangle.z2 = 0.0f;
+	triangle.z3 = 0.0f;
+	triangle.color = *color;
+	triangle.blendMode = renderer->blendMode;
+	triangle.isDepthTested = false;
+	triangle.varyings = TQ_SW_FLAT;
 	
-	/* 1b) Viewport transform */
+	const Rect drawable = GetDrawableRect(&renderer->backBuffer);
+	SubmitTriangle(renderer, &drawable, &triangle);
+}
+
+/*	Screen space triangle with whole pixel coordinates, which are the pixel corners:
+ *	(0, 0), (w, 0), (w, h) and (0, h) cover the w x h pixels at the origin exactly. */
+void DrawTriangle(Renderer* renderer, int v1x, int v1y,
+	int v2x, int v2y, 
+	int v3x, int v3y,
+	const Color* const color)
+{
+	DrawTriangleSubpixel(renderer, 
+		v1x * TQ_SW_SUBPIXEL_ONE, v1y * TQ_SW_SUBPIXEL_ONE,
+		v2x * TQ_SW_SUBPIXEL_ONE, v2y * TQ_SW_SUBPIXEL_ONE,
+		v3x * TQ_SW_SUBPIXEL_ONE, v3y * TQ_SW_SUBPIXEL_ONE,
+		color);
+}
+
+static void ReserveVertices(Renderer* renderer, int numVertices)
+{
+	if (numVertices > renderer->maxVertices) {
+		free(renderer->vertices);
+		free(renderer->varyings);
+		renderer->maxVertices = numVertices;
+		renderer->vertices = (TransformedVertex*) malloc(sizeof(TransformedVertex) * numVertices);
+		renderer->varyings = (float*) malloc(sizeof(float) * TQ_SW_MAX_VARYINGS * numVertices);
+	}
+}
+
+/* Classifies vertex->clip against the frustum and guard band */
+static void SetupVertex(TransformedVertex* vertex, 
+	const Matrix4x4* const viewport, const GuardBand* const guardBand)
+{
+	vertex->clipCode = ComputeClipCode(&vertex->clip, guardBand);
 	
-	/* 1c) Bubble sort vertices by y-coordinate in increasing order */
-	if (v1y > v2y) {
-		/* swap v1 v2 */
-		int temp = v1x;
-		v1x = v2x;
-		v2x = temp;
-		temp = v1y;
-		v1y = v2y;
-		v2y = temp;
-	}	
-	if (v2y > v3y) {
-		/* swap v2 v3 */
-		int temp = v2x;
-		v2x = v3x;
-		v3x = temp;
-		temp = v2y;
-		v2y = v3y;
-		v3y = temp;
+	/* Vertices which need clipping are projected after clipping */
+	if (!(vertex->clipCode & CLIP_PLANES)) {
+		ProjectVertex(&vertex->clip, viewport, vertex);
 	}
-	if (v1y > v2y) {
-		/* swap v1 v2 */
-		int temp = v1x;
-		v1x = v2x;
-		v2x = temp;
-		temp = v1y;
-		v1y = v2y;
-		v2y = temp;
+}
+
+/*	Transforms every position by transform (model-view-projection) exactly once,
+ *	into renderer->vertices. */
+/* Positions transformed at once by TransformVertices, see Transform of math.h */
+#define TQ_SW_VERTEX_BATCH 64
+
+static void TransformVertices(Renderer* renderer, const Matrix4x4* transform,
+	const Vec4* positions, int numPositions, 
+	const Matrix4x4* const viewport, const GuardBand* const guardBand)
+{
+	ReserveVertices(renderer, numPositions);
+	TransformedVertex* vertices = renderer->vertices;
+	
+	/* Transform writes packed Vec4s, the vertices aren't */
+	Vec4 clips[TQ_SW_VERTEX_BATCH];
+	for (int first = 0; first < numPositions; first += TQ_SW_VERTEX_BATCH) {
+		const int count = MinInt(numPositions - first, TQ_SW_VERTEX_BATCH);
+		Transform(*transform, positions + first, clips, count);
+		for (int i = 0; i < count; i++) {
+			TransformedVertex* vertex = &vertices[first + i];
+			vertex->clip = clips[i];
+			SetupVertex(vertex, viewport, guardBand);
+		}
 	}
+}
+
+/*	Draws an indexed triangle list in one pass:
+ *	every position is transformed by transform (model-view-projection) exactly once,
+ *	then each group of 3 indices is clipped and rasterized (or binned when tiled). */
+void DrawTriangles(Renderer* renderer, const Matrix4x4* transform,
+	const Vec4* positions, int numPositions,
+	const u32* indices, int numIndices,
+	const Color* const color)
+{
+	const BackBuffer* const backBuffer = &renderer->backBuffer;
+	const Matrix4x4 viewport = ViewportMatrix4x4(0, 0, backBuffer->width, backBuffer->height);
+	const GuardBand guardBand = CreateGuardBand(backBuffer);
+	TransformVertices(renderer, transform, positions, numPositions, &viewport, &guardBand);
 	
-	/* 1d) Determine handedness by area of parallellogram
-	 *		Area: 2D cross product */
-	int area = (v3x - v1x) * (v2y - v1y) - (v3y - v1y) * (v2x - v1x);
-	int handedness = (area >= 0) 
-		? 1		/* v1v2 is to the right of v1v3 */
-		: 0;	/* v1v2 is to the left of v1v3 */
+	const TransformedVertex* const vertices = renderer->vertices;
+	const Rect drawable = GetDrawableRect(backBuffer);
+	TriangleCommand triangle;
+	triangle.color = *color;
+	triangle.blendMode = renderer->blendMode;
+	triangle.isDepthTested = true;
 	
-	/* 2) Fill scan buffer
-	 *		First define min side for scanbuffer
-	 *		Next define the two max sides for scanbuffer */
-	ScanConvertLine(renderer, v1x, v1y, v3x, v3y, handedness);
-	ScanConvertLine(renderer, v1x, v1y, v2x, v2y, 1 - handedness);
-	ScanConvertLine(renderer, v2x, v2y, v3x, v3y, 1 - handedness);
+	const int numVisible = CullTriangles(renderer, numPositions, indices, numIndices);
+	const u32* const visible = renderer->visibleTriangles;
 	
-	/* 3)	Read scan buffer and draw to back buffer */
-	int* scanBuffer = renderer->scanBuffer;
-	int yMin = v1y; 
-	int yMax = v3y;	
+	for (int j = 0; j < numVisible; j++) {
+		const u32 i = visible[j];
+		const TransformedVertex* const v1 = &vertices[indices[i]];
+		const TransformedVertex* const v2 = &vertices[indices[i + 1]];
+		const TransformedVertex* const v3 = &vertices[indices[i + 2]];
+		
+		const u32 clipCode = v1->clipCode | v2->clipCode | v3->clipCode;
+		if (clipCode & CLIP_PLANES) {
+			SubmitClippedTriangle(renderer, &drawable, v1, v2, v3, NULL, NULL, NULL, clipCode, 
+				&guardBand, &viewport, NULL, &triangle);
+		} else {
+			SubmitTransformedTriangle(renderer, &drawable, v1, v2, v3, NULL, NULL, NULL, NULL, &triangle);
+		}
+	}
+}
+
+/* Per vertex attributes of DrawShadedTriangles, all optional */
+typedef struct VertexAttributes
+{
+	const Vec4* colors;	/* rgba in [0, 1], white when NULL */
+	const Vec2* uvs;	/* (0, 0) when NULL */
+	const Vec3* normals;
+} VertexAttributes;
+
+/* Returns the number of varyings */
+static int GatherVaryings(const VertexAttributes* const attributes, u32 index, float* varyings)
+{
+	for (int i = 0; i < 4; i++) {
+		varyings[VARYING_COLOR + i] = attributes->colors ? attributes->colors[index].values[i] : 1.0f;
+	}
+	for (int i = 0; i < 2; i++) {
+		varyings[VARYING_UV + i] = attributes->uvs ? attributes->uvs[index].values[i] : 0.0f;
+	}
+	if (!attributes->normals) {
+		return VARYING_NORMAL;
+	}
+	for (int i = 0; i < 3; i++) {
+		varyings[VARYING_NORMAL + i] = attributes->normals[index].values[i];
+	}
+	return VARYING_NORMAL + 3;
+}
+
+/*	DrawTriangles with perspective-correct per vertex attributes: every pixel gets
+ *	the interpolated color, modulated by a bilinear sample of texture (optional)
+ *	at the interpolated uv. Normals are interpolated along for shading. 
+ *	Always rasterized by the half-space rasterizer. */
+void DrawShadedTriangles(Renderer* renderer, const Matrix4x4* transform,
+	const Vec4* positions, const VertexAttributes* attributes, int numPositions,
+	const u32* indices, int numIndices,
+	const Texture* texture)
+{
+	const BackBuffer* const backBuffer = &renderer->backBuffer;
+	const Matrix4x4 viewport = ViewportMatrix4x4(0, 0, backBuffer->width, backBuffer->height);
+	const GuardBand guardBand = CreateGuardBand(backBuffer);
+	TransformVertices(renderer, transform, positions, numPositions, &viewport, &guardBand);
 	
-	for (int j = yMin; j < yMax; j++) {			
-		const size_t minIndex = j * 2;
-		const size_t maxIndex = minIndex + 1;
-		const int xMin = scanBuffer[minIndex];
-		const int xMax = scanBuffer[maxIndex];
-				
-		for (int i = xMin; i < xMax; i++) {
-			DrawPixel(renderer, i, j, color);
-		}	
+	const TransformedVertex* const vertices = renderer->vertices;
+	const Rect drawable = GetDrawableRect(backBuffer);
+	TriangleCommand triangle;
+	triangle.color.r = 255;
+	triangle.color.g = 255;
+	triangle.color.b = 255;
+	triangle.color.a = 255;
+	triangle.blendMode = renderer->blendMode;
+	triangle.isDepthTested = true;
+	
+	TriangleVaryings shading;
+	shading.texture = (texture && texture->numLevels > 0) ? texture : NULL;
+	shading.shader = NULL;
+	float varyings[3][TQ_SW_MAX_VARYINGS];
+	
+	const int numVisible = CullTriangles(renderer, numPositions, indices, numIndices);
+	const u32* const visible = renderer->visibleTriangles;
+	
+	for (int j = 0; j < numVisible; j++) {
+		const u32 i = visible[j];
+		const TransformedVertex* const v1 = &vertices[indices[i]];
+		const TransformedVertex* const v2 = &vertices[indices[i + 1]];
+		const TransformedVertex* const v3 = &vertices[indices[i + 2]];
+		
+		shading.numVaryings = GatherVaryings(attributes, indices[i], varyings[0]);
+		GatherVaryings(attributes, indices[i + 1], varyings[1]);
+		GatherVaryings(attributes, indices[i + 2], varyings[2]);
+		
+		const u32 clipCode = v1->clipCode | v2->clipCode | v3->clipCode;
+		if (clipCode & CLIP_PLANES) {
+			SubmitClippedTriangle(renderer, &drawable, v1, v2, v3, 
+				varyings[0], varyings[1], varyings[2], clipCode, 
+				&guardBand, &viewport, &shading, &triangle);
+		} else {
+			SubmitTransformedTriangle(renderer, &drawable, v1, v2, v3, 
+				varyings[0], varyings[1], varyings[2], &shading, &triangle);
+		}
+	}
+}
+
+/*	Draws an indexed triangle list with a programmable shader (see Shaders):
+ *	the vertex shader runs exactly once for every vertex in [0, numVertices),
+ *	then each group of 3 indices is clipped and rasterized by the half-space
+ *	rasterizer, calling the fragment shader per span. When tiled, shader and
+ *	its uniforms are read until FlushRenderer. */
+void DrawTrianglesWithShader(Renderer* renderer, const Shader* shader, int numVertices,
+	const u32* indices, int numIndices)
+{
+	const BackBuffer* const backBuffer = &renderer->backBuffer;
+	const Matrix4x4 viewport = ViewportMatrix4x4(0, 0, backBuffer->width, backBuffer->height);
+	const GuardBand guardBand = CreateGuardBand(backBuffer);
+	ReserveVertices(renderer, numVertices);
+	
+	TransformedVertex* const vertices = renderer->vertices;
+	float* const varyings = renderer->varyings;
+	for (int i = 0; i < numVertices; i++) {
+		vertices[i].clip = shader->vertex(shader->uniforms, (u32) i, varyings + i * TQ_SW_MAX_VARYINGS);
+		SetupVertex(&vertices[i], &viewport, &guardBand);
+	}
+	
+	const Rect drawable = GetDrawableRect(backBuffer);
+	TriangleCommand triangle;
+	triangle.color.r = 255;
+	triangle.color.g = 255;
+	triangle.color.b = 255;
+	triangle.color.a = 255;
+	triangle.blendMode = renderer->blendMode;
+	triangle.isDepthTested = true;
+	
+	TriangleVaryings shading;
+	shading.numVaryings = shader->numVaryings;
+	shading.texture = NULL;
+	shading.shader = shader;
+	
+	const int numVisible = CullTriangles(renderer, numVertices, indices, numIndices);
+	const u32* const visible = renderer->visibleTriangles;
+	
+	for (int j = 0; j < numVisible; j++) {
+		const u32 i = visible[j];
+		const TransformedVertex* const v1 = &vertices[indices[i]];
+		const TransformedVertex* const v2 = &vertices[indices[i + 1]];
+		const TransformedVertex* const v3 = &vertices[indices[i + 2]];
+		
+		const float* const varyings1 = varyings + indices[i] * TQ_SW_MAX_VARYINGS;
+		const float* const varyings2 = varyings + indices[i + 1] * TQ_SW_MAX_VARYINGS;
+		const float* const varyings3 = varyings + indices[i + 2] * TQ_SW_MAX_VARYINGS;
+		
+		const u32 clipCode = v1->clipCode | v2->clipCode | v3->clipCode;
+		if (clipCode & CLIP_PLANES) {
+			SubmitClippedTriangle(renderer, &drawable, v1, v2, v3, 
+				varyings1, varyings2, varyings3, clipCode, 
+				&guardBand, &viewport, &shading, &triangle);
+		} else {
+			SubmitTransformedTriangle(renderer, &drawable, v1, v2, v3, 
+				varyings1, varyings2, varyings3, &shading, &triangle);
+		}
 	}
-}
\ No newline at end of file
+}
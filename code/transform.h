@@ -0,0 +1,225 @@
+#pragma once
+
+/*	Transform hierarchy.
+ *	The local position, rotation and scale of every node live in flat arrays,
+ *	sorted depth-first: a parent comes before its children, and the subtree of
+ *	node i is the range [i, subtreeEnds[i]). One pass in index order then sees
+ *	the world matrix of a parent before any of its children need it, without
+ *	recursion and without walking up to the root for every node.
+ *
+ *	Changing a local transform marks its node dirty. UpdateTransforms only
+ *	recomputes the world matrices of dirty nodes and of everything below them.
+ *	Subtrees don't depend on each other, so with a work queue runs of whole
+ *	subtrees are updated in parallel.
+ *
+ *	Reference:
+ *	Bitsquid, "Building a Data-Oriented Entity System" (the transform component)
+ */
+
+#define TQ_TRANSFORM_NO_PARENT -1
+/* Nodes per work queue entry: big enough to hide the cost of the entry */
+#define TQ_TRANSFORM_JOB_SIZE 1024
+
+struct TransformHierarchy;
+
+typedef struct TransformJob
+{
+	struct TransformHierarchy* hierarchy;
+	int begin;
+	int end;
+} TransformJob;
+
+typedef struct TransformHierarchy
+{
+	Vec3* positions;	/* local */
+	Quaternion* rotations;	/* local */
+	Vec3* scales;	/* local */
+	int* parents;	/* TQ_TRANSFORM_NO_PARENT for a root */
+	int* subtreeEnds;	/* one past the last node below i */
+	bool* dirty;
+	Matrix4x4* worlds;
+	TransformJob* jobs;	/* at most one per node */
+	int count;
+	int capacity;
+} TransformHierarchy;
+
+TransformHierarchy CreateTransformHierarchy(int capacity)
+{
+	TransformHierarchy result;
+	result.positions = (Vec3*) malloc(sizeof(Vec3) * capacity);
+	result.rotations = (Quaternion*) malloc(sizeof(Quaternion) * capacity);
+	result.scales = (Vec3*) malloc(sizeof(Vec3) * capacity);
+	result.parents = (int*) malloc(sizeof(int) * capacity);
+	result.subtreeEnds = (int*) malloc(sizeof(int) * capacity);
+	result.dirty = (bool*) calloc(capacity, sizeof(bool));
+	result.worlds = (Matrix4x4*) malloc(sizeof(Matrix4x4) * capacity);
+	result.jobs = (TransformJob*) malloc(sizeof(TransformJob) * capacity);
+	result.count = 0;
+	result.capacity = capacity;
+	return result;
+}
+
+void DestroyTransformHierarchy(TransformHierarchy* hierarchy)
+{
+	free(hierarchy->positions);
+	free(hierarchy->rotations);
+	free(hierarchy->scales);
+	free(hierarchy->parents);
+	free(hierarchy->subtreeEnds);
+	free(hierarchy->dirty);
+	free(hierarchy->worlds);
+	free(hierarchy->jobs);
+	hierarchy->count = 0;
+	hierarchy->capacity = 0;
+}
+
+/*	Adds a node with the identity as local transform and returns its index, or
+ *	-1 when the hierarchy is full or parent already has a sibling subtree after
+ *	it. Add the nodes depth-first (a node, then all nodes below it, then its
+ *	next sibling), e.g. in the order of a scene file, so indices never move. */
+int AddTransform(TransformHierarchy* hierarchy, int parent)
+{
+	const int i = hierarchy->count;
+	if (i == hierarchy->capacity) {
+		return -1;
+	}
+	if (parent != TQ_TRANSFORM_NO_PARENT && hierarchy->subtreeEnds[parent] != i) {
+		return -1;
+	}
+
+	/* The subtrees of the parent and all nodes above it now end after i */
+	for (int ancestor = parent; ancestor != TQ_TRANSFORM_NO_PARENT; ancestor = hierarchy->parents[ancestor]) {
+		hierarchy->subtreeEnds[ancestor] = i + 1;
+	}
+
+	const Vec3 position = { 0.0f, 0.0f, 0.0f };
+	const Quaternion rotation = { 0.0f, 0.0f, 0.0f, 1.0f };
+	const Vec3 scale = { 1.0f, 1.0f, 1.0f };
+	hierarchy->positions[i] = position;
+	hierarchy->rotations[i] = rotation;
+	hierarchy->scales[i] = scale;
+	hierarchy->parents[i] = parent;
+	hierarchy->subtreeEnds[i] = i + 1;
+	hierarchy->dirty[i] = true;
+	hierarchy->count++;
+	return i;
+}
+
+/* Call after writing the local arrays of node i directly */
+inline void MarkTransformDirty(TransformHierarchy* hierarchy, int i)
+{
+	hierarchy->dirty[i] = true;
+}
+
+inline void SetLocalPosition(TransformHierarchy* hierarchy, int i, const Vec3* position)
+{
+	hierarchy->positions[i] = *position;
+	hierarchy->dirty[i] = true;
+}
+
+inline void SetLocalRotation(TransformHierarchy* hierarchy, int i, const Quaternion* rotation)
+{
+	hierarchy->rotations[i] = *rotation;
+	hierarchy->dirty[i] = true;
+}
+
+inline void SetLocalScale(TransformHierarchy* hierarchy, int i, const Vec3* scale)
+{
+	hierarchy->scales[i] = *scale;
+	hierarchy->dirty[i] = true;
+}
+
+/* The world matrix of the parent has to be up to date */
+static void UpdateTransform(TransformHierarchy* hierarchy, int i)
+{
+	const Matrix4x4 local = CreateMatrix4x4(hierarchy->positions[i], hierarchy->rotations[i],
+		hierarchy->scales[i]);
+	const int parent = hierarchy->parents[i];
+	if (parent == TQ_TRANSFORM_NO_PARENT) {
+		hierarchy->worlds[i] = local;
+	} else {
+		hierarchy->worlds[i] = hierarchy->worlds[parent] * local;
+	}
+	hierarchy->dirty[i] = false;
+}
+
+/*	[begin, end) is a run of whole subtrees: every dirty node in it is updated
+ *	with all nodes below it, the clean nodes in between are skipped. */
+static void UpdateDirtyTransforms(TransformHierarchy* hierarchy, int begin, int end)
+{
+	int i = begin;
+	while (i < end) {
+		const bool* next = (const bool*) memchr(&hierarchy->dirty[i], true, end - i);
+		if (!next) {
+			return;
+		}
+
+		i = (int) (next - hierarchy->dirty);
+		const int subtreeEnd = hierarchy->subtreeEnds[i];
+		for (; i < subtreeEnd; i++) {
+			UpdateTransform(hierarchy, i);
+		}
+	}
+}
+
+static void UpdateTransformsWork(void* data)
+{
+	const TransformJob* job = (const TransformJob*) data;
+	UpdateDirtyTransforms(job->hierarchy, job->begin, job->end);
+}
+
+static void AddTransformJob(TransformHierarchy* hierarchy, WorkQueue* workQueue, int begin, int end,
+	int* numJobs)
+{
+	if (begin == end) {
+		return;
+	}
+
+	TransformJob* job = &hierarchy->jobs[(*numJobs)++];
+	job->hierarchy = hierarchy;
+	job->begin = begin;
+	job->end = end;
+	AddWorkQueueEntry(workQueue, UpdateTransformsWork, job);
+}
+
+/*	Recomputes the world matrices of all dirty nodes and the nodes below them,
+ *	on this thread when workQueue is NULL. Otherwise runs of whole subtrees of
+ *	up to TQ_TRANSFORM_JOB_SIZE nodes go to the queue. A bigger subtree is
+ *	split: its root is updated here first, then its children are handed out
+ *	as subtrees of their own. */
+void UpdateTransforms(TransformHierarchy* hierarchy, WorkQueue* workQueue)
+{
+	if (!workQueue) {
+		UpdateDirtyTransforms(hierarchy, 0, hierarchy->count);
+		return;
+	}
+
+	int numJobs = 0;
+	int begin = 0;
+	int i = 0;
+	while (i < hierarchy->count) {
+		const int end = hierarchy->subtreeEnds[i];
+		if (end - i <= TQ_TRANSFORM_JOB_SIZE) {
+			if (end - begin > TQ_TRANSFORM_JOB_SIZE) {
+				AddTransformJob(hierarchy, workQueue, begin, i, &numJobs);
+				begin = i;
+			}
+			i = end;
+			continue;
+		}
+
+		/* Nothing queued so far is below i, so i can be written while the jobs run */
+		AddTransformJob(hierarchy, workQueue, begin, i, &numJobs);
+		if (hierarchy->dirty[i]) {
+			UpdateTransform(hierarchy, i);
+			for (int child = i + 1; child < end; child = hierarchy->subtreeEnds[child]) {
+				hierarchy->dirty[child] = true;
+			}
+		}
+		i++;
+		begin = i;
+	}
+	AddTransformJob(hierarchy, workQueue, begin, hierarchy->count, &numJobs);
+
+	CompleteAllWork(workQueue);
+}
@@ -0,0 +1,145 @@
+#pragma once
+
+/*	Work queue for spreading jobs over all cores.
+ *	Single producer (the main thread), multiple consumers (the worker threads).
+ *	The main thread also works on the queue while it waits in CompleteAllWork,
+ *	so a queue with 0 worker threads just runs everything serially.
+ *
+ *	Reference:
+ *	Handmade Hero, days 122-126 (multithreading)
+ */
+
+#define TQ_WORK_QUEUE_MAX_ENTRIES 1024
+#define TQ_WORK_QUEUE_MAX_THREADS 64
+
+typedef void WorkQueueCallback(void* data);
+
+typedef struct WorkQueueEntry
+{
+	WorkQueueCallback* callback;
+	void* data;
+} WorkQueueEntry;
+
+typedef struct WorkQueue
+{
+	WorkQueueEntry entries[TQ_WORK_QUEUE_MAX_ENTRIES];
+	SDL_Thread* threads[TQ_WORK_QUEUE_MAX_THREADS];
+	SDL_sem* semaphore;
+	SDL_atomic_t completionGoal;
+	SDL_atomic_t completionCount;
+	SDL_atomic_t nextEntryToWrite;
+	SDL_atomic_t nextEntryToRead;
+	SDL_atomic_t isRunning;
+	int numThreads;
+} WorkQueue;
+
+/* Returns true if there was an entry to work on */
+static bool DoNextWorkQueueEntry(WorkQueue* queue)
+{
+	const int originalNextEntryToRead = SDL_AtomicGet(&queue->nextEntryToRead);
+
+	if (originalNextEntryToRead == SDL_AtomicGet(&queue->nextEntryToWrite)) {
+		return false;
+	}
+
+	const int newNextEntryToRead = (originalNextEntryToRead + 1) % TQ_WORK_QUEUE_MAX_ENTRIES;
+	if (SDL_AtomicCAS(&queue->nextEntryToRead, originalNextEntryToRead, newNextEntryToRead)) {
+		const WorkQueueEntry entry = queue->entries[originalNextEntryToRead];
+		entry.callback(entry.data);
+		SDL_AtomicAdd(&queue->completionCount, 1);
+	}
+
+	return true;
+}
+
+static int WorkQueueThreadProc(void* data)
+{
+	WorkQueue* queue = (WorkQueue*) data;
+
+	while (SDL_AtomicGet(&queue->isRunning)) {
+		if (!DoNextWorkQueueEntry(queue)) {
+			SDL_SemWait(queue->semaphore);
+		}
+	}
+
+	return 0;
+}
+
+/*	numThreads < 0 creates one worker per logical core, minus the main thread. */
+bool CreateWorkQueue(WorkQueue* queue, int numThreads)
+{
+	if (numThreads < 0) {
+		numThreads = SDL_GetCPUCount() - 1;
+	}
+	if (numThreads > TQ_WORK_QUEUE_MAX_THREADS) {
+		numThreads = TQ_WORK_QUEUE_MAX_THREADS;
+	}
+
+	SDL_AtomicSet(&queue->completionGoal, 0);
+	SDL_AtomicSet(&queue->completionCount, 0);
+	SDL_AtomicSet(&queue->nextEntryToWrite, 0);
+	SDL_AtomicSet(&queue->nextEntryToRead, 0);
+	SDL_AtomicSet(&queue->isRunning, 1);
+	queue->numThreads = 0;
+
+	queue->semaphore = SDL_CreateSemaphore(0);
+	if (!queue->semaphore) {
+		return false;
+	}
+
+	for (int i = 0; i < numThreads; i++) {
+		queue->threads[i] = SDL_CreateThread(WorkQueueThreadProc, "TQ Worker", queue);
+		if (!queue->threads[i]) {
+			break;
+		}
+		queue->numThreads++;
+	}
+
+	return true;
+}
+
+/* Only call from the thread that adds the entries */
+void AddWorkQueueEntry(WorkQueue* queue, WorkQueueCallback* callback, void* data)
+{
+	const int nextEntryToWrite = SDL_AtomicGet(&queue->nextEntryToWrite);
+	const int newNextEntryToWrite = (nextEntryToWrite + 1) % TQ_WORK_QUEUE_MAX_ENTRIES;
+
+	/* Queue is full: help out until a slot frees up */
+	while (newNextEntryToWrite == SDL_AtomicGet(&queue->nextEntryToRead)) {
+		DoNextWorkQueueEntry(queue);
+	}
+
+	queue->entries[nextEntryToWrite].callback = callback;
+	queue->entries[nextEntryToWrite].data = data;
+	SDL_AtomicAdd(&queue->completionGoal, 1);
+
+	/* SDL_AtomicSet is a full barrier, so the entry is visible before the new index */
+	SDL_AtomicSet(&queue->nextEntryToWrite, newNextEntryToWrite);
+	SDL_SemPost(queue->semaphore);
+}
+
+void CompleteAllWork(WorkQueue* queue)
+{
+	while (SDL_AtomicGet(&queue->completionGoal) != SDL_AtomicGet(&queue->completionCount)) {
+		DoNextWorkQueueEntry(queue);
+	}
+
+	SDL_AtomicSet(&queue->completionGoal, 0);
+	SDL_AtomicSet(&queue->completionCount, 0);
+}
+
+void DestroyWorkQueue(WorkQueue* queue)
+{
+	CompleteAllWork(queue);
+
+	SDL_AtomicSet(&queue->isRunning, 0);
+	for (int i = 0; i < queue->numThreads; i++) {
+		SDL_SemPost(queue->semaphore);
+	}
+	for (int i = 0; i < queue->numThreads; i++) {
+		SDL_WaitThread(queue->threads[i], NULL);
+	}
+
+	SDL_DestroySemaphore(queue->semaphore);
+	queue->numThreads = 0;
+}
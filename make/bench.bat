@@ -0,0 +1,19 @@
+@echo off
+
+set RELEASEVARS=/O2 /Oi /FC /W4 /wd4100 /nologo /Tp
+
+set code=..\code\bench_main.c
+
+set includes=/I "..\deps\includes"
+
+set libs=/link /LIBPATH:..\deps\libs\ SDL2.lib SDL2main.lib
+
+set options=%RELEASEVARS% %code% %includes% %libs%
+
+mkdir ..\bin
+xcopy /D "..\deps\libs\*.dll" "..\bin\"
+
+pushd ..\bin
+cl -EHsc %options% /SUBSYSTEM:CONSOLE
+call bench_main.exe %*
+popd